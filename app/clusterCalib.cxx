@@ -1,9 +1,16 @@
 #include "TClusterCalib.hxx"
 #include "TActivityFilter.hxx"
+#include "EventPipelineLoop.hxx"
+#include "TStageTimer.hxx"
+#include "TFFTPlans.hxx"
 
 #include <eventLoop.hxx>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 /// Run the cluster calibration on a file.
 class TClusterCalibLoop: public CP::TEventLoopFunction {
@@ -11,12 +18,16 @@ public:
     TClusterCalibLoop() {
         fClusterCalib = NULL;
         fActivityFilter = NULL;
+        fApplyFilter = false;
         fSaveCalib = false;
         fSaveDecorrel = false;
         fSaveDeconv = false;
         fCalibrateAllChannels = false;
         fApplyEfficiencyCalibration = true;
         fRemoveCorrelatedPedestal = true;
+        fLowRankNoise = false;
+        fThreads = 1;
+        fEventCount = 0;
     }
 
     virtual ~TClusterCalibLoop() {};
@@ -54,6 +65,20 @@ public:
                   << "Remove wire to wire correlations"
                   << " in the pedestal (slow)"
                   << std::endl;
+        std::cout << "   -O low-rank        "
+                  << "Remove the coherent noise with a low rank"
+                  << " approximation"
+                  << std::endl;
+        std::cout << "   -O threads=N       "
+                  << "Use N threads for the drift channels"
+                  << std::endl;
+        std::cout << "   -O timing=<file>   "
+                  << "Write the stage timing (.json or .csv)"
+                  << std::endl;
+        std::cout << "   -O wisdom=<file>   "
+                  << "Load and save the FFTW wisdom"
+                  << std::endl;
+        CP::EventPipelineUsage(true);
     }
 
     virtual bool SetOption(std::string option,std::string value="") {
@@ -66,59 +91,121 @@ public:
         else if (option.find("corr") == 0) {
             fRemoveCorrelatedPedestal = true;
         }
+        else if (option == "low-rank") {
+            fRemoveCorrelatedPedestal = true;
+            fLowRankNoise = true;
+        }
         else if (option == "no-efficiency") {
             CaptLog("Do not apply the collection efficiency calibration");
             fApplyEfficiencyCalibration = false;
         }
         else if (option == "efficiency") fApplyEfficiencyCalibration = true;
         else if (option == "all") fCalibrateAllChannels = true;
+        else if (option == "threads") {
+            std::istringstream vStr(value);
+            vStr >> fThreads;
+            if (fThreads < 1) fThreads = 1;
+        }
+        else if (option == "timing") fTimingFile = value;
+        else if (option == "wisdom") {
+            CP::TFFTPlans::Get().SetWisdomFile(value);
+        }
         else if (option == "filter") {
-            fActivityFilter = new CP::TActivityFilter();
-            if (value!="") {
-                std::istringstream vStr(value);
-                double v;
-                vStr >> v;
-                if (v>0) fActivityFilter->SetMinimumSignal(v);
-                char colon;
-                vStr >> colon;
-                if (colon != ':') return true;
-
-                int chan;
-                vStr >> chan;
-                if (chan>0) fActivityFilter->SetRequiredHits(chan);
-                vStr >> colon;
-                if (colon != ':') return true;
-
-                vStr >> v;
-                if (v>0) fActivityFilter->SetRequiredSignificance(v);
-                vStr >> colon;
-                if (colon != ':') return true;
-                
-                vStr >> chan;
-                if (chan>0) fActivityFilter->SetMaximumAllowedHits(chan);
-            }
+            fApplyFilter = true;
+            fFilterValue = value;
         }
         else return false;
         return true;
     }
 
-    bool operator () (CP::TEvent& event) {
-        if (!fClusterCalib) {
-            fClusterCalib = new CP::TClusterCalib();
-            // Set the action for the calibrated pulse digits.
-            fClusterCalib->SaveCalibratedPulses(fSaveCalib);
-            fClusterCalib->SaveDecorrelatedPulses(fSaveDecorrel);
-            fClusterCalib->SaveDeconvolvedPulses(fSaveDeconv);
-            fClusterCalib->CalibrateAllChannels(fCalibrateAllChannels);
-            fClusterCalib->ApplyEfficiencyCalibration(
-                fApplyEfficiencyCalibration);
-            fClusterCalib->RemoveCorrelations(fRemoveCorrelatedPedestal);
+    void Initialize() {
+        fStartTime = std::chrono::steady_clock::now();
+    }
+
+    void Finalize(CP::TRootOutput * const file) {
+        double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - fStartTime).count();
+        std::cout << "Calibrated " << fEventCount << " events in "
+                  << elapsed << " s";
+        if (elapsed > 0.0) {
+            std::cout << " (" << fEventCount/elapsed << " events/s)";
+        }
+        std::cout << std::endl;
+
+        // Combine the stage timing from all of the calibrations.
+        CP::TStageTimer timer;
+        for (std::size_t i = 0; i < fCalibs.size(); ++i) {
+            timer.Merge(fCalibs[i]->GetTimer());
+        }
+        timer.Print();
+        if (!fTimingFile.empty()) timer.Write(fTimingFile);
+
+        // The FFT planning is reported separately from the stages.
+        CP::TFFTPlans::Get().Print();
+        CP::TFFTPlans::Get().SaveWisdom();
+    }
+
+    /// Create a cluster calibration with the options that have been set.
+    /// The calibration is owned by the loop so the timing can be summarized
+    /// at the end of the job.
+    CP::TClusterCalib* MakeClusterCalib() {
+        CP::TClusterCalib* clusterCalib = new CP::TClusterCalib();
+        fCalibs.push_back(std::unique_ptr<CP::TClusterCalib>(clusterCalib));
+        // Set the action for the calibrated pulse digits.
+        clusterCalib->SaveCalibratedPulses(fSaveCalib);
+        clusterCalib->SaveDecorrelatedPulses(fSaveDecorrel);
+        clusterCalib->SaveDeconvolvedPulses(fSaveDeconv);
+        clusterCalib->CalibrateAllChannels(fCalibrateAllChannels);
+        clusterCalib->ApplyEfficiencyCalibration(
+            fApplyEfficiencyCalibration);
+        clusterCalib->RemoveCorrelations(fRemoveCorrelatedPedestal);
+        if (fLowRankNoise) clusterCalib->UseLowRankNoise();
+        clusterCalib->SetThreads(fThreads);
+        return clusterCalib;
+    }
+
+    /// Create the activity filter with the options that have been set.  This
+    /// returns NULL if the filter isn't being applied.
+    CP::TActivityFilter* MakeActivityFilter() {
+        if (!fApplyFilter) return NULL;
+        CP::TActivityFilter* activityFilter = new CP::TActivityFilter();
+        if (fFilterValue!="") {
+            std::istringstream vStr(fFilterValue);
+            double v;
+            vStr >> v;
+            if (v>0) activityFilter->SetMinimumSignal(v);
+            char colon;
+            vStr >> colon;
+            if (colon != ':') return activityFilter;
+
+            int chan;
+            vStr >> chan;
+            if (chan>0) activityFilter->SetRequiredHits(chan);
+            vStr >> colon;
+            if (colon != ':') return activityFilter;
+
+            vStr >> v;
+            if (v>0) activityFilter->SetRequiredSignificance(v);
+            vStr >> colon;
+            if (colon != ':') return activityFilter;
+                
+            vStr >> chan;
+            if (chan>0) activityFilter->SetMaximumAllowedHits(chan);
         }
+        return activityFilter;
+    }
+
+    /// Filter and calibrate one event.  This returns true if the event
+    /// should be saved.
+    bool Calibrate(CP::TEvent& event,
+                   CP::TClusterCalib& clusterCalib,
+                   CP::TActivityFilter* activityFilter) {
+        ++fEventCount;
 
         // Possibly run a filter to reject noise events using uncalibrated
         // data.
-        if (fActivityFilter) {
-            bool result = (*fActivityFilter)(event);
+        if (activityFilter) {
+            bool result = (*activityFilter)(event);
             if (!result) {
                 CaptLog("Reject " << event.GetContext());
                 return false;
@@ -126,13 +213,41 @@ public:
         }
         
         // Run the calibration on the event.
-        (*fClusterCalib)(event);
+        clusterCalib(event);
 
         // Save everything that gets to here.
         return true;
     }
 
+    bool operator () (CP::TEvent& event) {
+        if (!fClusterCalib) {
+            fClusterCalib = MakeClusterCalib();
+            fActivityFilter = MakeActivityFilter();
+        }
+        return Calibrate(event, *fClusterCalib, fActivityFilter);
+    }
+
+    /// Make the function used by the event pipeline.  Each worker gets
+    /// it's own cluster calibration and activity filter.
+    CP::TEventPipeline::Function MakeWorkers(int workers) {
+        typedef std::vector<CP::TClusterCalib*> Calibs;
+        typedef std::vector< std::shared_ptr<CP::TActivityFilter> > Filters;
+        std::shared_ptr<Calibs> clusterCalib(new Calibs);
+        std::shared_ptr<Filters> activityFilter(new Filters);
+        for (int w = 0; w < workers; ++w) {
+            clusterCalib->push_back(MakeClusterCalib());
+            activityFilter->push_back(
+                std::shared_ptr<CP::TActivityFilter>(MakeActivityFilter()));
+        }
+        return [this,clusterCalib,activityFilter](CP::TEvent& event,
+                                                  int worker) {
+            return Calibrate(event, *(*clusterCalib)[worker],
+                             (*activityFilter)[worker].get());
+        };
+    }
+
 private:
+    std::vector< std::unique_ptr<CP::TClusterCalib> > fCalibs;
     CP::TClusterCalib* fClusterCalib;
     CP::TActivityFilter* fActivityFilter;
     
@@ -142,9 +257,21 @@ private:
     bool fCalibrateAllChannels;
     bool fApplyEfficiencyCalibration;
     bool fRemoveCorrelatedPedestal;
+    bool fLowRankNoise;
+    bool fApplyFilter;
+    std::string fFilterValue;
+    int fThreads;
+    std::string fTimingFile;
+    std::atomic<int> fEventCount;
+    std::chrono::steady_clock::time_point fStartTime;
 };
 
 int main(int argc, char **argv) {
     TClusterCalibLoop userCode;
+    if (CP::UseEventPipeline(argc,argv)) {
+        return CP::EventPipelineLoop(
+            argc,argv,userCode,0,
+            [&](int workers) {return userCode.MakeWorkers(workers);});
+    }
     CP::eventLoop(argc,argv,userCode);
 }
@@ -0,0 +1,230 @@
+///////////////////////////////////////////////////////////////////
+// Time the calibration on synthetic events.  The events are generated in
+// memory (see CP::TSyntheticEvents), so no input file is needed.  The
+// number of channels and samples are swept, and the events per second and
+// the time per stage are reported for each point.  This shows how each
+// stage scales with the detector size.
+#include "TClusterCalib.hxx"
+#include "TSyntheticEvents.hxx"
+#include "TStageTimer.hxx"
+#include "TFFTPlans.hxx"
+
+#include <TEvent.hxx>
+#include <HEPUnits.hxx>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+    void Usage(const char* name) {
+        std::cout << "Usage: " << name << " [options]" << std::endl
+                  << "   -c N[,N...]  Channel counts to sweep"
+                  << " (default 500,2000,5000)" << std::endl
+                  << "   -s N[,N...]  Sample counts to sweep"
+                  << " (default 4096)" << std::endl
+                  << "   -e N         Events timed per point (default 5)"
+                  << std::endl
+                  << "   -w N         Warm up events per point (default 1)"
+                  << std::endl
+                  << "   -t N         Threads for the drift channels"
+                  << " (default 1)" << std::endl
+                  << "   -g ADC       Gaussian noise (default 3)"
+                  << std::endl
+                  << "   -G ADC       Coherent noise (default 2)"
+                  << std::endl
+                  << "   -a N         Channels sharing coherent noise"
+                  << " (default 32)" << std::endl
+                  << "   -l kHz:ADC   Add a noise line (may be repeated)"
+                  << std::endl
+                  << "   -k N         Tracks per event (default 2)"
+                  << std::endl
+                  << "   -n           Don't remove the correlated pedestal"
+                  << std::endl
+                  << "   -S           Run the staged calibration (as if"
+                  << " the calibrated pulses are saved)" << std::endl
+                  << "   -o file      Write the results as CSV"
+                  << std::endl;
+    }
+
+    /// Parse a comma separated list of integers.
+    std::vector<int> ParseList(const std::string& value) {
+        std::vector<int> result;
+        std::istringstream vStr(value);
+        std::string field;
+        while (std::getline(vStr,field,',')) {
+            if (field.empty()) continue;
+            result.push_back(std::atoi(field.c_str()));
+        }
+        return result;
+    }
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> channelCounts;
+    channelCounts.push_back(500);
+    channelCounts.push_back(2000);
+    channelCounts.push_back(5000);
+    std::vector<int> sampleCounts(1,4096);
+    int events = 5;
+    int warmUp = 1;
+    int threads = 1;
+    bool removeCorrelations = true;
+    bool staged = false;
+    std::string outputName;
+    CP::TSyntheticEvents generator;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:s:e:w:t:g:G:a:l:k:nSo:h")) != -1) {
+        switch (c) {
+        case 'c': channelCounts = ParseList(optarg); break;
+        case 's': sampleCounts = ParseList(optarg); break;
+        case 'e': events = std::max(1,std::atoi(optarg)); break;
+        case 'w': warmUp = std::max(0,std::atoi(optarg)); break;
+        case 't': threads = std::max(1,std::atoi(optarg)); break;
+        case 'g': generator.SetGaussianNoise(std::atof(optarg)); break;
+        case 'G': generator.SetCoherentNoise(std::atof(optarg)); break;
+        case 'a': generator.SetCoherentGroup(std::atoi(optarg)); break;
+        case 'l': {
+            std::istringstream vStr(optarg);
+            double frequency = 0.0;
+            double amplitude = 0.0;
+            char colon;
+            vStr >> frequency >> colon >> amplitude;
+            generator.AddNoiseLine(1000.0*frequency*unit::hertz, amplitude);
+            break;
+        }
+        case 'k': generator.SetTracks(std::atoi(optarg)); break;
+        case 'n': removeCorrelations = false; break;
+        case 'S': staged = true; break;
+        case 'o': outputName = optarg; break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The stages that are reported.
+    std::vector<std::string> stages;
+    stages.push_back("PMT");
+    stages.push_back("Calibrate");
+    stages.push_back("Correlations");
+    stages.push_back("Deconvolve");
+    stages.push_back("Hits");
+
+    std::ofstream csv;
+    if (!outputName.empty()) {
+        csv.open(outputName.c_str());
+        csv << "channels,samples,events,eventsPerSecond,msPerEvent,"
+            << "samplesPerSecond,hitsPerEvent";
+        for (std::size_t s = 0; s < stages.size(); ++s) {
+            csv << "," << stages[s] << "Ms";
+        }
+        csv << std::endl;
+    }
+
+    std::cout << std::setw(9) << "Channels"
+              << std::setw(9) << "Samples"
+              << std::setw(11) << "Events/s"
+              << std::setw(11) << "ms/event"
+              << std::setw(12) << "Samples/s"
+              << std::setw(10) << "Hits/evt";
+    for (std::size_t s = 0; s < stages.size(); ++s) {
+        std::cout << std::setw(13) << (stages[s] + "(ms)");
+    }
+    std::cout << std::endl;
+
+    int eventNumber = 0;
+    for (std::size_t ic = 0; ic < channelCounts.size(); ++ic) {
+        for (std::size_t is = 0; is < sampleCounts.size(); ++is) {
+            generator.SetChannels(channelCounts[ic]);
+            generator.SetSamples(sampleCounts[is]);
+
+            // A new calibration for each point so the timing starts fresh.
+            CP::TClusterCalib clusterCalib;
+            clusterCalib.CalibrateAllChannels(true);
+            clusterCalib.RemoveCorrelations(removeCorrelations);
+            clusterCalib.SaveCalibratedPulses(staged);
+            clusterCalib.SetThreads(threads);
+
+            for (int i = 0; i < warmUp; ++i) {
+                std::unique_ptr<CP::TEvent> event(
+                    generator.Generate(++eventNumber));
+                clusterCalib(*event);
+            }
+
+            // Remember the warm up totals so they can be removed.
+            std::vector<CP::TStageTimer::Totals> before;
+            for (std::size_t s = 0; s < stages.size(); ++s) {
+                before.push_back(
+                    clusterCalib.GetTimer().GetJobTotals(stages[s]));
+            }
+            CP::TStageTimer::Totals beforeEvent
+                = clusterCalib.GetTimer().GetJobTotals("Event");
+            CP::TStageTimer::Totals beforeDrift
+                = clusterCalib.GetTimer().GetJobTotals("Drift");
+
+            // The events are generated outside of the timed region.
+            for (int i = 0; i < events; ++i) {
+                std::unique_ptr<CP::TEvent> event(
+                    generator.Generate(++eventNumber));
+                clusterCalib(*event);
+            }
+
+            CP::TStageTimer::Totals total
+                = clusterCalib.GetTimer().GetJobTotals("Event");
+            CP::TStageTimer::Totals drift
+                = clusterCalib.GetTimer().GetJobTotals("Drift");
+            double seconds = total.fTime - beforeEvent.fTime;
+            double hits = drift.fHits - beforeDrift.fHits;
+            double samples = 1.0*events*channelCounts[ic]*sampleCounts[is];
+            double rate = 0.0;
+            double sampleRate = 0.0;
+            if (seconds > 0.0) {
+                rate = events/seconds;
+                sampleRate = samples/seconds;
+            }
+
+            std::cout << std::setw(9) << channelCounts[ic]
+                      << std::setw(9) << sampleCounts[is]
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(11) << rate
+                      << std::setw(11) << 1000.0*seconds/events
+                      << std::scientific << std::setprecision(3)
+                      << std::setw(12) << sampleRate
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(10) << hits/events
+                      << std::setprecision(3);
+            if (csv.is_open()) {
+                csv << channelCounts[ic] << "," << sampleCounts[is]
+                    << "," << events << "," << rate
+                    << "," << 1000.0*seconds/events
+                    << "," << sampleRate << "," << hits/events;
+            }
+            for (std::size_t s = 0; s < stages.size(); ++s) {
+                CP::TStageTimer::Totals after
+                    = clusterCalib.GetTimer().GetJobTotals(stages[s]);
+                double ms = 1000.0*(after.fTime - before[s].fTime)/events;
+                std::cout << std::setw(13) << ms;
+                if (csv.is_open()) csv << "," << ms;
+            }
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::endl;
+            if (csv.is_open()) csv << std::endl;
+        }
+    }
+
+    // The planning time isn't part of the stage times.
+    CP::TFFTPlans::Get().Print();
+    CP::TFFTPlans::Get().SaveWisdom();
+
+    return 0;
+}
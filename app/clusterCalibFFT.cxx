@@ -1,5 +1,7 @@
 #include "GaussianNoise.hxx"
 #include "FindPedestal.hxx"
+#include "EventPipelineLoop.hxx"
+#include "TFFTPlans.hxx"
 
 #include <eventLoop.hxx>
 #include <TPulseDigit.hxx>
@@ -53,6 +55,7 @@ public:
     void Usage(void) {
         std::cout << "   -O draw=<base-name> Output histograms to pdf file."
                   << std::endl;
+        CP::EventPipelineUsage();
     }
 
     void Initialize() {
@@ -69,6 +72,8 @@ public:
 
     void Finalize(CP::TRootOutput * const file) {
         std::cout << "Finalize the run " << std::endl;
+        CP::TFFTPlans::Get().Print();
+        CP::TFFTPlans::Get().SaveWisdom();
         if (fPrintFile.size() < 1) return;
 
          TCanvas c("clusterCalibFFT");
@@ -370,10 +375,11 @@ public:
             asic = 16*asic+chanInfo.GetASICChannel(pulse->GetChannelId())-1;
             
             if (!fFFT || nSize != fSampleCount) {
-                if (!fFFT) delete fFFT;
+                CP::TFFTPlans::Get().Release(fFFT);
                 CaptLog("Nyquist frequency: " << nyquistFreq);
                 CaptLog("Frequency bin size: " << deltaFreq);
-                fFFT = TVirtualFFT::FFT(1, &nSize, "R2C M K");
+                fFFT = CP::TFFTPlans::Get().Acquire(nSize,
+                                                    CP::TFFTPlans::kForward);
                 fSampleCount = nSize;
                 int overSample = 20;
                 
@@ -719,5 +725,8 @@ private:
 
 int main(int argc, char **argv) {
     TCalibHistsLoop userCode;
+    if (CP::UseEventPipeline(argc,argv)) {
+        return CP::EventPipelineLoop(argc,argv,userCode,1);
+    }
     CP::eventLoop(argc,argv,userCode,1);
 }
@@ -1,5 +1,6 @@
 #include "GaussianNoise.hxx"
 #include "FindPedestal.hxx"
+#include "EventPipelineLoop.hxx"
 
 #include <eventLoop.hxx>
 #include <HEPUnits.hxx>
@@ -37,6 +38,7 @@ public:
     void Usage(void) {
         std::cout << "   -O draw=<base-name> Output histograms to pdf file."
                   << std::endl;
+        CP::EventPipelineUsage();
     }
 
     void Initialize() {
@@ -152,5 +154,8 @@ private:
 
 int main(int argc, char **argv) {
     TCalibHistsLoop userCode;
+    if (CP::UseEventPipeline(argc,argv)) {
+        return CP::EventPipelineLoop(argc,argv,userCode,0);
+    }
     CP::eventLoop(argc,argv,userCode);
 }
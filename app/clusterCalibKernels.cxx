@@ -0,0 +1,539 @@
+///////////////////////////////////////////////////////////////////
+// Time the individual calibration kernels on fixed synthetic waveforms.
+// The waveforms come from a single CP::TSyntheticEvents event, and the
+// inputs for each kernel (raw, calibrated, and deconvolved pulses) are
+// prepared before any timing starts.  Each kernel is run over all of the
+// channels a few times to warm up, and is then timed for a number of
+// repeats.  The median, mean, standard deviation and minimum time per
+// sample (or per point) are reported, so a change to one kernel can be
+// measured without the rest of the calibration.
+#include "TPulseCalib.hxx"
+#include "TPulseDeconvolution.hxx"
+#include "TNoiseFilter.hxx"
+#include "TElectronicsResponse.hxx"
+#include "TWireResponse.hxx"
+#include "TWirePeaks.hxx"
+#include "TMakeWireHit.hxx"
+#include "TTmplDensityCluster.hxx"
+#include "TSyntheticEvents.hxx"
+#include "TStageTimer.hxx"
+#include "FindPedestal.hxx"
+#include "TruncatedRMS.hxx"
+#include "GaussianNoise.hxx"
+#include "TADCHistogram.hxx"
+#include "TFFTPlans.hxx"
+#include "TFFTBatch.hxx"
+
+#include <TEvent.hxx>
+#include <TPulseDigit.hxx>
+#include <TCalibPulseDigit.hxx>
+#include <TDigitContainer.hxx>
+#include <THitSelection.hxx>
+#include <TChannelInfo.hxx>
+#include <TChannelCalib.hxx>
+#include <TRuntimeParameters.hxx>
+
+#include <TRandom3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+    void Usage(const char* name) {
+        std::cout << "Usage: " << name << " [options]" << std::endl
+                  << "   -c N         Drift channels in the waveform set"
+                  << " (default 64)" << std::endl
+                  << "   -s N         Samples per waveform (default 4096)"
+                  << std::endl
+                  << "   -r N         Timed repeats per kernel (default 30)"
+                  << std::endl
+                  << "   -w N         Warm up repeats per kernel (default 3)"
+                  << std::endl
+                  << "   -p N         Points for the density clustering"
+                  << " (default 2000)" << std::endl
+                  << "   -k name      Only time kernels matching name"
+                  << " (may be repeated)" << std::endl
+                  << "   -o file      Write the results as CSV"
+                  << std::endl;
+    }
+
+    /// The timing for one kernel.  Each entry in fTimes is the time per
+    /// unit (in ns) for one repeat over the whole input set.
+    struct KernelResult {
+        std::string fName;
+        std::string fUnit;
+        double fUnits;
+        std::vector<double> fTimes;
+    };
+
+    /// Time a kernel.  The prepare function is called (untimed) before
+    /// each repeat to reset any input that the kernel changes, and the work
+    /// function runs the kernel over the input set and returns the number
+    /// of samples (or points) that were handled.
+    KernelResult TimeKernel(const std::string& name,
+                            const std::string& unit,
+                            int warmUp, int repeats,
+                            std::function<void ()> prepare,
+                            std::function<double ()> work) {
+        KernelResult result;
+        result.fName = name;
+        result.fUnit = unit;
+        result.fUnits = 0.0;
+        for (int i = 0; i < warmUp; ++i) {
+            prepare();
+            work();
+        }
+        for (int i = 0; i < repeats; ++i) {
+            prepare();
+            CP::TStageTimer::Clock::time_point start
+                = CP::TStageTimer::Now();
+            double units = work();
+            double seconds = CP::TStageTimer::Seconds(start);
+            result.fUnits = units;
+            if (units > 0.0) result.fTimes.push_back(1E+9*seconds/units);
+        }
+        return result;
+    }
+
+    /// Summarize the repeats for a kernel.
+    void Summarize(const KernelResult& result,
+                   double& median, double& mean,
+                   double& sigma, double& minimum) {
+        median = mean = sigma = minimum = 0.0;
+        std::vector<double> times(result.fTimes);
+        if (times.empty()) return;
+        std::sort(times.begin(), times.end());
+        std::size_t n = times.size();
+        median = times[n/2];
+        if (n%2 == 0) median = 0.5*(times[n/2-1] + times[n/2]);
+        minimum = times.front();
+        for (std::size_t i = 0; i < n; ++i) mean += times[i];
+        mean /= n;
+        if (n < 2) return;
+        for (std::size_t i = 0; i < n; ++i) {
+            sigma += (times[i]-mean)*(times[i]-mean);
+        }
+        sigma = std::sqrt(sigma/(n-1));
+    }
+
+    /// Check if a kernel should be timed.
+    bool Selected(const std::vector<std::string>& only,
+                  const std::string& name) {
+        if (only.empty()) return true;
+        for (std::size_t k = 0; k < only.size(); ++k) {
+            if (name.find(only[k]) != std::string::npos) return true;
+        }
+        return false;
+    }
+
+    /// The distance between two clustering points (see TActivityFilter).
+    class HitDistanceMetric {
+    public:
+        double operator() (const std::pair<double,double>& lhs,
+                           const std::pair<double,double>& rhs) {
+            double x = std::abs(lhs.first-rhs.first);
+            double z = std::abs(lhs.second-rhs.second);
+            return std::sqrt(x*x+z*z);
+        }
+    };
+    typedef CP::TTmplDensityCluster<std::pair<double,double>,
+                                    HitDistanceMetric> HitCluster;
+}
+
+int main(int argc, char **argv) {
+    int channels = 64;
+    int samples = 4096;
+    int repeats = 30;
+    int warmUp = 3;
+    int points = 2000;
+    std::vector<std::string> only;
+    std::string outputName;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:s:r:w:p:k:o:h")) != -1) {
+        switch (c) {
+        case 'c': channels = std::max(1,std::atoi(optarg)); break;
+        case 's': samples = std::max(16,std::atoi(optarg)); break;
+        case 'r': repeats = std::max(2,std::atoi(optarg)); break;
+        case 'w': warmUp = std::max(0,std::atoi(optarg)); break;
+        case 'p': points = std::max(1,std::atoi(optarg)); break;
+        case 'k': only.push_back(optarg); break;
+        case 'o': outputName = optarg; break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Make the inputs.  None of this is timed.
+    ///////////////////////////////////////////////////////////////////////
+    CP::TSyntheticEvents generator;
+    generator.SetChannels(channels);
+    generator.SetSamples(samples);
+    generator.SetPMTs(0);
+    std::unique_ptr<CP::TEvent> event(generator.Generate(1));
+    const CP::TEventContext& context = event->GetContext();
+    CP::TChannelInfo::Get().SetContext(context);
+
+    CP::THandle<CP::TDigitContainer> drift
+        = event->Get<CP::TDigitContainer>("~/digits/drift");
+    std::vector<const CP::TPulseDigit*> raw;
+    for (std::size_t d = 0; d < drift->size(); ++d) {
+        const CP::TPulseDigit* pulse
+            = dynamic_cast<const CP::TPulseDigit*>((*drift)[d]);
+        if (pulse) raw.push_back(pulse);
+    }
+
+    CP::TPulseCalib pulseCalib;
+    std::vector< std::unique_ptr<CP::TCalibPulseDigit> > calibrated;
+    for (std::size_t d = 0; d < drift->size(); ++d) {
+        CP::TDigitProxy proxy(*drift,d);
+        std::unique_ptr<CP::TCalibPulseDigit> digit(pulseCalib(proxy, context));
+        if (digit) calibrated.push_back(std::move(digit));
+    }
+
+    CP::TPulseDeconvolution deconvolution(samples);
+    std::vector< std::unique_ptr<CP::TCalibPulseDigit> > deconvolved;
+    for (std::size_t d = 0; d < calibrated.size(); ++d) {
+        std::unique_ptr<CP::TCalibPulseDigit> digit(
+            deconvolution(*calibrated[d], context));
+        if (digit) deconvolved.push_back(std::move(digit));
+    }
+
+    // The transformed waveforms and response functions for the noise
+    // filter.  This is the same as TPulseDeconvolution, but without the
+    // smoothing.
+    int fftSize = deconvolution.GetSampleCount();
+    CP::TFFTBatch* transforms
+        = CP::TFFTPlans::Get().AcquireBatch(fftSize, calibrated.size());
+    std::vector< std::unique_ptr<CP::TElectronicsResponse> > electronics;
+    std::vector< std::unique_ptr<CP::TWireResponse> > wires;
+    for (std::size_t d = 0; d < calibrated.size(); ++d) {
+        const CP::TCalibPulseDigit& digit = *calibrated[d];
+        double* buffer = transforms->GetReal(d);
+        for (int i = 0; i < fftSize; ++i) {
+            double v = 0.0;
+            if (i < (int) digit.GetSampleCount()) v = digit.GetSample(i);
+            buffer[i] = v;
+        }
+        electronics.push_back(std::unique_ptr<CP::TElectronicsResponse>(
+                                  new CP::TElectronicsResponse(fftSize)));
+        electronics.back()->Calculate(context, digit.GetChannelId());
+        wires.push_back(std::unique_ptr<CP::TWireResponse>(
+                            new CP::TWireResponse(fftSize)));
+        wires.back()->Calculate(context, digit.GetChannelId());
+    }
+    transforms->Forward();
+    CP::TNoiseFilter noiseFilter(
+        CP::TRuntimeParameters::Get().GetParameterD(
+            "clusterCalib.deconvolution.noisePower"),
+        CP::TRuntimeParameters::Get().GetParameterD(
+            "clusterCalib.deconvolution.spikePower"));
+
+    // The hit windows are centered on the largest sample of each
+    // deconvolved waveform.
+    CP::TChannelCalib channelCalib;
+    std::vector< std::pair<std::size_t,std::size_t> > windows;
+    std::vector<double> digitSteps;
+    for (std::size_t d = 0; d < deconvolved.size(); ++d) {
+        const CP::TCalibPulseDigit& digit = *deconvolved[d];
+        std::size_t peak = std::max_element(digit.begin(), digit.end())
+            - digit.begin();
+        std::size_t begin = (peak < 20) ? 0 : peak-20;
+        std::size_t end = std::min(peak+20, digit.GetSampleCount()-1);
+        windows.push_back(std::make_pair(begin,end));
+        digitSteps.push_back(
+            channelCalib.GetTimeConstant(digit.GetChannelId(),1));
+    }
+
+    // The clustering points are short lines (with wire spacing of 3 mm)
+    // and some isolated noise points.
+    TRandom3 random(4357);
+    std::vector< std::pair<double,double> > clusterPoints;
+    while ((int) clusterPoints.size() < points) {
+        if (random.Uniform() < 0.2) {
+            clusterPoints.push_back(
+                std::make_pair(random.Uniform(0.0,1000.0),
+                               random.Uniform(0.0,1000.0)));
+            continue;
+        }
+        double x = random.Uniform(0.0,1000.0);
+        double z = random.Uniform(0.0,1000.0);
+        double slope = random.Uniform(-2.0,2.0);
+        for (int i = 0; i < 20 && (int) clusterPoints.size() < points; ++i) {
+            clusterPoints.push_back(
+                std::make_pair(x + 3.0*i, z + 3.0*slope*i));
+        }
+    }
+
+    std::cout << "Kernel inputs: " << raw.size() << " raw, "
+              << calibrated.size() << " calibrated, "
+              << deconvolved.size() << " deconvolved waveforms of "
+              << samples << " samples (FFT length " << fftSize << "), "
+              << clusterPoints.size()
+              << " clustering points" << std::endl;
+
+    ///////////////////////////////////////////////////////////////////////
+    // Time the kernels.
+    ///////////////////////////////////////////////////////////////////////
+    std::function<void ()> nothing = [](){};
+    std::vector<double> work;
+    std::vector<KernelResult> results;
+
+    if (Selected(only,"FindPedestal")) results.push_back(TimeKernel(
+        "FindPedestal", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < raw.size(); ++d) {
+                CP::FindPedestal(raw[d]->begin(), raw[d]->end(), work);
+                n += raw[d]->GetSampleCount();
+            }
+            return n;
+        }));
+
+    if (Selected(only,"TruncatedRMS")) results.push_back(TimeKernel(
+        "TruncatedRMS", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < raw.size(); ++d) {
+                CP::TruncatedRMSWork(raw[d]->begin(), raw[d]->end(), work);
+                n += raw[d]->GetSampleCount();
+            }
+            return n;
+        }));
+
+    if (Selected(only,"GaussianNoise")) results.push_back(TimeKernel(
+        "GaussianNoise", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < raw.size(); ++d) {
+                CP::GaussianNoise(raw[d]->begin(), raw[d]->end(), work);
+                n += raw[d]->GetSampleCount();
+            }
+            return n;
+        }));
+
+    CP::TADCHistogram values;
+    CP::TADCHistogram differences;
+    if (Selected(only,"ADCHistogram")) results.push_back(TimeKernel(
+        "ADCHistogram", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < raw.size(); ++d) {
+                CP::TADCHistogram::Fill(raw[d]->begin(), raw[d]->end(),
+                                        values, differences);
+                values.GetQuantile(0.5);
+                values.GetTruncatedRMS();
+                differences.GetQuantile(0.52);
+                n += raw[d]->GetSampleCount();
+            }
+            return n;
+        }));
+
+    if (Selected(only,"TPulseDeconvolution")) results.push_back(TimeKernel(
+        "TPulseDeconvolution", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < calibrated.size(); ++d) {
+                std::unique_ptr<CP::TCalibPulseDigit> digit(
+                    deconvolution(*calibrated[d], context));
+                n += calibrated[d]->GetSampleCount();
+            }
+            return n;
+        }));
+
+    // RemoveBaseline is timed on deconvolutions that still have their
+    // baseline, and each channel uses the sample sigma from its own
+    // deconvolution.  RemoveBaseline changes the digit, so each repeat works
+    // on fresh copies.
+    std::vector< std::unique_ptr<CP::TCalibPulseDigit> > withBaseline;
+    std::vector<double> baselineSigmas;
+    std::vector< std::unique_ptr<CP::TCalibPulseDigit> > baselines;
+    if (Selected(only,"RemoveBaseline")) {
+        CP::TPulseDeconvolution keepBaseline(samples);
+        keepBaseline.SetRemoveBaseline(false);
+        for (std::size_t d = 0; d < calibrated.size(); ++d) {
+            std::unique_ptr<CP::TCalibPulseDigit> digit(
+                keepBaseline(*calibrated[d], context));
+            if (!digit) continue;
+            withBaseline.push_back(std::move(digit));
+            baselineSigmas.push_back(keepBaseline.GetSampleSigma(0));
+        }
+    }
+    if (Selected(only,"RemoveBaseline")) results.push_back(TimeKernel(
+        "RemoveBaseline", "sample", warmUp, repeats,
+        [&]() {
+            baselines.clear();
+            for (std::size_t d = 0; d < withBaseline.size(); ++d) {
+                baselines.push_back(std::unique_ptr<CP::TCalibPulseDigit>(
+                                        new CP::TCalibPulseDigit(
+                                            *withBaseline[d])));
+            }
+        },
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < baselines.size(); ++d) {
+                deconvolution.SetSampleSigma(baselineSigmas[d]);
+                deconvolution.RemoveBaseline(*baselines[d]);
+                n += baselines[d]->GetSampleCount();
+            }
+            return n;
+        }));
+    baselines.clear();
+    withBaseline.clear();
+
+    if (Selected(only,"TNoiseFilter")) results.push_back(TimeKernel(
+        "TNoiseFilter", "point", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < calibrated.size(); ++d) {
+                noiseFilter.Calculate(calibrated[d]->GetChannelId(),
+                                      *electronics[d], *wires[d],
+                                      transforms->GetComplex(d));
+                n += fftSize;
+            }
+            return n;
+        }));
+
+    // Compare the forward and inverse transforms of the digits at the FFT
+    // length the deconvolution used to use (the digit length rounded up to
+    // be even), and at the 2^a 3^b 5^c 7^d length it uses now.
+    int evenSize = 2*(1+samples/2);
+    CP::TFFTBatch* evenBatch = NULL;
+    if (Selected(only,"FFTEvenLength")) {
+        evenBatch = CP::TFFTPlans::Get().AcquireBatch(evenSize,
+                                                      calibrated.size());
+    }
+    CP::TFFTBatch* fastBatch = NULL;
+    if (Selected(only,"FFTFastLength")) {
+        fastBatch = CP::TFFTPlans::Get().AcquireBatch(fftSize,
+                                                      calibrated.size());
+    }
+    std::function<void (CP::TFFTBatch*)> fillBatch
+        = [&](CP::TFFTBatch* batch) {
+        for (std::size_t d = 0; d < calibrated.size(); ++d) {
+            const CP::TCalibPulseDigit& digit = *calibrated[d];
+            double* buffer = batch->GetReal(d);
+            for (int i = 0; i < batch->GetLength(); ++i) {
+                double v = 0.0;
+                if (i < (int) digit.GetSampleCount()) v = digit.GetSample(i);
+                buffer[i] = v;
+            }
+        }
+    };
+    if (evenBatch) results.push_back(TimeKernel(
+        "FFTEvenLength", "sample", warmUp, repeats,
+        [&]() {fillBatch(evenBatch);},
+        [&]() {
+            evenBatch->Forward();
+            evenBatch->Inverse();
+            return 1.0*calibrated.size()*samples;
+        }));
+    if (fastBatch) results.push_back(TimeKernel(
+        "FFTFastLength", "sample", warmUp, repeats,
+        [&]() {fillBatch(fastBatch);},
+        [&]() {
+            fastBatch->Forward();
+            fastBatch->Inverse();
+            return 1.0*calibrated.size()*samples;
+        }));
+    CP::TFFTPlans::Get().Release(evenBatch);
+    CP::TFFTPlans::Get().Release(fastBatch);
+
+    CP::TWirePeaks wirePeaks(false);
+    wirePeaks.SetContext(context);
+    CP::THitSelection peakHits("kernel");
+    if (Selected(only,"TWirePeaks")) results.push_back(TimeKernel(
+        "TWirePeaks", "sample", warmUp, repeats,
+        [&]() {peakHits.clear();},
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < deconvolved.size(); ++d) {
+                wirePeaks(peakHits, *deconvolved[d], 0.0);
+                n += deconvolved[d]->GetSampleCount();
+            }
+            return n;
+        }));
+    peakHits.clear();
+
+    CP::TMakeWireHit makeHit(false);
+    makeHit.SetContext(context);
+    if (Selected(only,"TMakeWireHit")) results.push_back(TimeKernel(
+        "TMakeWireHit", "sample", warmUp, repeats, nothing,
+        [&]() {
+            double n = 0.0;
+            for (std::size_t d = 0; d < deconvolved.size(); ++d) {
+                CP::THandle<CP::THit> hit
+                    = makeHit(*deconvolved[d], digitSteps[d], 0.0,
+                              windows[d].first, windows[d].second, false);
+                n += windows[d].second - windows[d].first + 1;
+            }
+            return n;
+        }));
+
+    if (Selected(only,"TTmplDensityCluster")) results.push_back(TimeKernel(
+        "TTmplDensityCluster", "point", warmUp, repeats, nothing,
+        [&]() {
+            HitCluster hitCluster(2,8.5);
+            hitCluster.Cluster(clusterPoints.begin(), clusterPoints.end());
+            return (double) clusterPoints.size();
+        }));
+
+    ///////////////////////////////////////////////////////////////////////
+    // Report the results.
+    ///////////////////////////////////////////////////////////////////////
+    std::ofstream csv;
+    if (!outputName.empty()) {
+        csv.open(outputName.c_str());
+        csv << "kernel,unit,units,repeats,medianNs,meanNs,sigmaNs,minimumNs"
+            << std::endl;
+    }
+
+    std::cout << std::left << std::setw(22) << "Kernel" << std::right
+              << std::setw(8) << "Unit"
+              << std::setw(10) << "Units"
+              << std::setw(9) << "Repeats"
+              << std::setw(12) << "Median(ns)"
+              << std::setw(12) << "Mean(ns)"
+              << std::setw(12) << "Sigma(ns)"
+              << std::setw(12) << "Min(ns)"
+              << std::endl;
+    for (std::size_t r = 0; r < results.size(); ++r) {
+        const KernelResult& result = results[r];
+        double median, mean, sigma, minimum;
+        Summarize(result, median, mean, sigma, minimum);
+        std::cout << std::left << std::setw(22) << result.fName << std::right
+                  << std::setw(8) << result.fUnit
+                  << std::setw(10) << (long) result.fUnits
+                  << std::setw(9) << result.fTimes.size()
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(12) << median
+                  << std::setw(12) << mean
+                  << std::setw(12) << sigma
+                  << std::setw(12) << minimum
+                  << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        if (csv.is_open()) {
+            csv << result.fName << "," << result.fUnit
+                << "," << (long) result.fUnits
+                << "," << result.fTimes.size()
+                << "," << median << "," << mean
+                << "," << sigma << "," << minimum << std::endl;
+        }
+    }
+
+    CP::TFFTPlans::Get().Release(transforms);
+    return 0;
+}
@@ -0,0 +1,522 @@
+///////////////////////////////////////////////////////////////////
+// Compare the calibration output against stored references.  The hits are
+// either read from calibrated files, or found by running TClusterCalib on
+// synthetic events (see CP::TSyntheticEvents).  The hit counts, times and
+// charges for each channel are compared to a golden reference within
+// tolerances, and the time per event for each calibration stage is compared
+// to a stored baseline so that slowdowns are flagged.  The references are
+// written with the same program (the -G and -B options).  The synthetic
+// events can be written to a file (the -W option) so that they can be
+// calibrated by another version of the code to make a reference.  The
+// program exits with a non-zero status if any comparison fails, and prints
+// "SUCCESS" or "FAILED" for the check.d scripts.
+#include "TClusterCalib.hxx"
+#include "TSyntheticEvents.hxx"
+#include "TStageTimer.hxx"
+
+#include <TEvent.hxx>
+#include <THitSelection.hxx>
+#include <TRootInput.hxx>
+#include <TRootOutput.hxx>
+#include <HEPUnits.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+    void Usage(const char* name) {
+        std::cout << "Usage: " << name << " [options] [calib-files]"
+                  << std::endl
+                  << "   -S N         Calibrate N synthetic events instead"
+                  << " of reading files" << std::endl
+                  << "   -c N         Synthetic drift channels"
+                  << " (default 500)" << std::endl
+                  << "   -s N         Synthetic samples (default 4096)"
+                  << std::endl
+                  << "   -w N         Synthetic warm up events that are not"
+                  << " timed (default 1)" << std::endl
+                  << "   -W file      Write the synthetic events without"
+                  << " calibrating them" << std::endl
+                  << "   -g file      Compare the hits to a golden reference"
+                  << std::endl
+                  << "   -G file      Write the hits as a golden reference"
+                  << std::endl
+                  << "   -t ns        Hit time tolerance (default 50)"
+                  << std::endl
+                  << "   -q frac      Relative hit charge tolerance"
+                  << " (default 0.02)" << std::endl
+                  << "   -n frac      Allowed fraction of unmatched hits"
+                  << " (default 0.01)" << std::endl
+                  << "   -b file      Compare the stage timing to a baseline"
+                  << std::endl
+                  << "   -B file      Write the stage timing as a baseline"
+                  << std::endl
+                  << "   -m file      Use a stage timing file (e.g. from"
+                  << " CLUSTERCALIB -O timing=file)" << std::endl
+                  << "   -p percent   Allowed slowdown (default 20)"
+                  << std::endl
+                  << "   -f ms        Stages faster than this per event are"
+                  << " not flagged (default 1)" << std::endl;
+    }
+
+    /// A hit is summarized by the time and charge.  The hits are kept by
+    /// channel name so the references don't depend on the channel
+    /// numbering.
+    typedef std::pair<double,double> Hit;
+    typedef std::map<std::string, std::vector<Hit> > ChannelHits;
+    typedef std::map<std::pair<int,int>, ChannelHits> EventHits;
+
+    /// The time per event (in ms) for each stage.
+    typedef std::map<std::string, double> StageTiming;
+
+    /// Add the hits in a selection to the channel hits for an event.
+    void AddHits(CP::THandle<CP::THitSelection> hits, ChannelHits& channels) {
+        if (!hits) return;
+        for (CP::THitSelection::iterator h = hits->begin();
+             h != hits->end(); ++h) {
+            channels[(*h)->GetChannelId().AsString()].push_back(
+                Hit((*h)->GetTime(), (*h)->GetCharge()));
+        }
+    }
+
+    /// Add all of the hits in an event.
+    void AddEvent(CP::TEvent& event, EventHits& eventHits) {
+        std::pair<int,int> key(event.GetContext().GetRun(),
+                               event.GetContext().GetEvent());
+        ChannelHits& channels = eventHits[key];
+        AddHits(event.GetHits("drift"), channels);
+        AddHits(event.GetHits("pmt"), channels);
+        for (ChannelHits::iterator c = channels.begin();
+             c != channels.end(); ++c) {
+            std::sort(c->second.begin(), c->second.end());
+        }
+    }
+
+    /// Write the hits as a reference.  The times are in ns.
+    bool WriteHits(const std::string& fileName, const EventHits& eventHits) {
+        std::ofstream out(fileName.c_str());
+        if (!out) {
+            std::cout << "Cannot write " << fileName << std::endl;
+            return false;
+        }
+        out << "# clusterCalib golden hits: run event channel time(ns) charge"
+            << std::endl;
+        out << std::setprecision(9);
+        for (EventHits::const_iterator e = eventHits.begin();
+             e != eventHits.end(); ++e) {
+            for (ChannelHits::const_iterator c = e->second.begin();
+                 c != e->second.end(); ++c) {
+                for (std::size_t h = 0; h < c->second.size(); ++h) {
+                    out << e->first.first << " " << e->first.second
+                        << " " << c->first
+                        << " " << c->second[h].first/unit::ns
+                        << " " << c->second[h].second << std::endl;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// Read a hit reference written by WriteHits.
+    bool ReadHits(const std::string& fileName, EventHits& eventHits) {
+        std::ifstream in(fileName.c_str());
+        if (!in) {
+            std::cout << "Cannot read " << fileName << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in,line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream lStr(line);
+            int run, event;
+            std::string channel;
+            double time, charge;
+            if (!(lStr >> run >> event >> channel >> time >> charge)) {
+                std::cout << "Invalid line in " << fileName << ": " << line
+                          << std::endl;
+                return false;
+            }
+            eventHits[std::make_pair(run,event)][channel].push_back(
+                Hit(time*unit::ns, charge));
+        }
+        for (EventHits::iterator e = eventHits.begin();
+             e != eventHits.end(); ++e) {
+            for (ChannelHits::iterator c = e->second.begin();
+                 c != e->second.end(); ++c) {
+                std::sort(c->second.begin(), c->second.end());
+            }
+        }
+        return true;
+    }
+
+    /// Compare the hits to the reference.  The hits on each channel are
+    /// matched in time order, and a hit is unmatched if there isn't a
+    /// reference hit within the time tolerance.  The comparison fails if an
+    /// event is missing, or if the fraction of unmatched hits (or of matched
+    /// hits with a different charge) is more than allowed.
+    bool CompareHits(const EventHits& golden, const EventHits& found,
+                     double timeTolerance, double chargeTolerance,
+                     double allowedFraction) {
+        bool success = true;
+        long goldenCount = 0;
+        long foundCount = 0;
+        long unmatched = 0;
+        long badCharge = 0;
+        double maxTimeDiff = 0.0;
+        double maxChargeDiff = 0.0;
+        for (EventHits::const_iterator e = golden.begin();
+             e != golden.end(); ++e) {
+            EventHits::const_iterator f = found.find(e->first);
+            if (f == found.end()) {
+                std::cout << "FAILED Missing event " << e->first.first
+                          << "." << e->first.second << std::endl;
+                success = false;
+                continue;
+            }
+            long eventGolden = 0;
+            long eventBad = 0;
+            // Look at all of the channels in either set of hits.
+            std::map<std::string,bool> channels;
+            for (ChannelHits::const_iterator c = e->second.begin();
+                 c != e->second.end(); ++c) channels[c->first] = true;
+            for (ChannelHits::const_iterator c = f->second.begin();
+                 c != f->second.end(); ++c) channels[c->first] = true;
+            static const std::vector<Hit> empty;
+            for (std::map<std::string,bool>::iterator c = channels.begin();
+                 c != channels.end(); ++c) {
+                ChannelHits::const_iterator gc = e->second.find(c->first);
+                ChannelHits::const_iterator fc = f->second.find(c->first);
+                const std::vector<Hit>& g
+                    = (gc == e->second.end()) ? empty : gc->second;
+                const std::vector<Hit>& h
+                    = (fc == f->second.end()) ? empty : fc->second;
+                eventGolden += g.size();
+                foundCount += h.size();
+                std::size_t i = 0;
+                std::size_t j = 0;
+                while (i < g.size() && j < h.size()) {
+                    double dt = h[j].first - g[i].first;
+                    if (dt < -timeTolerance) {++eventBad; ++j; continue;}
+                    if (dt > timeTolerance) {++eventBad; ++i; continue;}
+                    maxTimeDiff = std::max(maxTimeDiff, std::abs(dt));
+                    double dq = std::abs(h[j].second - g[i].second);
+                    double scale = std::max(std::abs(g[i].second), 1.0);
+                    maxChargeDiff = std::max(maxChargeDiff, dq/scale);
+                    if (dq > chargeTolerance*scale) ++badCharge;
+                    ++i;
+                    ++j;
+                }
+                eventBad += (g.size() - i) + (h.size() - j);
+            }
+            goldenCount += eventGolden;
+            unmatched += eventBad;
+            if (eventBad > allowedFraction*std::max(eventGolden,1L)) {
+                std::cout << "FAILED Event " << e->first.first
+                          << "." << e->first.second << " has "
+                          << eventBad << " unmatched hits out of "
+                          << eventGolden << std::endl;
+                success = false;
+            }
+        }
+        for (EventHits::const_iterator f = found.begin();
+             f != found.end(); ++f) {
+            if (golden.find(f->first) != golden.end()) continue;
+            std::cout << "FAILED Event " << f->first.first
+                      << "." << f->first.second << " is not in the reference"
+                      << std::endl;
+            success = false;
+        }
+        if (badCharge > allowedFraction*std::max(goldenCount,1L)) {
+            std::cout << "FAILED " << badCharge
+                      << " hits have a charge outside of the tolerance"
+                      << std::endl;
+            success = false;
+        }
+        std::cout << "Hits: " << goldenCount << " reference, "
+                  << foundCount << " found, "
+                  << unmatched << " unmatched, "
+                  << badCharge << " with a different charge" << std::endl;
+        std::cout << "Largest time difference: " << maxTimeDiff/unit::ns
+                  << " ns, largest relative charge difference: "
+                  << maxChargeDiff << std::endl;
+        return success;
+    }
+
+    /// Read the stage timing.  This reads the comma separated files written
+    /// by WriteTiming, and by CP::TStageTimer::WriteCSV (only the job totals
+    /// are used).
+    bool ReadTiming(const std::string& fileName, StageTiming& timing) {
+        std::ifstream in(fileName.c_str());
+        if (!in) {
+            std::cout << "Cannot read " << fileName << std::endl;
+            return false;
+        }
+        std::string line;
+        std::map<std::string,int> columns;
+        while (std::getline(in,line)) {
+            std::vector<std::string> fields;
+            std::istringstream lStr(line);
+            std::string field;
+            while (std::getline(lStr,field,',')) fields.push_back(field);
+            if (fields.empty()) continue;
+            if (columns.empty()) {
+                for (std::size_t i = 0; i < fields.size(); ++i) {
+                    columns[fields[i]] = i;
+                }
+                if (!columns.count("stage")) {
+                    std::cout << "No stage column in " << fileName
+                              << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            if (columns.count("scope") && fields[columns["scope"]] != "job") {
+                continue;
+            }
+            std::string stage = fields[columns["stage"]];
+            if (columns.count("msPerEvent")) {
+                timing[stage]
+                    = std::atof(fields[columns["msPerEvent"]].c_str());
+            }
+            else if (columns.count("time") && columns.count("events")) {
+                double events
+                    = std::atof(fields[columns["events"]].c_str());
+                double time = std::atof(fields[columns["time"]].c_str());
+                if (events > 0) timing[stage] = 1000.0*time/events;
+            }
+        }
+        return true;
+    }
+
+    /// Write the stage timing.
+    bool WriteTiming(const std::string& fileName, const StageTiming& timing) {
+        std::ofstream out(fileName.c_str());
+        if (!out) {
+            std::cout << "Cannot write " << fileName << std::endl;
+            return false;
+        }
+        out << "stage,msPerEvent" << std::endl;
+        out << std::setprecision(6);
+        for (StageTiming::const_iterator s = timing.begin();
+             s != timing.end(); ++s) {
+            out << s->first << "," << s->second << std::endl;
+        }
+        return true;
+    }
+
+    /// Compare the stage timing to the baseline.  A stage fails if it is
+    /// slower than the baseline by more than the allowed percentage.  Stages
+    /// that take less than the minimum are reported, but not flagged since
+    /// the relative fluctuations are large.
+    bool CompareTiming(const StageTiming& baseline, const StageTiming& found,
+                       double allowedPercent, double minimum) {
+        bool success = true;
+        std::cout << std::left << std::setw(16) << "Stage" << std::right
+                  << std::setw(14) << "Baseline(ms)"
+                  << std::setw(14) << "Found(ms)"
+                  << std::setw(10) << "Change"
+                  << std::endl;
+        for (StageTiming::const_iterator b = baseline.begin();
+             b != baseline.end(); ++b) {
+            StageTiming::const_iterator f = found.find(b->first);
+            if (f == found.end()) continue;
+            double change = 0.0;
+            if (b->second > 0.0) change = 100.0*(f->second/b->second - 1.0);
+            std::cout << std::left << std::setw(16) << b->first << std::right
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(14) << b->second
+                      << std::setw(14) << f->second
+                      << std::setprecision(1)
+                      << std::setw(9) << change << "%";
+            std::cout.unsetf(std::ios::floatfield);
+            if (change > allowedPercent && b->second >= minimum) {
+                std::cout << "  SLOWER";
+                success = false;
+            }
+            std::cout << std::endl;
+        }
+        if (!success) {
+            std::cout << "FAILED Stages are more than " << allowedPercent
+                      << "% slower than the baseline" << std::endl;
+        }
+        return success;
+    }
+}
+
+int main(int argc, char **argv) {
+    int syntheticEvents = 0;
+    int warmUp = 1;
+    std::string goldenName;
+    std::string writeGoldenName;
+    std::string baselineName;
+    std::string writeBaselineName;
+    std::string timingName;
+    std::string writeEventsName;
+    double timeTolerance = 50*unit::ns;
+    double chargeTolerance = 0.02;
+    double allowedFraction = 0.01;
+    double allowedPercent = 20.0;
+    double minimum = 1.0;
+    CP::TSyntheticEvents generator;
+    generator.SetChannels(500);
+
+    int c;
+    while ((c = getopt(argc, argv, "S:c:s:w:W:g:G:t:q:n:b:B:m:p:f:h")) != -1) {
+        switch (c) {
+        case 'S': syntheticEvents = std::max(0,std::atoi(optarg)); break;
+        case 'c': generator.SetChannels(std::atoi(optarg)); break;
+        case 's': generator.SetSamples(std::atoi(optarg)); break;
+        case 'w': warmUp = std::max(0,std::atoi(optarg)); break;
+        case 'W': writeEventsName = optarg; break;
+        case 'g': goldenName = optarg; break;
+        case 'G': writeGoldenName = optarg; break;
+        case 't': timeTolerance = std::atof(optarg)*unit::ns; break;
+        case 'q': chargeTolerance = std::atof(optarg); break;
+        case 'n': allowedFraction = std::atof(optarg); break;
+        case 'b': baselineName = optarg; break;
+        case 'B': writeBaselineName = optarg; break;
+        case 'm': timingName = optarg; break;
+        case 'p': allowedPercent = std::atof(optarg); break;
+        case 'f': minimum = std::atof(optarg); break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (syntheticEvents < 1 && optind >= argc) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Write the synthetic events that would be compared (the warm up events
+    // are generated, but not written, so the random sequence is the same).
+    ///////////////////////////////////////////////////////////////////////
+    if (!writeEventsName.empty()) {
+        if (syntheticEvents < 1) {
+            Usage(argv[0]);
+            return 1;
+        }
+        CP::TRootOutput output(writeEventsName.c_str());
+        if (!output.IsOpen()) {
+            std::cout << "FAILED Cannot write " << writeEventsName
+                      << std::endl;
+            return 1;
+        }
+        int eventNumber = 0;
+        for (int i = 0; i < warmUp + syntheticEvents; ++i) {
+            std::unique_ptr<CP::TEvent> event(
+                generator.Generate(++eventNumber));
+            if (i < warmUp) continue;
+            output.WriteEvent(*event);
+        }
+        output.Close();
+        std::cout << "Wrote " << syntheticEvents << " synthetic events to "
+                  << writeEventsName << std::endl;
+        return 0;
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Collect the hits and the stage timing.
+    ///////////////////////////////////////////////////////////////////////
+    EventHits found;
+    StageTiming timing;
+    if (syntheticEvents > 0) {
+        CP::TClusterCalib clusterCalib;
+        clusterCalib.CalibrateAllChannels(true);
+        int eventNumber = 0;
+        for (int i = 0; i < warmUp; ++i) {
+            std::unique_ptr<CP::TEvent> event(
+                generator.Generate(++eventNumber));
+            clusterCalib(*event);
+        }
+        const CP::TStageTimer& timer = clusterCalib.GetTimer();
+        StageTiming before;
+        for (std::size_t s = 0; s < timer.GetStages().size(); ++s) {
+            const std::string& stage = timer.GetStages()[s];
+            before[stage] = 1000.0*timer.GetJobTotals(stage).fTime;
+        }
+        for (int i = 0; i < syntheticEvents; ++i) {
+            std::unique_ptr<CP::TEvent> event(
+                generator.Generate(++eventNumber));
+            clusterCalib(*event);
+            AddEvent(*event, found);
+        }
+        for (std::size_t s = 0; s < timer.GetStages().size(); ++s) {
+            const std::string& stage = timer.GetStages()[s];
+            timing[stage] = (1000.0*timer.GetJobTotals(stage).fTime
+                             - before[stage])/syntheticEvents;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        CP::TRootInput input(argv[i]);
+        if (!input.IsOpen()) {
+            std::cout << "FAILED Cannot open " << argv[i] << std::endl;
+            return 1;
+        }
+        for (CP::TEvent* event = input.FirstEvent();
+             event; event = input.NextEvent()) {
+            AddEvent(*event, found);
+            delete event;
+        }
+    }
+    if (!timingName.empty()) {
+        timing.clear();
+        if (!ReadTiming(timingName, timing)) return 1;
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Write and compare the references.
+    ///////////////////////////////////////////////////////////////////////
+    bool success = true;
+    if (!writeGoldenName.empty()) {
+        if (!WriteHits(writeGoldenName, found)) success = false;
+        else std::cout << "Wrote golden hits to " << writeGoldenName
+                       << std::endl;
+    }
+    if (!writeBaselineName.empty()) {
+        if (!WriteTiming(writeBaselineName, timing)) success = false;
+        else std::cout << "Wrote timing baseline to " << writeBaselineName
+                       << std::endl;
+    }
+    if (!goldenName.empty()) {
+        EventHits golden;
+        if (!ReadHits(goldenName, golden)) success = false;
+        else if (!CompareHits(golden, found, timeTolerance,
+                              chargeTolerance, allowedFraction)) {
+            success = false;
+        }
+    }
+    if (!baselineName.empty()) {
+        StageTiming baseline;
+        if (timing.empty()) {
+            std::cout << "FAILED No stage timing to compare (use -S or -m)"
+                      << std::endl;
+            success = false;
+        }
+        else if (!ReadTiming(baselineName, baseline)) success = false;
+        else if (!CompareTiming(baseline, timing, allowedPercent, minimum)) {
+            success = false;
+        }
+    }
+
+    if (!success) {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "SUCCESS" << std::endl;
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Compare the hits found by 400GPSMuon5GeVThruHits.sh to the golden
+# reference.  The reference is kept with the package, and is made from the
+# baseline version of the package with reference/MakeReferences.sh.  A
+# missing input or reference is not a failure.  The check is SKIPPED and
+# exits with status 77, and the reference is never made here.
+# The tolerances can be changed with CLUSTERCALIB_REGRESSION_OPTIONS
+# (e.g. "-t 100 -q 0.05").
+
+INPUT=calib-400GPSMuon5GeVThruHits.root
+if [ ! -f ${INPUT} ]; then
+    echo SKIPPED Missing input file ${INPUT}
+    exit 77
+fi
+
+REFERENCE=${CLUSTERCALIBROOT}/check.d/reference/400GPSMuon5GeVThruHits.golden
+if [ ! -f ${REFERENCE} ]; then
+    echo SKIPPED Missing golden reference ${REFERENCE}
+    echo "Make it with check.d/reference/MakeReferences.sh"
+    exit 77
+fi
+
+if ! clusterCalib-regression.exe ${CLUSTERCALIB_REGRESSION_OPTIONS} \
+    -g ${REFERENCE} ${INPUT}; then
+    echo FAILED Hits in ${INPUT} do not match ${REFERENCE}
+    exit 1
+fi
+
+echo SUCCESS
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Calibrate synthetic events and compare the hits to the golden reference,
+# and the time per event for each stage to a timing baseline.  The golden
+# reference is made from the baseline version of the package with
+# reference/MakeReferences.sh.  A missing reference is not a failure.  The
+# check is SKIPPED and exits with status 77, and the reference is never made
+# here.  The timing depends on the machine, so the baseline is kept in the
+# working directory (or CLUSTERCALIB_TIMING_BASELINE), and is made on the
+# first run.  The allowed slowdown (in percent) is set with
+# CLUSTERCALIB_SLOWDOWN.
+
+EVENTS=5
+CHANNELS=500
+
+REFERENCE=${CLUSTERCALIBROOT}/check.d/reference/synthetic-${CHANNELS}.golden
+BASELINE=${CLUSTERCALIB_TIMING_BASELINE:-synthetic-${CHANNELS}-timing.csv}
+SLOWDOWN=${CLUSTERCALIB_SLOWDOWN:-20}
+
+if [ ! -f ${REFERENCE} ]; then
+    echo SKIPPED Missing golden reference ${REFERENCE}
+    echo "Make it with check.d/reference/MakeReferences.sh"
+    exit 77
+fi
+
+OPTIONS="-S ${EVENTS} -c ${CHANNELS} ${CLUSTERCALIB_REGRESSION_OPTIONS}"
+OPTIONS="${OPTIONS} -g ${REFERENCE}"
+if [ -f ${BASELINE} ]; then
+    OPTIONS="${OPTIONS} -b ${BASELINE} -p ${SLOWDOWN}"
+else
+    OPTIONS="${OPTIONS} -B ${BASELINE}"
+    echo "Making a new timing baseline: " ${BASELINE}
+fi
+
+if ! clusterCalib-regression.exe ${OPTIONS}; then
+    echo FAILED Synthetic event regression
+    exit 1
+fi
+
+echo SUCCESS
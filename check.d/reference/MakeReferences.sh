@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# Make the golden references used by 910CompareGoldenHits.sh and
+# 920SyntheticRegression.sh with the baseline version of the package, so
+# the checks compare the current calibration to the calibration before it
+# was optimized.  This is not run as a check.  It must be run in a
+# configured CMT environment with the current package built (the
+# clusterCalib-regression.exe from the current tree writes the synthetic
+# events and the references), and from the directory holding
+# elecsim-200GPSMuon5GeVThruDigits.root.  The baseline version is checked
+# out into a temporary work tree and built there.  The new references
+# should be checked and then committed.
+#
+# Usage: MakeReferences.sh [baseline-commit]
+#
+# The baseline commit defaults to the first commit of the package.
+
+set -e
+
+EVENTS=5
+CHANNELS=500
+INPUT=elecsim-200GPSMuon5GeVThruDigits.root
+
+HERE=$(cd $(dirname $0) && pwd)
+TOP=$(cd ${HERE}/../.. && pwd)
+RUN=$(pwd)
+BASELINE=${1:-$(git -C ${TOP} rev-list --max-parents=0 HEAD)}
+
+if [ ! -f ${INPUT} ]; then
+    echo FAILED Missing input file ${INPUT}
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap "git -C ${TOP} worktree remove --force ${WORK}/clusterCalib; \
+      rm -rf ${WORK}" EXIT
+
+# Write the synthetic events that 920SyntheticRegression.sh calibrates.
+clusterCalib-regression.exe -S ${EVENTS} -c ${CHANNELS} \
+    -W ${WORK}/synthetic-${CHANNELS}.root
+
+# Build the baseline version, and calibrate the events with it.  This is
+# done in a sub-shell so the baseline environment isn't kept.
+git -C ${TOP} worktree add --detach ${WORK}/clusterCalib ${BASELINE}
+(
+    cd ${WORK}/clusterCalib/cmt
+    cmt config
+    source setup.sh
+    make
+    cd ${RUN}
+    CLUSTERCALIB.exe -o ${WORK}/baseline-400.root ${INPUT}
+    CLUSTERCALIB.exe -O all -o ${WORK}/baseline-synthetic-${CHANNELS}.root \
+        ${WORK}/synthetic-${CHANNELS}.root
+)
+
+# Write the references from the baseline calibration.
+clusterCalib-regression.exe \
+    -G ${HERE}/400GPSMuon5GeVThruHits.golden ${WORK}/baseline-400.root
+clusterCalib-regression.exe \
+    -G ${HERE}/synthetic-${CHANNELS}.golden \
+    ${WORK}/baseline-synthetic-${CHANNELS}.root
+
+echo "Made the references from ${BASELINE} in ${HERE}"
@@ -0,0 +1,25 @@
+#ifndef ChannelInfoMutex_hxx_seen
+#define ChannelInfoMutex_hxx_seen
+#include <mutex>
+
+namespace CP {
+    /// The CP::TChannelInfo singleton holds the context for the whole
+    /// process, so the events that are processed on different threads can't
+    /// use it at the same time.  Every TChannelInfo access (setting the
+    /// context, and the lookups) must be done while holding this lock.  A
+    /// block of lookups for an event should set the context after taking
+    /// the lock so that the lookups use the context of the event.  The lock
+    /// is recursive so a function that takes the lock can be called while
+    /// the caller holds it.  CP::TChannelInfoLock takes the lock and sets
+    /// the context.
+    /// \code
+    /// std::lock_guard<std::recursive_mutex> lock(CP::ChannelInfoMutex());
+    /// CP::TChannelInfo::Get().SetContext(event.GetContext());
+    /// CP::TGeometryId id = CP::TChannelInfo::Get().GetGeometry(channel);
+    /// \endcode
+    inline std::recursive_mutex& ChannelInfoMutex() {
+        static std::recursive_mutex infoMutex;
+        return infoMutex;
+    }
+}
+#endif
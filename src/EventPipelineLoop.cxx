@@ -0,0 +1,306 @@
+#include "EventPipelineLoop.hxx"
+
+#include <TCaptLog.hxx>
+#include <TRootInput.hxx>
+#include <TRootOutput.hxx>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace {
+    /// Check if an option is handled by the event pipeline.
+    bool IsPipelineOption(const std::string& option) {
+        return (option == "events"
+                || option == "window"
+                || option == "read-ahead"
+                || option == "write-behind");
+    }
+
+    /// Split a "-O" argument into the option and the value.
+    void SplitOption(const std::string& argument,
+                     std::string& option, std::string& value) {
+        std::size_t equal = argument.find('=');
+        option = argument.substr(0,equal);
+        value = "";
+        if (equal != std::string::npos) value = argument.substr(equal+1);
+    }
+
+    /// Print the standard event loop flags that are understood when the
+    /// event pipeline is used.
+    void PipelineLoopUsage(const char* program,
+                           CP::TEventLoopFunction& userCode) {
+        CaptLog("Usage: " << program << " [options] input-file ...");
+        CaptLog("Options:");
+        CaptLog("    -d                Increase the debug level");
+        CaptLog("    -D <name>=[error,severe,warn,debug,trace]");
+        CaptLog("                      Change the named debug level");
+        CaptLog("    -h                This help message");
+        CaptLog("    -n <cnt>          Only read <cnt> events");
+        CaptLog("    -o <file>         Set the name of an output file");
+        CaptLog("    -O <opt>[=<val>]  Set an option for the user code");
+        CaptLog("    -q                Decrease the verbosity");
+        CaptLog("    -s <cnt>          Skip <cnt> events");
+        CaptLog("    -v                Increase the verbosity");
+        CaptLog("    -V <name>=[quiet,log,info,verbose]");
+        CaptLog("                      Change the named log level");
+        userCode.Usage();
+    }
+
+    /// Set a named debug level from a "-D name=level" argument.  This
+    /// returns false if the argument isn't understood.
+    bool SetNamedDebugLevel(const std::string& argument) {
+        std::string name;
+        std::string level;
+        SplitOption(argument,name,level);
+        if (name.empty() || level.empty()) return false;
+        switch (level[0]) {
+        case 'e': case 'E':
+            CP::TCaptLog::SetDebugLevel(name.c_str(),
+                                        CP::TCaptLog::ErrorLevel);
+            return true;
+        case 's': case 'S':
+            CP::TCaptLog::SetDebugLevel(name.c_str(),
+                                        CP::TCaptLog::SevereLevel);
+            return true;
+        case 'w': case 'W':
+            CP::TCaptLog::SetDebugLevel(name.c_str(),
+                                        CP::TCaptLog::WarnLevel);
+            return true;
+        case 'd': case 'D':
+            CP::TCaptLog::SetDebugLevel(name.c_str(),
+                                        CP::TCaptLog::DebugLevel);
+            return true;
+        case 't': case 'T':
+            CP::TCaptLog::SetDebugLevel(name.c_str(),
+                                        CP::TCaptLog::TraceLevel);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Set a named log level from a "-V name=level" argument.  This returns
+    /// false if the argument isn't understood.
+    bool SetNamedLogLevel(const std::string& argument) {
+        std::string name;
+        std::string level;
+        SplitOption(argument,name,level);
+        if (name.empty() || level.empty()) return false;
+        switch (level[0]) {
+        case 'q': case 'Q':
+            CP::TCaptLog::SetLogLevel(name.c_str(),
+                                      CP::TCaptLog::QuietLevel);
+            return true;
+        case 'l': case 'L':
+            CP::TCaptLog::SetLogLevel(name.c_str(),
+                                      CP::TCaptLog::LogLevel);
+            return true;
+        case 'i': case 'I':
+            CP::TCaptLog::SetLogLevel(name.c_str(),
+                                      CP::TCaptLog::InfoLevel);
+            return true;
+        case 'v': case 'V':
+            CP::TCaptLog::SetLogLevel(name.c_str(),
+                                      CP::TCaptLog::VerboseLevel);
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+void CP::EventPipelineUsage(bool events) {
+    if (events) {
+        CaptLog("   -O events=N        "
+                << "Process N events at the same time");
+        CaptLog("   -O window=N        "
+                << "Keep at most N events in flight (default 2*events)");
+    }
+    CaptLog("   -O read-ahead=N    "
+            << "Decode up to N events ahead in a reader thread");
+    CaptLog("   -O write-behind=N  "
+            << "Queue up to N events for a writer thread");
+}
+
+bool CP::UseEventPipeline(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* argument = argv[i];
+        if (std::strcmp(argument,"-O") == 0) {
+            if (i+1 >= argc) break;
+            argument = argv[++i];
+        }
+        else if (std::strncmp(argument,"-O",2) == 0) argument += 2;
+        else continue;
+        std::string option;
+        std::string value;
+        SplitOption(argument,option,value);
+        if (IsPipelineOption(option)) return true;
+    }
+    return false;
+}
+
+int CP::EventPipelineLoop(int argc, char** argv,
+                          CP::TEventLoopFunction& userCode,
+                          int defaultReadCount,
+                          CP::EventPipelineFactory factory) {
+    std::string outputName;
+    int maxEvents = -1;
+    if (defaultReadCount > 0) maxEvents = defaultReadCount;
+    int skipEvents = 0;
+    int events = 1;
+    int window = 0;
+    int readAhead = 0;
+    int writeBehind = 0;
+
+    // The flags are the same as for CP::eventLoop.  A flag that can't be
+    // handled with the event pipeline is an error instead of being ignored.
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "dD:hn:o:O:qs:vV:")) != -1) {
+        switch (c) {
+        case 'd': {
+            int level = CP::TCaptLog::GetDebugLevel() + 1;
+            CP::TCaptLog::SetDebugLevel(
+                static_cast<CP::TCaptLog::ErrorPriority>(level));
+            break;
+        }
+        case 'D':
+            if (!SetNamedDebugLevel(optarg)) {
+                CaptError("Invalid debug level: " << optarg);
+                PipelineLoopUsage(argv[0],userCode);
+                return 1;
+            }
+            break;
+        case 'q': {
+            int level = CP::TCaptLog::GetLogLevel() - 1;
+            if (level < CP::TCaptLog::QuietLevel) {
+                level = CP::TCaptLog::QuietLevel;
+            }
+            CP::TCaptLog::SetLogLevel(
+                static_cast<CP::TCaptLog::LogPriority>(level));
+            break;
+        }
+        case 'v': {
+            int level = CP::TCaptLog::GetLogLevel() + 1;
+            CP::TCaptLog::SetLogLevel(
+                static_cast<CP::TCaptLog::LogPriority>(level));
+            break;
+        }
+        case 'V':
+            if (!SetNamedLogLevel(optarg)) {
+                CaptError("Invalid log level: " << optarg);
+                PipelineLoopUsage(argv[0],userCode);
+                return 1;
+            }
+            break;
+        case 'h':
+            PipelineLoopUsage(argv[0],userCode);
+            return 0;
+        case 's': skipEvents = std::atoi(optarg); break;
+        case 'o': outputName = optarg; break;
+        case 'n': maxEvents = std::atoi(optarg); break;
+        case 'O': {
+            std::string option;
+            std::string value;
+            SplitOption(optarg,option,value);
+            if (IsPipelineOption(option)) {
+                int v = 0;
+                std::istringstream vStr(value);
+                vStr >> v;
+                if (option == "events") events = v;
+                else if (option == "window") window = v;
+                else if (option == "read-ahead") readAhead = v;
+                else if (option == "write-behind") writeBehind = v;
+            }
+            else if (!userCode.SetOption(option,value)) {
+                CaptError("Invalid option: " << optarg);
+                PipelineLoopUsage(argv[0],userCode);
+                return 1;
+            }
+            break;
+        }
+        default:
+            CaptError("The -" << (char) optopt << " flag is not supported"
+                      << " with the event pipeline options");
+            PipelineLoopUsage(argv[0],userCode);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        CaptError("No input files");
+        return 1;
+    }
+    if (events > 1 && !factory) {
+        CaptError("Only one event can be processed at a time");
+        return 1;
+    }
+
+    std::unique_ptr<CP::TRootOutput> output;
+    if (!outputName.empty()) {
+        output.reset(new CP::TRootOutput(outputName.c_str()));
+    }
+
+    // With one event at a time, the user code is run in this thread.
+    int workers = 0;
+    if (events > 1) workers = events;
+    CP::TEventPipeline pipeline(workers,window);
+    pipeline.SetReadAhead(readAhead);
+    pipeline.SetWriteBehind(writeBehind);
+    CaptLog("Event pipeline: " << std::max(1,workers) << " events"
+            << " with at most " << pipeline.GetWindow() << " in flight,"
+            << " read ahead " << pipeline.GetReadAhead() << ","
+            << " write behind " << pipeline.GetWriteBehind());
+
+    CP::TEventPipeline::Function work;
+    if (factory) work = factory(std::max(1,workers));
+    else {
+        work = [&](CP::TEvent& event, int) {return userCode(event);};
+    }
+
+    userCode.Initialize();
+    for (int i = optind; i < argc; ++i) {
+        CP::TRootInput input(argv[i]);
+        if (!input.IsOpen()) {
+            CaptError("Cannot open " << argv[i]);
+            continue;
+        }
+        // Skip the events at the start of the input.
+        while (skipEvents > 0) {
+            std::unique_ptr<CP::TEvent> event(input.NextEvent());
+            if (!event) break;
+            --skipEvents;
+        }
+        if (skipEvents > 0) {
+            input.CloseFile();
+            continue;
+        }
+        int count = -1;
+        if (0 <= maxEvents) count = maxEvents - pipeline.GetEventsRead();
+        pipeline.Process(input, output.get(), work, count);
+        input.CloseFile();
+        if (0 <= maxEvents && maxEvents <= pipeline.GetEventsRead()) break;
+    }
+    userCode.Finalize(output.get());
+    if (output) output->Close();
+
+    CaptLog("Event pipeline: " << pipeline.GetEventsRead() << " read, "
+            << pipeline.GetEventsWritten() << " written in "
+            << pipeline.GetElapsedTime() << " s");
+    CaptLog("    Waiting for input:  " << pipeline.GetInputWait() << " s");
+    CaptLog("    Waiting for output: " << pipeline.GetOutputWait() << " s");
+    CaptLog("    Processing events:  " << pipeline.GetComputeTime() << " s");
+    if (pipeline.GetReadAhead() > 0) {
+        CaptLog("    Reader thread busy: " << pipeline.GetReadTime() << " s");
+    }
+    if (pipeline.GetWriteBehind() > 0) {
+        CaptLog("    Writer thread busy: " << pipeline.GetWriteTime()
+                << " s");
+    }
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef EventPipelineLoop_hxx_seen
+#define EventPipelineLoop_hxx_seen
+
+#include "TEventPipeline.hxx"
+
+#include <eventLoop.hxx>
+
+#include <functional>
+
+namespace CP {
+    /// Make the processing function for an event pipeline.  The argument is
+    /// the number of workers, and the function that is returned will be
+    /// called with a worker number between zero and workers-1.  Any objects
+    /// needed by the workers should be created here (in the main thread) and
+    /// owned by the returned function.
+    typedef std::function<CP::TEventPipeline::Function (int workers)>
+    EventPipelineFactory;
+
+    /// Print the usage for the event pipeline options.  If events is true,
+    /// then the options to process several events at the same time are
+    /// included.
+    void EventPipelineUsage(bool events = false);
+
+    /// Check if the command line has any of the event pipeline options
+    /// ("-O events=N", "-O window=N", "-O read-ahead=N" or "-O
+    /// write-behind=N").
+    bool UseEventPipeline(int argc, char** argv);
+
+    /// Run an event loop using a CP::TEventPipeline to read ahead, write
+    /// behind, and (if a factory is provided) process several events at the
+    /// same time.  This is used instead of CP::eventLoop when
+    /// UseEventPipeline is true, and takes the same flags for the output
+    /// file, the event count, the events to skip, the debug and log levels,
+    /// and the user options.  A flag that can't be handled with the
+    /// pipeline is an error.  The pipeline options are handled here, and
+    /// the other "-O" options are passed to the user code.  Without a
+    /// factory, the events are handed to the user code one at a time in the
+    /// main thread.  The time spent waiting for the input and output is
+    /// reported after the user code is finalized.
+    int EventPipelineLoop(int argc, char** argv,
+                          CP::TEventLoopFunction& userCode,
+                          int defaultReadCount = 0,
+                          CP::EventPipelineFactory factory
+                          = CP::EventPipelineFactory());
+};
+#endif
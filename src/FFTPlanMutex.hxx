@@ -0,0 +1,18 @@
+#ifndef FFTPlanMutex_hxx_seen
+#define FFTPlanMutex_hxx_seen
+#include <mutex>
+
+namespace CP {
+    /// The FFTW planner used behind TVirtualFFT is not thread-safe, so the
+    /// plans must be created (and deleted) while holding this lock.
+    /// Executing an existing plan doesn't need the lock.
+    /// \code
+    /// std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    /// fFFT = TVirtualFFT::FFT(1, &nSize, "R2C M K");
+    /// \endcode
+    inline std::mutex& FFTPlanMutex() {
+        static std::mutex planMutex;
+        return planMutex;
+    }
+}
+#endif
@@ -0,0 +1,27 @@
+#ifndef FastFFTLength_hxx_seen
+#define FastFFTLength_hxx_seen
+#include <algorithm>
+
+namespace CP {
+    /// Return the smallest even length that is at least "minimum" and has
+    /// no prime factors larger than 7 (i.e. 2^a 3^b 5^c 7^d with a > 0).
+    /// FFTW has fast codelets for these factors, while a length with a
+    /// large prime factor can take many times longer to transform.  The
+    /// length is even so the spectrum always has a Nyquist frequency bin.
+    /// \code
+    /// int nSize = CP::FastFFTLength(sampleCount + taper);
+    /// \endcode
+    inline int FastFFTLength(int minimum) {
+        int length = std::max(2, minimum);
+        if (length%2 != 0) ++length;
+        for (;; length += 2) {
+            int remainder = length;
+            while (remainder%2 == 0) remainder /= 2;
+            while (remainder%3 == 0) remainder /= 3;
+            while (remainder%5 == 0) remainder /= 5;
+            while (remainder%7 == 0) remainder /= 7;
+            if (remainder == 1) return length;
+        }
+    }
+}
+#endif
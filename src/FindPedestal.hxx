@@ -9,23 +9,26 @@ namespace CP {
     /// Estimate the pedestal for samples between iterators [begin,end).  The
     /// pedestal is based on the median of the ADC values, and is interpolated
     /// around the median value. This will work for both integer and floating
-    /// point input iterators.  For example if
+    /// point input iterators.  The work vector is used as scratch space so
+    /// that a caller can reuse it between calls (each thread needs its own).
+    /// For example if
     /// \code
     /// const CP::TPulseDigit* pulse = digit.As<const CP::TPulseDigit>();
-    /// double pedestal = CP::FindPedestal(pulse->begin(), pulse->end());
+    /// std::vector<double> work;
+    /// double pedestal = CP::FindPedestal(pulse->begin(), pulse->end(), work);
     /// \endcode
-    template <typename iter>
-    double FindPedestal(iter begin, iter end) {
+    template <typename iter, typename work_vector>
+    double FindPedestal(iter begin, iter end, work_vector& work) {
         std::size_t length = end - begin;
-        static std::vector<typename iter::value_type> work;
         if (work.capacity() < length) work.reserve(length);
         work.clear();
         std::copy(begin,end,std::back_inserter(work));
         std::sort(work.begin(),work.end());
-        typename std::vector<typename iter::value_type>::iterator middle
+        typename work_vector::iterator middle
             = work.begin() + work.size()/2;
         if (middle == work.begin()) return *middle;
-        std::pair<iter,iter> bounds
+        std::pair<typename work_vector::iterator,
+                  typename work_vector::iterator> bounds
             = std::equal_range(work.begin(), work.end(), *middle);
         if (bounds.second == work.end()) {
             return *middle;
@@ -36,5 +39,12 @@ namespace CP {
         pedestal += *middle - diff;
         return pedestal;
     }
+
+    /// Estimate the pedestal using a temporary work area.
+    template <typename iter>
+    double FindPedestal(iter begin, iter end) {
+        std::vector<typename iter::value_type> work;
+        return FindPedestal(begin, end, work);
+    }
 }
 #endif
@@ -11,11 +11,12 @@ namespace CP {
     /// differences of two samples (that gives a sqrt(2)) and wanting the RMS
     /// (which is the 68%).  This gives 48% (which is 68%/sqrt(2)).  Then
     /// because of the ordering after the sort, the bin we look at is 1.0-52%.
-    template <typename iter>
-    double GaussianNoise(iter begin, iter end) {
+    /// The work vector is used as scratch space so that a caller can reuse
+    /// it between calls (each thread needs its own).
+    template <typename iter, typename work_vector>
+    double GaussianNoise(iter begin, iter end, work_vector& work) {
         if (begin == end) return 0.0;
         std::size_t length = end - begin;
-        static std::vector<typename iter::value_type> work;
         if (work.capacity() < length) work.reserve(length);
         work.clear();
         while (begin+1 != end) {
@@ -23,10 +24,11 @@ namespace CP {
             ++begin;
         }
         std::sort(work.begin(),work.end());
-        typename std::vector<typename iter::value_type>::iterator middle
+        typename work_vector::iterator middle
             = work.begin() + 0.52*work.size();
         if (middle == work.begin()) return *middle;
-        std::pair<iter,iter> bounds
+        std::pair<typename work_vector::iterator,
+                  typename work_vector::iterator> bounds
             = std::equal_range(work.begin(), work.end(), *middle);
         if (bounds.second == work.end()) {
             return *middle;
@@ -37,5 +39,13 @@ namespace CP {
         pedestal += *middle - diff;
         return pedestal;
     }
+
+    /// Calculate the channel-to-channel Gaussian sigma using a temporary
+    /// work area.
+    template <typename iter>
+    double GaussianNoise(iter begin, iter end) {
+        std::vector<typename iter::value_type> work;
+        return GaussianNoise(begin, end, work);
+    }
 }
 #endif
@@ -0,0 +1,131 @@
+#ifndef MatrixMultiply_hxx_seen
+#define MatrixMultiply_hxx_seen
+#include "ParallelFor.hxx"
+
+#include <algorithm>
+#include <vector>
+
+namespace CP {
+
+    /// The tile sizes used by the matrix multiplies.  A tile of the output
+    /// has kMultiplyRows by kMultiplyColumns elements, and kMultiplyDepth
+    /// elements of the inner dimension are handled at a time so that the
+    /// tiles being read stay in the cache.  The column tile is a multiple
+    /// of the SIMD width for float and double.
+    const std::size_t kMultiplyRows = 32;
+    const std::size_t kMultiplyColumns = 128;
+    const std::size_t kMultiplyDepth = 256;
+
+    /// Do the work for a tile of the output.  This adds a[i][k]*b[k][j] to
+    /// c[i][j] for i in [0,rows), j in [0,columns), and k in [0,depth).  The
+    /// innermost loop runs along the rows of b and c, so it's contiguous
+    /// and the compiler can vectorize it without reordering the sums.
+    template <typename T>
+    void MultiplyTile(std::size_t rows, std::size_t columns,
+                      std::size_t depth,
+                      const T* a, std::size_t lda,
+                      const T* b, std::size_t ldb,
+                      T* c, std::size_t ldc) {
+        for (std::size_t i = 0; i < rows; ++i) {
+            T* __restrict__ cRow = c + i*ldc;
+            const T* aRow = a + i*lda;
+            for (std::size_t k = 0; k < depth; ++k) {
+                const T aik = aRow[k];
+                if (aik == 0) continue;
+                const T* __restrict__ bRow = b + k*ldb;
+                for (std::size_t j = 0; j < columns; ++j) {
+                    cRow[j] += aik*bRow[j];
+                }
+            }
+        }
+    }
+
+    /// Calculate C = A*B where A is m by k, B is k by n, and C is m by n.
+    /// The matrices are stored by row, and the distance between rows is
+    /// given by lda, ldb and ldc.  The output is split into tiles that are
+    /// handed out to up to "threads" threads (see CP::ParallelFor).  This is
+    /// written so the compiler can vectorize the inner loop, and works with
+    /// float or double.
+    /// \code
+    /// std::vector<float> c(m*n);
+    /// CP::MatrixMultiply(threads, m, n, k, &a[0], k, &b[0], n, &c[0], n);
+    /// \endcode
+    template <typename T>
+    void MatrixMultiply(int threads,
+                        std::size_t m, std::size_t n, std::size_t k,
+                        const T* a, std::size_t lda,
+                        const T* b, std::size_t ldb,
+                        T* c, std::size_t ldc) {
+        std::size_t rowTiles = (m + kMultiplyRows - 1)/kMultiplyRows;
+        std::size_t columnTiles = (n + kMultiplyColumns - 1)/kMultiplyColumns;
+        CP::ParallelFor(
+            threads, rowTiles*columnTiles,
+            [&](std::size_t tile, int) {
+                std::size_t i0 = (tile/columnTiles)*kMultiplyRows;
+                std::size_t j0 = (tile%columnTiles)*kMultiplyColumns;
+                std::size_t rows = std::min(kMultiplyRows, m - i0);
+                std::size_t columns = std::min(kMultiplyColumns, n - j0);
+                for (std::size_t i = 0; i < rows; ++i) {
+                    std::fill(c + (i0+i)*ldc + j0,
+                              c + (i0+i)*ldc + j0 + columns, T(0));
+                }
+                for (std::size_t k0 = 0; k0 < k; k0 += kMultiplyDepth) {
+                    std::size_t depth = std::min(kMultiplyDepth, k - k0);
+                    MultiplyTile(rows, columns, depth,
+                                 a + i0*lda + k0, lda,
+                                 b + k0*ldb + j0, ldb,
+                                 c + i0*ldc + j0, ldc);
+                }
+            });
+    }
+
+    /// Calculate C = A*transpose(A) where A is n by k and C is n by n.  This
+    /// is the matrix of dot products between the rows of A.  Only the tiles
+    /// on or above the diagonal are calculated, and they are copied into the
+    /// lower half.  Each thread copies a tile of A into a transposed work
+    /// area so the tile can be multiplied with MultiplyTile.
+    template <typename T>
+    void SymmetricMultiply(int threads,
+                           std::size_t n, std::size_t k,
+                           const T* a, std::size_t lda,
+                           T* c, std::size_t ldc) {
+        std::size_t rowTiles = (n + kMultiplyRows - 1)/kMultiplyRows;
+        std::size_t columnTiles = (n + kMultiplyColumns - 1)/kMultiplyColumns;
+        std::vector< std::vector<T> > work(std::max(threads,1));
+        CP::ParallelFor(
+            threads, rowTiles*columnTiles,
+            [&](std::size_t tile, int worker) {
+                std::size_t i0 = (tile/columnTiles)*kMultiplyRows;
+                std::size_t j0 = (tile%columnTiles)*kMultiplyColumns;
+                // Skip the tiles that are entirely below the diagonal.
+                if (j0 + kMultiplyColumns <= i0) return;
+                std::size_t rows = std::min(kMultiplyRows, n - i0);
+                std::size_t columns = std::min(kMultiplyColumns, n - j0);
+                std::vector<T>& transposed = work[worker];
+                transposed.resize(kMultiplyDepth*kMultiplyColumns);
+                for (std::size_t i = 0; i < rows; ++i) {
+                    std::fill(c + (i0+i)*ldc + j0,
+                              c + (i0+i)*ldc + j0 + columns, T(0));
+                }
+                for (std::size_t k0 = 0; k0 < k; k0 += kMultiplyDepth) {
+                    std::size_t depth = std::min(kMultiplyDepth, k - k0);
+                    for (std::size_t j = 0; j < columns; ++j) {
+                        const T* aRow = a + (j0+j)*lda + k0;
+                        for (std::size_t d = 0; d < depth; ++d) {
+                            transposed[d*kMultiplyColumns + j] = aRow[d];
+                        }
+                    }
+                    MultiplyTile(rows, columns, depth,
+                                 a + i0*lda + k0, lda,
+                                 &transposed[0], kMultiplyColumns,
+                                 c + i0*ldc + j0, ldc);
+                }
+            });
+
+        // Fill the lower half from the upper half.
+        CP::ParallelFor(threads, n, [&](std::size_t i, int) {
+            for (std::size_t j = 0; j < i; ++j) c[i*ldc + j] = c[j*ldc + i];
+        });
+    }
+}
+#endif
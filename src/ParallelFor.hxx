@@ -0,0 +1,61 @@
+#ifndef ParallelFor_hxx_seen
+#define ParallelFor_hxx_seen
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CP {
+
+    /// Call work(index, worker) for every index in [0, count) using up to
+    /// "threads" threads.  The indices are handed out through a shared
+    /// counter so that slow items don't stall the other threads, and the
+    /// worker number is between zero and threads-1 so it can be used to pick
+    /// per-thread objects.  The calling thread is used as worker zero, and
+    /// the loop is run serially when threads is less than two.  If any call
+    /// throws, the remaining indices are skipped and the first exception is
+    /// rethrown in the calling thread.  The results must be stored by index
+    /// if the order matters.
+    /// \code
+    /// std::vector<double> result(input.size());
+    /// CP::ParallelFor(4, input.size(),
+    ///                 [&](std::size_t i, int w) {result[i] = f(input[i]);});
+    /// \endcode
+    template <typename Function>
+    void ParallelFor(int threads, std::size_t count, Function work) {
+        if (threads < 2 || count < 2) {
+            for (std::size_t i = 0; i < count; ++i) work(i,0);
+            return;
+        }
+        if ((std::size_t) threads > count) threads = count;
+
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> failed(false);
+        std::exception_ptr error;
+        std::mutex errorLock;
+
+        auto loop = [&](int worker) {
+            while (!failed) {
+                std::size_t i = next++;
+                if (count <= i) break;
+                try {
+                    work(i,worker);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(errorLock);
+                    if (!error) error = std::current_exception();
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int w = 1; w < threads; ++w) pool.push_back(std::thread(loop,w));
+        loop(0);
+        for (std::size_t w = 0; w < pool.size(); ++w) pool[w].join();
+
+        if (error) std::rethrow_exception(error);
+    }
+}
+#endif
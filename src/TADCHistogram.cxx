@@ -0,0 +1,105 @@
+#include "TADCHistogram.hxx"
+
+#include <algorithm>
+#include <cmath>
+
+CP::TADCHistogram::TADCHistogram()
+    : fMinimum(0), fEntries(0) {}
+
+CP::TADCHistogram::~TADCHistogram() {}
+
+bool CP::TADCHistogram::Reset(int minimum, int maximum) {
+    fEntries = 0;
+    if (maximum < minimum) {
+        fCounts.clear();
+        return false;
+    }
+    if (maximum - minimum >= kMaximumRange) {
+        fCounts.clear();
+        return false;
+    }
+    fMinimum = minimum;
+    fCounts.assign(maximum - minimum + 1, 0);
+    return true;
+}
+
+int CP::TADCHistogram::Locate(std::size_t rank,
+                              std::size_t& below,
+                              std::size_t& count) const {
+    below = 0;
+    count = 0;
+    for (std::size_t bin = 0; bin < fCounts.size(); ++bin) {
+        if (rank < below + fCounts[bin]) {
+            count = fCounts[bin];
+            return fMinimum + bin;
+        }
+        below += fCounts[bin];
+    }
+    return fMinimum + fCounts.size() - 1;
+}
+
+double CP::TADCHistogram::GetQuantile(double fraction) const {
+    if (fEntries < 1) return 0.0;
+    std::size_t rank = fraction*fEntries;
+    if (fEntries <= rank) rank = fEntries-1;
+    std::size_t below;
+    std::size_t count;
+    int value = Locate(rank, below, count);
+    if (rank == 0) return value;
+
+    // Find the next larger value.  If there isn't one, the quantile isn't
+    // interpolated.
+    std::size_t bin = value - fMinimum + 1;
+    while (bin < fCounts.size() && fCounts[bin] < 1) ++bin;
+    if (fCounts.size() <= bin) return value;
+    int next = fMinimum + bin;
+
+    double diff = 0.5*(next - value);
+    double quantile = 1.0*(rank-below);
+    quantile /= 1.0*count;
+    quantile += value - diff;
+    return quantile;
+}
+
+std::pair<double,double>
+CP::TADCHistogram::GetTruncatedRMS(double trunc) const {
+    std::size_t lowBound = trunc*fEntries;
+    std::size_t highBound = (1.0-trunc)*fEntries;
+    if (highBound < lowBound+1) return std::pair<double,double>(0.0,0.0);
+
+    // Sum the values with a rank in [lowBound, highBound).  The values are
+    // integers, so the sums are exact and don't depend on the order.
+    double average = 0.0;
+    double rms = 0.0;
+    double norm = 0.0;
+    std::size_t first = 0;
+    for (std::size_t bin = 0; bin < fCounts.size(); ++bin) {
+        std::size_t last = first + fCounts[bin];
+        std::size_t low = std::max(first, lowBound);
+        std::size_t high = std::min(last, highBound);
+        first = last;
+        if (high <= low) continue;
+        double value = fMinimum + (int) bin;
+        double n = high - low;
+        average += n*value;
+        rms += n*value*value;
+        norm += n;
+        if (highBound <= last) break;
+    }
+    average /= norm;
+    rms /= norm;
+    rms = (rms - average*average);
+    if (rms > 0.0) rms = std::sqrt(rms);
+    else rms = - std::sqrt(-rms);
+    return std::pair<double,double>(average,rms);
+}
+
+double CP::TADCHistogram::GetSumOfSquares(double center) const {
+    double sum = 0.0;
+    for (std::size_t bin = 0; bin < fCounts.size(); ++bin) {
+        if (fCounts[bin] < 1) continue;
+        double v = fMinimum + (int) bin - center;
+        sum += fCounts[bin]*v*v;
+    }
+    return sum;
+}
@@ -0,0 +1,130 @@
+#ifndef TADCHistogram_hxx_seen
+#define TADCHistogram_hxx_seen
+
+#include <cstdlib>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace CP {
+    class TADCHistogram;
+};
+
+/// A counting histogram of integer ADC values that is used to find the
+/// statistics of a raw waveform without sorting the samples.  The raw
+/// samples only cover a small range of integers, so the median, the
+/// quantiles and the truncated moments can be found by walking the
+/// histogram, which is linear in the number of samples (plus the range of
+/// the values).  The histogram keeps its storage between calls, so a caller
+/// that reuses the object doesn't allocate memory for each channel (each
+/// thread needs its own).  The values and the sample to sample differences
+/// are filled together with one pass over the samples.  The statistics are
+/// the same as CP::FindPedestal, CP::TruncatedRMS and CP::GaussianNoise.
+/// \code
+/// CP::TADCHistogram values;
+/// CP::TADCHistogram differences;
+/// if (CP::TADCHistogram::Fill(pulse->begin(), pulse->end(),
+///                             values, differences)) {
+///     double pedestal = values.GetQuantile(0.5);
+///     std::pair<double,double> avgRMS = values.GetTruncatedRMS();
+///     double gaussianSigma = differences.GetQuantile(0.52);
+/// }
+/// \endcode
+class CP::TADCHistogram {
+public:
+    /// The largest range of values that will be histogrammed.  A waveform
+    /// with a larger range needs to use the sorting versions.
+    static const int kMaximumRange = 1<<16;
+
+    TADCHistogram();
+    virtual ~TADCHistogram();
+
+    /// Empty the histogram and set the range of values to be between
+    /// minimum and maximum (inclusive).  This returns false if the range is
+    /// too large to be histogrammed.
+    bool Reset(int minimum, int maximum);
+
+    /// Add a value to the histogram.  The value must be in the range set by
+    /// Reset.
+    void Add(int value) {
+        ++fCounts[value-fMinimum];
+        ++fEntries;
+    }
+
+    /// Get the number of values in the histogram.
+    std::size_t GetEntries() const {return fEntries;}
+
+    /// Find the value that has a rank of "rank" in the sorted values (i.e.
+    /// the value that would be at work[rank] after a sort).  The number of
+    /// values that are smaller is returned in "below", and the number of
+    /// values that are the same is returned in "count".
+    int Locate(std::size_t rank, std::size_t& below, std::size_t& count) const;
+
+    /// Find the quantile for "fraction" of the values.  The value is
+    /// interpolated between the integers using the position in the values
+    /// that are the same as the quantile (this is the interpolation used by
+    /// CP::FindPedestal and CP::GaussianNoise).
+    double GetQuantile(double fraction) const;
+
+    /// Calculate the average and RMS of the values after removing the
+    /// fraction "trunc" of the values at the low and high ends (the same as
+    /// CP::TruncatedRMS).
+    std::pair<double,double> GetTruncatedRMS(double trunc=0.05) const;
+
+    /// Calculate the sum of the squared differences between the values and
+    /// "center".  For integer values and center, the sum is exact.
+    double GetSumOfSquares(double center) const;
+
+    /// Fill histograms of the values and of the absolute difference between
+    /// neighboring samples between the iterators [begin,end).  This returns
+    /// false (and the histograms are not valid) if the samples are not
+    /// integers, or have a range that is too large.
+    template <typename iter>
+    static bool Fill(iter begin, iter end,
+                     CP::TADCHistogram& values,
+                     CP::TADCHistogram& differences);
+
+private:
+    /// The value for the first bin of the histogram.
+    int fMinimum;
+
+    /// The number of times each value was added.
+    std::vector<std::size_t> fCounts;
+
+    /// The total number of values.
+    std::size_t fEntries;
+};
+
+template <typename iter>
+bool CP::TADCHistogram::Fill(iter begin, iter end,
+                             CP::TADCHistogram& values,
+                             CP::TADCHistogram& differences) {
+    typedef typename std::iterator_traits<iter>::value_type value_type;
+    if (!std::is_integral<value_type>::value) return false;
+    if (begin == end) {
+        values.Reset(0,0);
+        differences.Reset(0,0);
+        return true;
+    }
+    int minimum = *begin;
+    int maximum = *begin;
+    for (iter i = begin; i != end; ++i) {
+        int v = *i;
+        if (v < minimum) minimum = v;
+        if (maximum < v) maximum = v;
+    }
+    if (!values.Reset(minimum, maximum)) return false;
+    if (!differences.Reset(0, maximum-minimum)) return false;
+    iter i = begin;
+    int last = *i;
+    values.Add(last);
+    for (++i; i != end; ++i) {
+        int v = *i;
+        values.Add(v);
+        differences.Add(std::abs(v-last));
+        last = v;
+    }
+    return true;
+}
+#endif
@@ -1,5 +1,7 @@
 #include "TActivityFilter.hxx"
 #include "TTmplDensityCluster.hxx"
+#include "TADCHistogram.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TPulseDigit.hxx>
 #include <TCalibPulseDigit.hxx>
@@ -10,6 +12,7 @@
 #include <CaptGeomId.hxx>
 #include <HEPUnits.hxx>
 
+#include <algorithm>
 #include <vector>
 #include <utility>
 
@@ -45,16 +48,33 @@ CP::TActivityFilter::TActivityFilter() {
 CP::TActivityFilter::~TActivityFilter() {}
 
 bool CP::TActivityFilter::operator() (CP::TEvent& event) {
-    CP::TChannelInfo::Get().SetContext(event.GetContext());
-
     CP::THandle<CP::TDigitContainer> drift
         = event.Get<CP::TDigitContainer>("~/digits/drift");
     if (!drift) return false;
 
-    std::vector<double> work;
+    // Look up the geometry and calibration for all of the drift digits at
+    // once.  The channel information is shared by all of the threads, so the
+    // context for this event is set while holding the lock.  A channel is
+    // used if it's a good collection channel.
+    std::vector<CP::TGeometryId> geometry(drift->size());
+    std::vector<char> collection(drift->size());
+    {
+        CP::TChannelInfoLock lock(event.GetContext());
+        CP::TChannelCalib calib;
+        for (std::size_t d = 0; d < drift->size(); ++d) {
+            const CP::TDigit* digit = (*drift)[d];
+            if (!digit) continue;
+            CP::TChannelId cid = digit->GetChannelId();
+            geometry[d] = CP::TChannelInfo::Get().GetGeometry(cid);
+            collection[d] = (calib.IsGoodChannel(cid)
+                             && !calib.IsBipolarSignal(cid));
+        }
+    }
+
+    CP::TADCHistogram values;
+    CP::TADCHistogram differences;
     std::vector< std::pair<double,double> > collectionWireHits;
 
-    CP::TChannelCalib calib;
     for (std::size_t d = 0; d < drift->size(); ++d) {
         const CP::TPulseDigit* digit
             = dynamic_cast<const CP::TPulseDigit*>((*drift)[d]);
@@ -65,65 +85,60 @@ bool CP::TActivityFilter::operator() (CP::TEvent& event) {
 
         CP::TChannelId cid = digit->GetChannelId();
 
-        // Check if this is a bad channel.
-        if (!calib.IsGoodChannel(cid)) continue;
-        
-        // Check that we have a collection wire;
-        CP::TGeometryId geometryId = CP::TChannelInfo::Get().GetGeometry(cid);
+        // Check if this is a bad channel, and that we have a collection
+        // wire.
+        if (!collection[d]) continue;
+        CP::TGeometryId geometryId = geometry[d];
         if (!CP::GeomId::Captain::IsWire(geometryId)) continue;
-        if (calib.IsBipolarSignal(cid)) continue;
 
-        if (work.size() != digit->GetSampleCount()) {
-            work.resize(digit->GetSampleCount());
+        // Fill the histograms of the ADC values and the sample to sample
+        // differences.  All of the statistics for the channel are found from
+        // the histograms, so the samples are only read once.
+        if (!CP::TADCHistogram::Fill(digit->begin(), digit->end(),
+                                     values, differences)) {
+            CaptError("Channel " << cid << " cannot be histogrammed");
+            continue;
         }
+        std::size_t sampleCount = values.GetEntries();
+        if (sampleCount < 3) continue;
+        std::size_t below;
+        std::size_t count;
 
         // Calculate the pedestal for the channel.
-        for (std::size_t i=1; i< digit->GetSampleCount(); ++i) {
-            work[i] = digit->GetSample(i);
-        }
-        std::sort(work.begin(), work.end());
-        double pedestal = work[0.5*digit->GetSampleCount()];
+        double pedestal = values.Locate(0.5*sampleCount, below, count);
 
         // Reject channels that have a strange pedestals
         if (pedestal < 200) continue;
         if (pedestal > 3000) continue;
         
-        // Calculate the raw and Gaussian sigma for the channel.
-        double channelSigma = 0.0;
-        for (std::size_t i=1; i< digit->GetSampleCount(); ++i) {
-            double v = digit->GetSample(i) - pedestal;
-            channelSigma += v*v;
-            work[i] = std::abs(digit->GetSample(i)-digit->GetSample(i-1));
-        }
-        channelSigma /= digit->GetSampleCount();
+        // Calculate the raw sigma for the channel.  The first sample isn't
+        // included in the sum.  The values and pedestal are integers so the
+        // sums are exact.
+        double channelSigma = values.GetSumOfSquares(pedestal);
+        double first = digit->GetSample(0) - pedestal;
+        channelSigma -= first*first;
+        channelSigma /= sampleCount;
         channelSigma = std::sqrt(channelSigma);
 
         // Reject channels that don't show any activity.
         if (channelSigma < 0.5) continue;
 
-        // Find the "RMS" based on sample to sample fluctuations.
-        work[0] = 0.0;
-        std::sort(work.begin(), work.end());
-        int iMedian = 0.52*digit->GetSampleCount();
-
-        // Count the number of channels that have the same value as the median
-        // ADC difference.
-        int iLow = iMedian;
-        while (iLow > 0) {
-            if (work[iLow] != work[iMedian]) break;
-            --iLow;
-        }
-        int iHigh = iMedian;
-        while ((std::size_t) (iHigh+1)<work.size()) {
-            if (work[iHigh] != work[iMedian]) break;
-            ++iHigh;
-        }
+        // Find the "RMS" based on sample to sample fluctuations.  This
+        // includes a zero difference for the first sample.
+        differences.Add(0);
+        std::size_t iMedian = 0.52*sampleCount;
+        double median = differences.Locate(iMedian, below, count);
+
+        // Find the range of the differences that have the same value as the
+        // median ADC difference.
+        std::size_t iLow = (below > 0) ? below-1 : 0;
+        std::size_t iHigh = std::min(below+count, sampleCount-1);
         double lowDiff = iMedian-iLow;
         double diff = iHigh - iLow;
 
         // Interpolate between the integer values for the ADC counts to find
         // the interpolated median.
-        double gaussianSigma = work[iMedian] + lowDiff/diff;
+        double gaussianSigma = median + lowDiff/diff;
 
         // Check if there is activity on this channel.  This ignores the very
         // beginning and very end of the time window.
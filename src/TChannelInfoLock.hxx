@@ -0,0 +1,44 @@
+#ifndef TChannelInfoLock_hxx_seen
+#define TChannelInfoLock_hxx_seen
+
+#include "ChannelInfoMutex.hxx"
+
+#include <TChannelInfo.hxx>
+#include <TEventContext.hxx>
+
+#include <mutex>
+
+namespace CP {
+    class TChannelInfoLock;
+};
+
+/// Hold the CP::ChannelInfoMutex() and set the CP::TChannelInfo context for
+/// an event while a block of channel information or calibration lookups is
+/// done.  The lookups can be made from any thread, and will use the context
+/// of the event that is being processed, not the context set by the last
+/// thread to use the channel information.  If the context isn't valid (e.g.
+/// a caller that doesn't know the event), the context already set by the
+/// caller is used.  The lock is released when the object is destroyed, or
+/// by Unlock.
+/// \code
+/// {
+///     CP::TChannelInfoLock lock(event.GetContext());
+///     CP::TChannelCalib calib;
+///     bipolar = calib.IsBipolarSignal(channel);
+/// }
+/// \endcode
+class CP::TChannelInfoLock {
+public:
+    explicit TChannelInfoLock(const CP::TEventContext& context)
+        : fLock(CP::ChannelInfoMutex()) {
+        if (context.IsValid()) CP::TChannelInfo::Get().SetContext(context);
+    }
+
+    /// Release the lock before the object is destroyed.
+    void Unlock() {fLock.unlock();}
+
+private:
+    /// The lock on CP::ChannelInfoMutex().
+    std::unique_lock<std::recursive_mutex> fLock;
+};
+#endif
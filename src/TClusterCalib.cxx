@@ -1,8 +1,13 @@
 #include "TClusterCalib.hxx"
 #include "TPulseCalib.hxx"
 #include "TPulseDeconvolution.hxx"
+#include "TCoherentNoise.hxx"
 #include "TPMTMakeHits.hxx"
 #include "TWirePeaks.hxx"
+#include "ParallelFor.hxx"
+#include "MatrixMultiply.hxx"
+#include "TStageTimer.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TPulseDigit.hxx>
 #include <TCalibPulseDigit.hxx>
@@ -21,15 +26,324 @@
 #include <TH1F.h>
 #include <TH2F.h>
 #include <TProfile.h>
+#include <RVersion.h>
+#if ROOT_VERSION(6,0,0) < ROOT_VERSION_CODE
+#include <TROOT.h>
+#endif
 
 #include <memory>
 #include <limits>
+#include <algorithm>
 
 // The next two includes are for debugging against MC input.  The are needed
 // to fill some diagnostic histograms.
 #include <TPulseMCDigit.hxx>
 #include <TMCChannelId.hxx>
 
+namespace {
+    /// Call work(first, last, worker, hits) for every block of channel
+    /// indices [first, last) in [0, count).  Each block gets it's own hit
+    /// selection.  The blocks are then merged in order so the hits are in
+    /// the same order as if the channels had been done one at a time.
+    template <typename Function>
+    void BlockParallelHits(int threads, std::size_t count,
+                           std::size_t blockSize,
+                           CP::THitSelection& hits, Function work) {
+        blockSize = std::max(std::size_t(1), blockSize);
+        std::size_t blocks = (count + blockSize - 1)/blockSize;
+        std::vector< std::unique_ptr<CP::THitSelection> > blockHits;
+        for (std::size_t b = 0; b < blocks; ++b) {
+            blockHits.push_back(std::unique_ptr<CP::THitSelection>(
+                                    new CP::THitSelection("drift-block")));
+        }
+        CP::ParallelFor(
+            threads, blocks,
+            [&](std::size_t b, int worker) {
+                std::size_t last = std::min((b+1)*blockSize, count);
+                work(b*blockSize, last, worker, *blockHits[b]);
+            });
+        for (std::size_t b = 0; b < blocks; ++b) {
+            hits.insert(hits.end(),
+                        blockHits[b]->begin(), blockHits[b]->end());
+        }
+    }
+
+    /// Count the calibrated rows in the waveform matrix.
+    long CountRows(const CP::TWaveformMatrix& waveforms) {
+        long rows = 0;
+        for (std::size_t r = 0; r < waveforms.GetRows(); ++r) {
+            if (waveforms.HasFlag(r, CP::TWaveformMatrix::kCalibrated)) {
+                ++rows;
+            }
+        }
+        return rows;
+    }
+
+    /// Count the samples in the calibrated rows of the waveform matrix.
+    long CountSamples(const CP::TWaveformMatrix& waveforms) {
+        long samples = 0;
+        for (std::size_t r = 0; r < waveforms.GetRows(); ++r) {
+            if (waveforms.HasFlag(r, CP::TWaveformMatrix::kCalibrated)) {
+                samples += waveforms.GetSampleCount(r);
+            }
+        }
+        return samples;
+    }
+
+    /// Get a key that is the same for channels in the same electronics
+    /// group.  The group is the motherboard, or the ASIC on the motherboard.
+    /// This returns a negative value if the channel isn't in a group.  The
+    /// caller must hold a CP::TChannelInfoLock for the event.
+    long ElectronicsKey(const CP::TChannelId& id, bool motherboard) {
+        CP::TChannelInfo& info = CP::TChannelInfo::Get();
+        long key = info.GetMotherboard(id);
+        if (key < 0 || motherboard) return key;
+        int asic = info.GetASIC(id);
+        if (asic < 0) return -1;
+        return 1000*key + asic;
+    }
+
+    /// Find the correlation between two rows of the waveform matrix using
+    /// every fourth sample.  The correlation is averaged over the samples in
+    /// the second row.
+    double PairCorrelation(const CP::TWaveformMatrix& waveforms,
+                           const std::vector<double>& sigmas,
+                           std::size_t d1, std::size_t d2) {
+        const float* samples1 = waveforms.GetRow(d1);
+        const float* samples2 = waveforms.GetRow(d2);
+        std::size_t count2 = waveforms.GetSampleCount(d2);
+        double corr12 = 0.0;
+        int steps = 0;
+        for (std::size_t i=0; i<count2; i += 4) {
+            double p1 = samples1[i];
+            double p2 = samples2[i];
+            corr12 += p1*p2;
+            ++steps;
+        }
+        if (steps < 1) return 0.0;
+        corr12 /= steps;
+        corr12 /= (sigmas[d1]*sigmas[d2]);
+        return corr12;
+    }
+
+    /// Find the correlations between all of the good rows of the waveform
+    /// matrix with a matrix multiply done with type T (float or double).
+    /// The correlations are the dot products between every fourth sample of
+    /// the sigma normalized rows, so they are Y*transpose(Y).  The result is
+    /// a "2d" array indexed by the position in the good vector.  Each
+    /// correlation is averaged over the samples in the later row.
+    template <typename T>
+    void DenseCorrelations(int threads,
+                           const CP::TWaveformMatrix& waveforms,
+                           const std::vector<std::size_t>& good,
+                           const std::vector<double>& sigmas,
+                           std::size_t pulseSamples,
+                           std::vector<T>& correlations) {
+        const std::size_t n = good.size();
+        correlations.resize(n*n);
+        if (n < 1) return;
+
+        // Fill every fourth sample of the normalized rows.  Samples past the
+        // end of a row are zero.
+        const std::size_t depth = (pulseSamples + 3)/4;
+        std::vector<T> y(n*depth);
+        CP::ParallelFor(threads, n, [&](std::size_t g, int) {
+            std::size_t d = good[g];
+            const float* samples = waveforms.GetRow(d);
+            std::size_t count
+                = std::min(waveforms.GetSampleCount(d), pulseSamples);
+            double norm = 1.0/sigmas[d];
+            T* yRow = &y[g*depth];
+            for (std::size_t k = 0; 4*k < count; ++k) {
+                yRow[k] = samples[4*k]*norm;
+            }
+        });
+
+        CP::SymmetricMultiply(threads, n, depth, &y[0], depth,
+                              &correlations[0], n);
+
+        CP::ParallelFor(threads, n, [&](std::size_t g1, int) {
+            T* row = &correlations[g1*n];
+            for (std::size_t g2 = 0; g2 < n; ++g2) {
+                std::size_t count2
+                    = waveforms.GetSampleCount(good[std::max(g1,g2)]);
+                std::size_t steps = (count2 + 3)/4;
+                row[g2] = (steps > 0) ? row[g2]/steps : 0;
+            }
+        });
+    }
+
+    /// The number of samples in each block used to subtract the correlated
+    /// pedestal.  The pedestal for a sample only depends on the same sample
+    /// in the other rows, so the samples can be done a block at a time with
+    /// a work area that is proportional to the number of rows.
+    const std::size_t kPedestalBlock = 256;
+
+    /// Subtract the correlated pedestals from the good rows of the waveform
+    /// matrix using matrix multiplies done with type T (float or double).
+    /// The pedestals are the correlation weighted sums of the normalized
+    /// rows, so they are W*Z where W holds the weights (zero for pairs that
+    /// aren't strongly correlated) and Z holds the normalized rows.  The
+    /// samples are handled in blocks, and the pedestal for a block is
+    /// subtracted in place as soon as it's found.  This returns the number
+    /// of rows with strong correlations.
+    template <typename T>
+    int SubtractDenseCorrelatedPedestals(int threads,
+                                         CP::TWaveformMatrix& waveforms,
+                                         const std::vector<std::size_t>& good,
+                                         const std::vector<double>& sigmas,
+                                         std::size_t pulseSamples) {
+        const std::size_t n = good.size();
+        if (n < 1) return 0;
+
+        // Fill a "2d" array of wire to wire correlations.
+        std::vector<T> correlations;
+        DenseCorrelations(threads, waveforms, good, sigmas, pulseSamples,
+                          correlations);
+
+        // Turn the correlations into weights.  Only pairs with a strong
+        // correlation are used, and the weight favors channels with high
+        // correlations.
+        std::vector<double> weights(n);
+        CP::ParallelFor(threads, n, [&](std::size_t g1, int) {
+            T* row = &correlations[g1*n];
+            for (std::size_t g2 = 0; g2 < n; ++g2) {
+                double w = row[g2];
+                if (g1 == g2 || w < 0.6) {
+                    row[g2] = 0;
+                    continue;
+                }
+                w = w*w*w;
+                row[g2] = w;
+                weights[g1] += w;
+            }
+        });
+
+        // Find the correlation weighted sum of the other wires for a block
+        // of samples, and subtract it.  Each thread has it's own work area
+        // for the normalized rows (Z) and the sums.
+        const std::size_t block = kPedestalBlock;
+        std::size_t blocks = (pulseSamples + block - 1)/block;
+        std::vector< std::vector<T> > work(std::max(threads,1));
+        CP::ParallelFor(threads, blocks, [&](std::size_t b, int worker) {
+            std::size_t first = b*block;
+            std::size_t width = std::min(block, pulseSamples - first);
+            std::vector<T>& buffer = work[worker];
+            buffer.assign(2*n*block, 0);
+            T* z = &buffer[0];
+            T* sums = &buffer[n*block];
+            for (std::size_t g = 0; g < n; ++g) {
+                std::size_t d = good[g];
+                const float* samples = waveforms.GetRow(d);
+                std::size_t count
+                    = std::min(waveforms.GetSampleCount(d), first+width);
+                double norm = 1.0/sigmas[d];
+                T* zRow = z + g*block;
+                for (std::size_t i = first; i < count; ++i) {
+                    zRow[i-first] = samples[i]*norm;
+                }
+            }
+            CP::MatrixMultiply(1, n, width, n,
+                               &correlations[0], n,
+                               z, block,
+                               sums, block);
+            for (std::size_t g = 0; g < n; ++g) {
+                if (weights[g] < 0.1) continue;
+                std::size_t d = good[g];
+                float* samples = waveforms.GetRow(d);
+                std::size_t count
+                    = std::min(waveforms.GetSampleCount(d), first+width);
+                double scale = sigmas[d]/weights[g];
+                const T* sum = sums + g*block;
+                for (std::size_t i = first; i < count; ++i) {
+                    samples[i] = samples[i] - scale*sum[i-first];
+                }
+            }
+        });
+
+        int correlatedWires = 0;
+        for (std::size_t g = 0; g < n; ++g) {
+            if (weights[g] > 0.0) ++correlatedWires;
+        }
+        return correlatedWires;
+    }
+
+    /// Subtract the correlated pedestals found by applying the weights in a
+    /// correlation graph.  For each good row, the pedestal is the weighted
+    /// average of the scaled baseline fluctuations of the good rows it is
+    /// connected to.  The samples are handled in blocks, and the pedestal
+    /// for a block is subtracted in place as soon as it's found.  This
+    /// returns the number of rows with strong correlations.
+    int SubtractGraphCorrelatedPedestals(int threads,
+                                         CP::TWaveformMatrix& waveforms,
+                                         const CP::TCorrelationGraph& graph,
+                                         const std::vector<double>& sigmas,
+                                         std::size_t pulseSamples) {
+        const std::size_t rows = std::min(waveforms.GetRows(),
+                                          graph.GetNodes());
+        std::vector<double> weights(rows);
+        CP::ParallelFor(threads, rows, [&](std::size_t d1, int) {
+            if (sigmas[d1]<1.0) return;
+            const CP::TCorrelationGraph::Edges& edges = graph.GetEdges(d1);
+            for (std::size_t e = 0; e < edges.size(); ++e) {
+                if (sigmas[edges[e].fNode]<1.0) continue;
+                weights[d1] += edges[e].fWeight;
+            }
+        });
+        int correlatedWires = 0;
+        std::vector<std::size_t> corrected;
+        for (std::size_t d1 = 0; d1 < rows; ++d1) {
+            if (weights[d1] > 0.0) ++correlatedWires;
+            if (weights[d1] < 0.1) continue;
+            corrected.push_back(d1);
+        }
+
+        // Find the pedestals for a block of samples, and then subtract them.
+        // Each thread has it's own work area with a block for each corrected
+        // row.
+        const std::size_t block = kPedestalBlock;
+        std::size_t blocks = (pulseSamples + block - 1)/block;
+        std::vector< std::vector<double> > work(std::max(threads,1));
+        CP::ParallelFor(threads, blocks, [&](std::size_t b, int worker) {
+            std::size_t first = b*block;
+            std::size_t last = std::min(first + block, pulseSamples);
+            std::vector<double>& buffer = work[worker];
+            buffer.assign(corrected.size()*block, 0.0);
+            for (std::size_t c = 0; c < corrected.size(); ++c) {
+                std::size_t d1 = corrected[c];
+                double* pedestal1 = &buffer[c*block];
+                std::size_t count1
+                    = std::min(waveforms.GetSampleCount(d1), last);
+                const CP::TCorrelationGraph::Edges& edges
+                    = graph.GetEdges(d1);
+                for (std::size_t e = 0; e < edges.size(); ++e) {
+                    std::size_t d2 = edges[e].fNode;
+                    if (sigmas[d2]<1.0) continue;
+                    const float* samples2 = waveforms.GetRow(d2);
+                    std::size_t count
+                        = std::min(count1, waveforms.GetSampleCount(d2));
+                    double w = edges[e].fWeight*sigmas[d1]
+                        /(sigmas[d2]*weights[d1]);
+                    for (std::size_t i = first; i < count; ++i) {
+                        pedestal1[i-first] += w*samples2[i];
+                    }
+                }
+            }
+            for (std::size_t c = 0; c < corrected.size(); ++c) {
+                std::size_t d1 = corrected[c];
+                float* samples1 = waveforms.GetRow(d1);
+                const double* pedestal1 = &buffer[c*block];
+                std::size_t count1
+                    = std::min(waveforms.GetSampleCount(d1), last);
+                for (std::size_t i = first; i < count1; ++i) {
+                    samples1[i] = samples1[i] - pedestal1[i-first];
+                }
+            }
+        });
+        return correlatedWires;
+    }
+}
+
 CP::TClusterCalib::TClusterCalib() {
 
     double pulseLength
@@ -46,9 +360,13 @@ CP::TClusterCalib::TClusterCalib() {
     fSampleCount = (pulseLength+responseLength)/(500*unit::ns);
     fSampleCount = 2*(1+fSampleCount/2);
 
-    fCalibrate = new TPulseCalib();
+    fThreads = 1;
+
+    fCalibrate.push_back(new TPulseCalib());
 
-    fDeconvolution = new TPulseDeconvolution(fSampleCount);
+    fDeconvolution.push_back(new TPulseDeconvolution(fSampleCount));
+
+    fCoherentNoise.push_back(new TCoherentNoise());
 
     fSaveCalibratedPulses = false;
     fSaveDecorrelatedPulses = false;
@@ -56,13 +374,102 @@ CP::TClusterCalib::TClusterCalib() {
     fCalibrateAllChannels = false;
     fApplyEfficiencyCalibration = true;
     fRemoveCorrelatedPedestal = true;
+
+    fSinglePrecisionCorrelations
+        = (CP::TRuntimeParameters::Get().GetParameterI(
+               "clusterCalib.correlations.singlePrecision") != 0);
+
+    fCorrelationNeighborhood
+        = CP::TRuntimeParameters::Get().GetParameterI(
+            "clusterCalib.correlations.neighborhood");
+
+    fCorrelationWireWindow
+        = CP::TRuntimeParameters::Get().GetParameterI(
+            "clusterCalib.correlations.wireWindow");
+
+    fCorrelationSketch.Configure(
+        CP::TRuntimeParameters::Get().GetParameterI(
+            "clusterCalib.correlations.sketchBits"),
+        CP::TRuntimeParameters::Get().GetParameterD(
+            "clusterCalib.correlations.sketchRecall"),
+        0.6);
+
+    fCorrelationModelInterval
+        = CP::TRuntimeParameters::Get().GetParameterI(
+            "clusterCalib.correlations.modelInterval");
+
+    fCorrelationModelAveraging
+        = CP::TRuntimeParameters::Get().GetParameterD(
+            "clusterCalib.correlations.modelAveraging");
+
+    fCorrelationModelEvents = 0;
+    fCorrelationModelRun = -1;
+
+    fLowRankNoise
+        = (CP::TRuntimeParameters::Get().GetParameterI(
+               "clusterCalib.coherent.lowRank") != 0);
+
+    fCoherentGroups
+        = CP::TRuntimeParameters::Get().GetParameterI(
+            "clusterCalib.coherent.groups");
+}
+
+CP::TClusterCalib::~TClusterCalib() {
+    for (std::size_t i = 0; i < fCalibrate.size(); ++i) {
+        delete fCalibrate[i];
+    }
+    for (std::size_t i = 0; i < fDeconvolution.size(); ++i) {
+        delete fDeconvolution[i];
+    }
+    for (std::size_t i = 0; i < fCoherentNoise.size(); ++i) {
+        delete fCoherentNoise[i];
+    }
 }
 
-CP::TClusterCalib::~TClusterCalib() {}
+void CP::TClusterCalib::SetThreads(int threads) {
+    if (threads < 1) threads = 1;
+    CaptLog("Drift calibration threads " << threads);
+#if ROOT_VERSION(6,0,0) < ROOT_VERSION_CODE
+    // The worker threads create ROOT objects (e.g. the calibrated digits),
+    // so ROOT needs to protect it's global state.
+    if (threads > 1) ROOT::EnableThreadSafety();
+#endif
+    fThreads = threads;
+    while ((int) fCalibrate.size() < fThreads) {
+        fCalibrate.push_back(new TPulseCalib());
+    }
+    while ((int) fDeconvolution.size() < fThreads) {
+        fDeconvolution.push_back(new TPulseDeconvolution(fSampleCount));
+    }
+    while ((int) fCoherentNoise.size() < fThreads) {
+        fCoherentNoise.push_back(new TCoherentNoise());
+    }
+    while ((int) fCalibrate.size() > fThreads) {
+        delete fCalibrate.back();
+        fCalibrate.pop_back();
+    }
+    while ((int) fDeconvolution.size() > fThreads) {
+        delete fDeconvolution.back();
+        fDeconvolution.pop_back();
+    }
+    while ((int) fCoherentNoise.size() > fThreads) {
+        delete fCoherentNoise.back();
+        fCoherentNoise.pop_back();
+    }
+}
 
 bool CP::TClusterCalib::operator()(CP::TEvent& event) {
     CaptLog("Process " << event.GetContext());
-    CP::TChannelInfo::Get().SetContext(event.GetContext());
+
+    // The channel information is shared by all of the threads, so the
+    // context is set for this event each time it's used (see
+    // TChannelInfoLock.hxx).
+    fContext = event.GetContext();
+
+    fTimer.StartEvent(event.GetContext());
+    CP::TStageTimer::Clock::time_point eventStart = CP::TStageTimer::Now();
+    CP::TStageTimer::Clock::time_point start = eventStart;
+    long pmtSamples = 0;
 
     ///////////////////////////////////////////////////////////////////////
     // PMT Calibration
@@ -74,7 +481,10 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
     CP::TPMTMakeHits makePMTHits;
 
     if (pmt) {
-        // Calibrate the PMT pulses and turn them into hits.
+        // Calibrate the PMT pulses and turn them into hits.  The hits look
+        // up the geometry for the PMT.
+        CP::TChannelInfoLock lock(fContext);
+        makePMTHits.SetContext(fContext);
         for (std::size_t d = 0; d < pmt->size(); ++d) {
             const CP::TPulseDigit* pulse
                 = dynamic_cast<const CP::TPulseDigit*>((*pmt)[d]);
@@ -83,7 +493,9 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
                 continue;
             }
             CP::TDigitProxy proxy(*pmt,d);
-            std::unique_ptr<CP::TCalibPulseDigit> calib((*fCalibrate)(proxy));
+            std::unique_ptr<CP::TCalibPulseDigit> calib(
+                (*fCalibrate[0])(proxy, fContext));
+            pmtSamples += calib->GetSampleCount();
             makePMTHits(*pmtHits,*calib);
         }
     }
@@ -104,9 +516,14 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
                 continue;
             }
             if (pulse->GetChannelId() != CP::TTPCChannelId(2,7,27)) continue;
-            CP::TChannelCalib calib;
-            double timeOffset = calib.GetTimeConstant(pulse->GetChannelId(),0);
-            double digitStep = calib.GetTimeConstant(pulse->GetChannelId(),1);
+            double timeOffset;
+            double digitStep;
+            {
+                CP::TChannelInfoLock lock(fContext);
+                CP::TChannelCalib calib;
+                timeOffset = calib.GetTimeConstant(pulse->GetChannelId(),0);
+                digitStep = calib.GetTimeConstant(pulse->GetChannelId(),1);
+            }
             CP::TDigitProxy proxy(*drift,d);
             for(std::size_t s = 1; s<pulse->GetSampleCount(); ++s) {
                 int delta = pulse->GetSample(s-1) - pulse->GetSample(s);
@@ -127,6 +544,9 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
     }
 #endif
     
+    fTimer.Add("PMT", CP::TStageTimer::Seconds(start),
+               (pmt ? pmt->size() : 0), pmtSamples, pmtHits->size());
+
     if (pmtHits->size() > 0) {
         // If there are any PMT hits found, add them to the output.
         CP::THandle<CP::TDataVector> hits
@@ -144,35 +564,48 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
         = event.Get<CP::TDigitContainer>("~/digits/drift");
     if (!drift) {
         CaptLog("No drift signals for this event " << event.GetContext());
+        fTimer.Add("Event", CP::TStageTimer::Seconds(eventStart));
+        fTimer.FinishEvent();
         return false;
     }
 
-    CP::THandle<CP::TDigitContainer> driftCalib;
-
-    driftCalib = CalibrateChannels(event, drift);
-    
-    driftCalib = RemoveCorrelatedPedestal(event,driftCalib);
+    CP::TStageTimer::Clock::time_point driftStart = CP::TStageTimer::Now();
 
-    driftCalib = DeconvolveSignals(event,driftCalib);
-    
     // Create a hit selection for hits that are found.
     std::unique_ptr<CP::THitSelection> driftHits(
         new CP::THitSelection("drift"));
-    
-    CP::TWirePeaks wirePeaks(fApplyEfficiencyCalibration);
 
-    // Loop over all of the calibrated pulse digits and find the hits.
-    for (std::size_t d = 0; d < driftCalib->size(); ++d) {
-        const CP::TCalibPulseDigit* calib
-            = dynamic_cast<const CP::TCalibPulseDigit*>((*driftCalib)[d]);
-        if (d%100 == 0) {
-            CaptLog("Make Hits " << calib->GetChannelId().AsString());
-        }
+    start = CP::TStageTimer::Now();
+    std::vector<std::size_t> selected = SelectChannels(drift);
+    fTimer.Add("Select", CP::TStageTimer::Seconds(start), selected.size());
+
+    // Fill the waveform matrix with the calibrated drift channels.  All of
+    // the later stages work on the matrix, and digits are only made when
+    // they are going to be saved.
+    start = CP::TStageTimer::Now();
+    CalibrateChannels(drift, selected);
+    fTimer.Add("Calibrate", CP::TStageTimer::Seconds(start),
+               CountRows(fWaveforms), CountSamples(fWaveforms));
+    if (fSaveCalibratedPulses) SaveWaveforms(event, drift, "drift-calib");
 
-        // Find any peaks in the deconvoluted pulse.
-        wirePeaks(*driftHits,*calib,t0);
+    if (fRemoveCorrelatedPedestal) {
+        start = CP::TStageTimer::Now();
+        if (fLowRankNoise) RemoveCoherentNoise();
+        else RemoveCorrelatedPedestal();
+        fTimer.Add("Correlations", CP::TStageTimer::Seconds(start),
+                   CountRows(fWaveforms), CountSamples(fWaveforms));
+        if (fSaveDecorrelatedPulses) {
+            SaveWaveforms(event, drift, "drift-correl");
+        }
     }
 
+    FindDriftHits(*driftHits, event, drift, t0);
+
+    fTimer.Add("Drift", CP::TStageTimer::Seconds(driftStart),
+               drift->size(), 0, driftHits->size());
+    fTimer.Add("Event", CP::TStageTimer::Seconds(eventStart));
+    fTimer.FinishEvent();
+
     if (driftHits->size() > 0) {
         // Add the drift hits to the output.
         CP::THandle<CP::TDataVector> hits
@@ -183,204 +616,113 @@ bool CP::TClusterCalib::operator()(CP::TEvent& event) {
     return true;
 }
 
-CP::THandle<CP::TDigitContainer> CP::TClusterCalib::RemoveCorrelatedPedestal(
-    CP::TEvent& event, CP::THandle<CP::TDigitContainer> driftCalib) {
-    if (!fRemoveCorrelatedPedestal) return driftCalib;
-    
-    // Find the RMS for each wire.  The pedestal is already removed so the
-    // expected (mean) value is zero.
-    std::vector<double> sigmas(driftCalib->size());
-    for (std::size_t d1 = 0; d1 < driftCalib->size(); ++d1) {
-        CP::TCalibPulseDigit* calib1
-            = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d1]);
-        double sigma = 0.0;
-        for (std::size_t i=0; i<(std::size_t) calib1->GetSampleCount(); ++i) {
-            double p = calib1->GetSample(i);
-            sigma += p*p;
-        }
-        sigma /= calib1->GetSampleCount();
-        sigmas[d1] = std::sqrt(sigma);
-    }
+void CP::TClusterCalib::FindDriftHits(
+    CP::THitSelection& driftHits,
+    CP::TEvent& event,
+    CP::THandle<CP::TDigitContainer> drift,
+    double t0) {
+    // The per-channel stages are timed by each thread, and the totals are
+    // added to the stage timer after all of the channels are done.
+    struct WorkerTotals {
+        CP::TStageTimer::Totals fDeconvolve;
+        CP::TStageTimer::Totals fHits;
+    };
+    std::vector<WorkerTotals> workerTotals(fThreads);
 
-    // Fill a "2d" array of wire to wire correlations.  The array indexing is
-    // done by hand so I can use a vector. 
-    std::vector<double> correlations(driftCalib->size()*driftCalib->size());
-    std::size_t pulseSamples = 0;
-    for (std::size_t d1 = 0; d1 < driftCalib->size(); ++d1) {
-        if (sigmas[d1]<1.0) continue;
-        CP::TCalibPulseDigit* calib1
-            = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d1]);
-        if (d1%100 == 0) {
-            CaptLog("Find Correlations " << calib1->GetChannelId().AsString());
-        }
-        pulseSamples = std::max(pulseSamples,calib1->GetSampleCount());
-        for (std::size_t d2 = d1+1; d2 < driftCalib->size(); ++d2) {
-            if (sigmas[d2]<1.0) continue;
-            if (d1 == d2) continue;
-            CP::TCalibPulseDigit* calib2
-                = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d2]);
-            double corr12 = 0.0;
-            int steps = 0;
-            for (std::size_t i=0; i<calib2->GetSampleCount(); i += 4) {
-                double p1 = calib1->GetSample(i);
-                double p2 = calib2->GetSample(i);
-                corr12 += p1*p2;
-                ++steps;
-            }
-            corr12 /= steps;
-            corr12 /= (sigmas[d1]*sigmas[d2]);
-            correlations[d1*driftCalib->size()+d2] = corr12;
-            correlations[d2*driftCalib->size()+d1] = corr12;
-        }
+    std::vector<CP::TWirePeaks> wirePeaks(
+        fThreads, CP::TWirePeaks(fApplyEfficiencyCalibration));
+    for (std::size_t w = 0; w < wirePeaks.size(); ++w) {
+        wirePeaks[w].SetContext(fContext);
     }
 
-    // Find the average "correlated" pedestal for each wire.  For a wire, this
-    // is the correlation weighted average of the samples in all of the other
-    // wires.  This needs to be calculated separately so when the new pedestal
-    // subtraction is done, the subtraction does affect the pedestal
-    // calculation.
-    std::vector<double> pedestals(driftCalib->size()*pulseSamples);
-    std::vector<double> weights(driftCalib->size());
-    int correlatedWires = 0;
-    for (std::size_t d1 = 0; d1 < driftCalib->size(); ++d1) {
-        if (sigmas[d1]<1.0) continue;
-        CP::TCalibPulseDigit* calib1
-            = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d1]);
-        if (d1%100 == 0) {
-            CaptLog("Estimate correlated pedestal "
-                    << calib1->GetChannelId().AsString());
-        }
-        for (std::size_t d2 = 0; d2 < driftCalib->size(); ++d2) {
-            if (sigmas[d2]<1.0) continue;
-            if (d1 == d2) continue;
-            CP::TCalibPulseDigit* calib2
-                = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d2]);
-            double w = correlations[d1*driftCalib->size()+d2];
-            if (w < 0.6) continue;
-            w = w*w*w; // Favor channels with high correlations.
-            for (std::size_t i = 0; i< calib2->GetSampleCount(); ++i) {
-                // this is going to take the average (weighted by the
-                // correlation) of the scaled baseline fluctuation.
-                double v = sigmas[d1]*calib2->GetSample(i)/sigmas[d2];
-                pedestals[d1*pulseSamples+i] += w*v;
-            }
-            weights[d1] += std::abs(w);
-        } 
-        if (weights[d1] > 0.0) ++correlatedWires;
-    }
-    CaptLog("Wires with strong correlations: " << correlatedWires);
+    // The deconvolved digits are kept (by row) if they are going to be
+    // saved.
+    std::vector<CP::TCalibPulseDigit*> deconvolved;
+    if (fSaveDeconvolvedPulses) deconvolved.resize(fWaveforms.GetRows());
 
-    // Find the averaged pedestals for each wire.
-    for (std::size_t d1 = 0; d1 < driftCalib->size(); ++d1) {
-        const CP::TCalibPulseDigit* calib
-            = dynamic_cast<const CP::TCalibPulseDigit*>((*driftCalib)[d1]);
-        for (std::size_t i = 0; i< calib->GetSampleCount(); ++i) {
-            if (weights[d1] < 0.1) pedestals[d1*pulseSamples+i] = 0.0;
-            else pedestals[d1*pulseSamples+i] /= weights[d1];
-        }
-    }
+    // Deconvolve a block of rows in place (the FFTs for the block are done
+    // together), and then find the hits while the rows are still in the
+    // cache.  The peak finding works on a digit, so one is made from the row
+    // and deleted as soon as the hits are found (unless it's being saved).
+    BlockParallelHits(
+        fThreads, fWaveforms.GetRows(), fDeconvolution[0]->GetBatchSize(),
+        driftHits,
+        [&](std::size_t first, std::size_t last, int worker,
+            CP::THitSelection& hits) {
+            WorkerTotals& totals = workerTotals[worker];
+            std::vector<std::size_t> rows;
+            for (std::size_t r = first; r < last; ++r) {
+                if (!fWaveforms.HasFlag(r, CP::TWaveformMatrix::kCalibrated)) {
+                    continue;
+                }
+                rows.push_back(r);
+            }
+            if (rows.empty()) return;
 
-    // Create a handle for the current calibrated digits being worked on.
-    // This will keep track of the current stage of the calibration as it
-    // progresses.
-    if (fSaveDecorrelatedPulses) {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-correl");
-        dv->AddDatum(dg);
-    }
-    else {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-correl");
-        dv->AddTemporary(dg);
-    }
-    CP::THandle<CP::TDigitContainer> driftCorrel
-        = event.Get<CP::TDigitContainer>("~/digits/drift-correl");
-
-    // Subtract the average correlated pedestal from each channel
-    for (std::size_t d1 = 0; d1 < driftCalib->size(); ++d1) {
-        CP::TCalibPulseDigit* calib
-            = dynamic_cast<CP::TCalibPulseDigit*>((*driftCalib)[d1]);
-        std::unique_ptr<CP::TCalibPulseDigit> correl(
-            new CP::TCalibPulseDigit(*calib));
-        for (std::size_t i = 0; i< calib->GetSampleCount(); ++i) {
-            double v = calib->GetSample(i);
-            double p = pedestals[d1*pulseSamples+i];
-            correl->SetSample(i,v-p);
-        }
-        driftCorrel->push_back(correl.release());
-    }
+            // Apply the deconvolution.
+            CP::TStageTimer::Clock::time_point t = CP::TStageTimer::Now();
+            fDeconvolution[worker]->Deconvolve(fWaveforms, rows,
+                                               event.GetContext());
+            totals.fDeconvolve.fTime += CP::TStageTimer::Seconds(t);
 
-    return driftCorrel;
-}
+            for (std::size_t i = 0; i < rows.size(); ++i) {
+                std::size_t r = rows[i];
+                if (!fWaveforms.HasFlag(r, CP::TWaveformMatrix::kDeconvolved)) {
+                    continue;
+                }
+                std::size_t samples = fWaveforms.GetSampleCount(r);
+                ++totals.fDeconvolve.fChannels;
+                totals.fDeconvolve.fSamples += samples;
+                if (r%100 == 0) {
+                    CaptLog("Deconvolve "
+                            << fWaveforms.GetChannelId(r).AsString());
+                }
 
-CP::THandle<CP::TDigitContainer> CP::TClusterCalib::DeconvolveSignals(
-    CP::TEvent& event, CP::THandle<CP::TDigitContainer> driftCalib) {
+                // Find any peaks in the deconvoluted pulse.
+                t = CP::TStageTimer::Now();
+                std::unique_ptr<CP::TCalibPulseDigit> digit(
+                    fWaveforms.MakeDigit(r, *drift));
+                std::size_t found = hits.size();
+                wirePeaks[worker](hits,*digit,t0);
+                totals.fHits.fTime += CP::TStageTimer::Seconds(t);
+                ++totals.fHits.fChannels;
+                totals.fHits.fSamples += samples;
+                totals.fHits.fHits += hits.size() - found;
+                if (fSaveDeconvolvedPulses) deconvolved[r] = digit.release();
+            }
+        });
 
-    // Create a container for the deconvoluted TCalibPulseDigits and check to
-    // see if the deconvoluted digits are going to be saved.  If they are,
-    // then create a permanent container to hold them.  Otherwise, the
-    // container is temporary.
-    if (fSaveDeconvolvedPulses) {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-deconv");
-        dv->AddDatum(dg);
+    for (std::size_t w = 0; w < workerTotals.size(); ++w) {
+        const WorkerTotals& totals = workerTotals[w];
+        fTimer.Add("Deconvolve", totals.fDeconvolve.fTime,
+                   totals.fDeconvolve.fChannels,
+                   totals.fDeconvolve.fSamples);
+        fTimer.Add("Hits", totals.fHits.fTime,
+                   totals.fHits.fChannels,
+                   totals.fHits.fSamples,
+                   totals.fHits.fHits);
     }
-    else {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-deconv");
-        dv->AddTemporary(dg);
-    }
-    CP::THandle<CP::TDigitContainer> driftDeconv
-        = event.Get<CP::TDigitContainer>("~/digits/drift-deconv");
-
-    // Loop over all of the calibrated pulse digits and deconvolve.  The
-    // deconvolution is going to apply a Weiner filter.
-    for (std::size_t d = 0; d < driftCalib->size(); ++d) {
-        const CP::TCalibPulseDigit* calib
-            = dynamic_cast<const CP::TCalibPulseDigit*>((*driftCalib)[d]);
-        std::unique_ptr<CP::TCalibPulseDigit> deconv((*fDeconvolution)(*calib));
-        if (!deconv.get()) continue;
-        if (d%100 == 0) {
-            CaptLog("Deconvolve " << calib->GetChannelId().AsString());
-        }
 
-        // Add the deconvoluted digits to the event (remember, they might be
-        // temporary).
-        driftDeconv->push_back(deconv.release());
-    }
+    if (!fSaveDeconvolvedPulses) return;
 
-    return driftDeconv;
+    // Add the deconvoluted digits to the event in the original order.
+    CP::THandle<CP::TDataVector> dv = event.Get<CP::TDataVector>("~/digits");
+    CP::TDigitContainer* dg = new CP::TDigitContainer("drift-deconv");
+    for (std::size_t r = 0; r < deconvolved.size(); ++r) {
+        if (!deconvolved[r]) continue;
+        dg->push_back(deconvolved[r]);
+    }
+    dv->AddDatum(dg);
 }
 
-CP::THandle<CP::TDigitContainer> CP::TClusterCalib::CalibrateChannels(
-    CP::TEvent& event,
+std::vector<std::size_t> CP::TClusterCalib::SelectChannels(
     CP::THandle<CP::TDigitContainer> drift) {
-    
-    // Create a handle for the current calibrated digits being worked on.
-    // This will keep track of the current stage of the calibration as it
-    // progresses.
-    if (fSaveCalibratedPulses) {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-calib");
-        dv->AddDatum(dg);
-    }
-    else {
-        CP::THandle<CP::TDataVector> dv
-            = event.Get<CP::TDataVector>("~/digits");
-        CP::TDigitContainer* dg = new CP::TDigitContainer("drift-calib");
-        dv->AddTemporary(dg);
-    }
-    CP::THandle<CP::TDigitContainer> driftCalib
-        = event.Get<CP::TDigitContainer>("~/digits/drift-calib");
-
-    // Calibrate the drift pulses.  This loop should only apply the
-    // calibration.  The resulting calibrated digits are pointed to in the
-    // handle driftCalib.  This fills driftCalib for the first time.
+    // Select the drift pulses to be calibrated.  This is done in the main
+    // thread since it's where the channel and calibration tables get loaded
+    // for the event.  The channel information is held for the whole
+    // selection.
+    CP::TChannelInfoLock lock(fContext);
+    std::vector<std::size_t> selected;
     for (std::size_t d = 0; d < drift->size(); ++d) {
         const CP::TPulseDigit* pulse
             = dynamic_cast<const CP::TPulseDigit*>((*drift)[d]);
@@ -406,19 +748,315 @@ CP::THandle<CP::TDigitContainer> CP::TClusterCalib::CalibrateChannels(
                      << " " << std::setw(40) << pulseGeom << std::setw(0));
         }
 
-        CP::TDigitProxy proxy(*drift,d);
-        std::unique_ptr<CP::TCalibPulseDigit> calib((*fCalibrate)(proxy));
-        if (!calib.get()) {
-            CaptError("Channel not calibrated ");
+        selected.push_back(d);
+    }
+
+    return selected;
+}
+
+void CP::TClusterCalib::CalibrateChannels(
+    CP::THandle<CP::TDigitContainer> drift,
+    const std::vector<std::size_t>& selected) {
+
+    // Find the size of the matrix.  The rows are in the same order as the
+    // selected channels.
+    std::size_t samples = 0;
+    for (std::size_t s = 0; s < selected.size(); ++s) {
+        const CP::TPulseDigit* pulse
+            = dynamic_cast<const CP::TPulseDigit*>((*drift)[selected[s]]);
+        samples = std::max(samples, pulse->GetSampleCount());
+    }
+    fWaveforms.Resize(selected.size(), samples);
+
+    // Calibrate the drift pulses directly into the rows.  This loop should
+    // only apply the calibration.
+    CP::ParallelFor(fThreads, selected.size(), [&](std::size_t s,
+                                                   int worker) {
+        const CP::TPulseDigit* pulse
+            = dynamic_cast<const CP::TPulseDigit*>((*drift)[selected[s]]);
+        double startTime;
+        double stopTime;
+        fCalibrate[worker]->Calibrate(*pulse, fContext, fWaveforms.GetRow(s),
+                                      startTime, stopTime);
+        fWaveforms.SetRow(s, selected[s], pulse->GetChannelId(),
+                          pulse->GetSampleCount(), startTime, stopTime);
+    });
+}
+
+void CP::TClusterCalib::SaveWaveforms(
+    CP::TEvent& event,
+    CP::THandle<CP::TDigitContainer> drift,
+    const char* name) {
+    CP::TStageTimer::Clock::time_point start = CP::TStageTimer::Now();
+    CP::THandle<CP::TDataVector> dv = event.Get<CP::TDataVector>("~/digits");
+    CP::TDigitContainer* dg = new CP::TDigitContainer(name);
+    for (std::size_t r = 0; r < fWaveforms.GetRows(); ++r) {
+        if (!fWaveforms.HasFlag(r, CP::TWaveformMatrix::kCalibrated)) {
+            continue;
+        }
+        dg->push_back(fWaveforms.MakeDigit(r, *drift));
+    }
+    long digits = dg->size();
+    dv->AddDatum(dg);
+    fTimer.Add("Save", CP::TStageTimer::Seconds(start), digits);
+}
+
+void CP::TClusterCalib::RemoveCoherentNoise() {
+    // Split the calibrated rows into groups.  The rows in a group are in
+    // order.
+    std::vector< std::vector<std::size_t> > groups;
+    std::vector< std::pair<long, std::size_t> > keys;
+    CP::TChannelInfoLock lock(fContext);
+    for (std::size_t r = 0; r < fWaveforms.GetRows(); ++r) {
+        if (!fWaveforms.HasFlag(r, CP::TWaveformMatrix::kCalibrated)) {
+            continue;
+        }
+        long key = 0;
+        if (fCoherentGroups != kAllChannels) {
+            key = ElectronicsKey(fWaveforms.GetChannelId(r),
+                                 fCoherentGroups & kSameMotherboard);
+            if (key < 0) continue;
+        }
+        keys.push_back(std::make_pair(key, r));
+    }
+    lock.Unlock();
+    std::sort(keys.begin(), keys.end());
+    for (std::size_t k = 0; k < keys.size(); ++k) {
+        if (k == 0 || keys[k].first != keys[k-1].first) {
+            groups.push_back(std::vector<std::size_t>());
+        }
+        groups.back().push_back(keys[k].second);
+    }
+
+    // A single group uses all of the threads for the rows, otherwise the
+    // groups are done in parallel.
+    if (groups.size() == 1) {
+        int rank = (*fCoherentNoise[0])(fWaveforms, groups[0], fThreads);
+        CaptLog("Coherent noise components: " << rank);
+        return;
+    }
+    CP::ParallelFor(fThreads, groups.size(), [&](std::size_t g, int worker) {
+        (*fCoherentNoise[worker])(fWaveforms, groups[g], 1);
+    });
+    CaptLog("Coherent noise groups: " << groups.size());
+}
+
+void CP::TClusterCalib::RemoveCorrelatedPedestal() {
+    CP::TWaveformMatrix& waveforms = fWaveforms;
+    const std::size_t rows = waveforms.GetRows();
+
+    // Find the RMS for each wire.  The pedestal is already removed so the
+    // expected (mean) value is zero.  Rows that weren't calibrated keep a
+    // zero sigma, and are skipped.
+    std::vector<double> sigmas(rows);
+    std::size_t pulseSamples = 0;
+    for (std::size_t d1 = 0; d1 < rows; ++d1) {
+        if (!waveforms.HasFlag(d1, CP::TWaveformMatrix::kCalibrated)) {
             continue;
         }
+        const float* samples1 = waveforms.GetRow(d1);
+        std::size_t count1 = waveforms.GetSampleCount(d1);
+        if (count1 < 1) continue;
+        double sigma = 0.0;
+        for (std::size_t i=0; i<count1; ++i) {
+            double p = samples1[i];
+            sigma += p*p;
+        }
+        sigma /= count1;
+        sigmas[d1] = std::sqrt(sigma);
+        if (sigmas[d1]<1.0) continue;
+        pulseSamples = std::max(pulseSamples,count1);
+    }
+
+    // Only the channels with enough noise are used.
+    std::vector<std::size_t> good;
+    for (std::size_t d1 = 0; d1 < rows; ++d1) {
+        if (sigmas[d1]<1.0) continue;
+        good.push_back(d1);
+    }
+
+    if (pulseSamples < 1) return;
+
+    // Subtract the average correlated pedestal from each channel.
+    int correlatedWires = 0;
+    if (fCorrelationModelInterval > 0) {
+        correlatedWires = RemoveModelCorrelatedPedestal(
+            good, sigmas, pulseSamples);
+    }
+    else if (fCorrelationNeighborhood != kAllChannels) {
+        correlatedWires = RemoveSparseCorrelatedPedestal(
+            good, sigmas, pulseSamples);
+    }
+    else if (fSinglePrecisionCorrelations) {
+        correlatedWires = SubtractDenseCorrelatedPedestals<float>(
+            fThreads, waveforms, good, sigmas, pulseSamples);
+    }
+    else {
+        correlatedWires = SubtractDenseCorrelatedPedestals<double>(
+            fThreads, waveforms, good, sigmas, pulseSamples);
+    }
+    CaptLog("Wires with strong correlations: " << correlatedWires);
+}
+
+void CP::TClusterCalib::FindNeighborhood(
+    const std::vector<std::size_t>& good) {
+    fCorrelationGraph.Resize(fWaveforms.GetRows());
+    CP::TChannelInfoLock lock(fContext);
+    CP::TChannelInfo& info = CP::TChannelInfo::Get();
+
+    // Rows with the same electronics key are neighbors.  The entries are
+    // sorted by key and then by row, so each group of rows is in order.
+    if (fCorrelationNeighborhood & (kSameASIC|kSameMotherboard)) {
+        std::vector< std::pair<long, std::size_t> > keys;
+        for (std::size_t g = 0; g < good.size(); ++g) {
+            long key = ElectronicsKey(
+                fWaveforms.GetChannelId(good[g]),
+                fCorrelationNeighborhood & kSameMotherboard);
+            if (key < 0) continue;
+            keys.push_back(std::make_pair(key, good[g]));
+        }
+        std::sort(keys.begin(), keys.end());
+        for (std::size_t k1 = 0; k1 < keys.size(); ++k1) {
+            for (std::size_t k2 = k1+1; k2 < keys.size(); ++k2) {
+                if (keys[k1].first != keys[k2].first) break;
+                fCorrelationGraph.AddEdge(keys[k1].second,
+                                          keys[k2].second, 0.0);
+            }
+        }
+    }
+
+    // Wires in the same plane that are close together are neighbors.
+    if (fCorrelationNeighborhood & kAdjacentWires) {
+        std::vector< std::pair<long, std::size_t> > wires;
+        for (std::size_t g = 0; g < good.size(); ++g) {
+            const CP::TChannelId& id = fWaveforms.GetChannelId(good[g]);
+            CP::TGeometryId geomId = info.GetGeometry(id);
+            if (!CP::GeomId::Captain::IsWire(geomId)) continue;
+            long key = 100000L*CP::GeomId::Captain::GetWirePlane(geomId)
+                + CP::GeomId::Captain::GetWireNumber(geomId);
+            wires.push_back(std::make_pair(key, good[g]));
+        }
+        std::sort(wires.begin(), wires.end());
+        for (std::size_t w1 = 0; w1 < wires.size(); ++w1) {
+            for (std::size_t w2 = w1+1; w2 < wires.size(); ++w2) {
+                if (wires[w2].first - wires[w1].first
+                    > fCorrelationWireWindow) break;
+                std::size_t d1 = std::min(wires[w1].second, wires[w2].second);
+                std::size_t d2 = std::max(wires[w1].second, wires[w2].second);
+                fCorrelationGraph.AddEdge(d1, d2, 0.0);
+            }
+        }
+    }
+
+    lock.Unlock();
+
+    // Rows with similar signatures are likely to be correlated.
+    if (fCorrelationNeighborhood & kSimilarSketch) {
+        fCorrelationSketch.FindCandidates(fWaveforms, good,
+                                          fCorrelationGraph, fThreads);
+        CaptLog("Sketch tables: " << fCorrelationSketch.GetTables());
+    }
+
+    // The neighborhoods can overlap.
+    fCorrelationGraph.Unique();
+}
+
+void CP::TClusterCalib::MeasureCorrelations(
+    const std::vector<std::size_t>& good,
+    const std::vector<double>& sigmas,
+    std::size_t pulseSamples,
+    const CP::TCorrelationModel* model) {
+    const CP::TWaveformMatrix& waveforms = fWaveforms;
+    const std::size_t rows = waveforms.GetRows();
+
+    if (fCorrelationNeighborhood == kAllChannels) {
+        // Check every pair of good rows.
+        fCorrelationGraph.Resize(rows);
+        std::vector<double> correlations;
+        DenseCorrelations(fThreads, waveforms, good, sigmas, pulseSamples,
+                          correlations);
+        const std::size_t n = good.size();
+        CP::ParallelFor(fThreads, n, [&](std::size_t g1, int) {
+            std::size_t d1 = good[g1];
+            for (std::size_t g2 = g1+1; g2 < n; ++g2) {
+                std::size_t d2 = good[g2];
+                double corr12 = correlations[g1*n+g2];
+                if (corr12 < 0.6
+                    && !(model && model->Contains(d1,d2))) continue;
+                fCorrelationGraph.AddEdge(d1, d2, corr12);
+            }
+        });
+        return;
+    }
+
+    // Only check the pairs in the same neighborhood.
+    FindNeighborhood(good);
+    CaptLog("Neighborhood pairs: " << fCorrelationGraph.GetEdgeCount());
+    CP::ParallelFor(fThreads, rows, [&](std::size_t d1, int) {
+        CP::TCorrelationGraph::Edges& edges = fCorrelationGraph.GetEdges(d1);
+        std::size_t kept = 0;
+        for (std::size_t e = 0; e < edges.size(); ++e) {
+            std::size_t d2 = edges[e].fNode;
+            double corr12 = PairCorrelation(waveforms, sigmas, d1, d2);
+            if (corr12 < 0.6
+                && !(model && model->Contains(d1,d2))) continue;
+            edges[kept++] = CP::TCorrelationGraph::Edge(d2, corr12);
+        }
+        edges.resize(kept);
+    });
+}
+
+int CP::TClusterCalib::RemoveSparseCorrelatedPedestal(
+    const std::vector<std::size_t>& good,
+    const std::vector<double>& sigmas,
+    std::size_t pulseSamples) {
+    MeasureCorrelations(good, sigmas, pulseSamples, NULL);
 
-        // Add the calibrated digits to the event (remember, they are probably
-        // temporary).
-        driftCalib->push_back(calib.release());
+    // Turn the correlations into weights that favor the channels with high
+    // correlations.
+    for (std::size_t d1 = 0; d1 < fCorrelationGraph.GetNodes(); ++d1) {
+        CP::TCorrelationGraph::Edges& edges = fCorrelationGraph.GetEdges(d1);
+        for (std::size_t e = 0; e < edges.size(); ++e) {
+            double w = edges[e].fWeight;
+            edges[e].fWeight = w*w*w;
+        }
     }
+    fCorrelationGraph.Symmetrize();
 
-    return driftCalib;
+    return SubtractGraphCorrelatedPedestals(fThreads, fWaveforms,
+                                            fCorrelationGraph,
+                                            sigmas, pulseSamples);
 }
 
+int CP::TClusterCalib::RemoveModelCorrelatedPedestal(
+    const std::vector<std::size_t>& good,
+    const std::vector<double>& sigmas,
+    std::size_t pulseSamples) {
+    bool update = false;
+    // The correlations change between runs (the electronics may have been
+    // reconfigured), so the model is started again for a new run even if
+    // it has the same channels.
+    int run = fContext.GetRun();
+    if (run != fCorrelationModelRun
+        || !fCorrelationModel.Matches(fWaveforms)) {
+        CaptLog("Start the correlation model for run " << run);
+        fCorrelationModel.Start(fWaveforms);
+        fCorrelationModelRun = run;
+        fCorrelationModelEvents = 0;
+        update = true;
+    }
+    if (fCorrelationModelEvents % fCorrelationModelInterval == 0) {
+        update = true;
+    }
+    ++fCorrelationModelEvents;
+
+    if (update) {
+        MeasureCorrelations(good, sigmas, pulseSamples, &fCorrelationModel);
+        fCorrelationModel.Update(fCorrelationGraph,
+                                 fCorrelationModelAveraging);
+    }
 
+    return SubtractGraphCorrelatedPedestals(fThreads, fWaveforms,
+                                            fCorrelationModel.GetWeights(),
+                                            sigmas, pulseSamples);
+}
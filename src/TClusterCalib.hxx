@@ -1,15 +1,25 @@
 #ifndef TClusterCalib_hxx_seen
 #define TClusterCalib_hxx_seen
 
+#include "TStageTimer.hxx"
+#include "TWaveformMatrix.hxx"
+#include "TCorrelationGraph.hxx"
+#include "TCorrelationModel.hxx"
+#include "TCorrelationSketch.hxx"
+
 #include <TEvent.hxx>
 #include <TChannelId.hxx>
+#include <TEventContext.hxx>
 
 #include <memory>
+#include <vector>
 
 namespace CP {
     class TClusterCalib;
+    class THitSelection;
     class TPulseCalib;
     class TPulseDeconvolution;
+    class TCoherentNoise;
 };
 
 /// Apply the calibration to an event and find pulse to make hits.
@@ -58,26 +68,156 @@ public:
     void RemoveCorrelations(bool value = true) {
         fRemoveCorrelatedPedestal = value;
     }
+
+    /// The hardware neighborhoods that can be used to choose which pairs of
+    /// channels are checked for correlations.  These are or'ed together.
+    enum {
+        /// Check every pair of channels.
+        kAllChannels = 0x00,
+        /// Check the channels on the same ASIC.
+        kSameASIC = 0x01,
+        /// Check the channels on the same motherboard.
+        kSameMotherboard = 0x02,
+        /// Check the wires in the same plane that are within the wire window
+        /// of each other.
+        kAdjacentWires = 0x04,
+        /// Check the pairs that have similar random projection signatures
+        /// (see TCorrelationSketch).
+        kSimilarSketch = 0x08
+    };
+
+    /// Set a flag to remove the coherent noise with a low rank (randomized
+    /// SVD) approximation instead of the correlated pedestal.  This is only
+    /// used when the correlations are being removed.  The default is set by
+    /// clusterCalib.coherent.lowRank.
+    void UseLowRankNoise(bool value = true) {fLowRankNoise = value;}
+
+    /// Set the groups of channels used for the low rank approximation.  The
+    /// groups are kAllChannels (the whole detector), kSameASIC, or
+    /// kSameMotherboard.  The default is set by clusterCalib.coherent.groups.
+    void SetCoherentGroups(int groups) {fCoherentGroups = groups;}
+
+    /// Set the neighborhood of channels that are checked for correlations
+    /// when the correlated pedestal is removed.  If this is kAllChannels
+    /// (the default is set by clusterCalib.correlations.neighborhood), then
+    /// every pair of channels is checked.  Otherwise, only the pairs in the
+    /// same neighborhood are checked, and the correlations are kept as a
+    /// sparse graph.
+    void SetCorrelationNeighborhood(int neighborhood, int wireWindow = 2) {
+        fCorrelationNeighborhood = neighborhood;
+        fCorrelationWireWindow = wireWindow;
+    }
+
+    /// Set how the correlations are kept between events.  If the interval is
+    /// zero, the correlations are found from scratch for every event.
+    /// Otherwise, a correlation model is kept for the run, and is updated
+    /// with the correlations measured every interval events.  The other
+    /// events apply the cached weights.  The averaging is the weight given
+    /// to a new measurement in an exponentially weighted moving average, and
+    /// if it's zero (or one), the new measurement replaces the old one.  The
+    /// defaults are set by clusterCalib.correlations.modelInterval and
+    /// clusterCalib.correlations.modelAveraging.
+    void SetCorrelationModel(int interval, double averaging = 0.0) {
+        fCorrelationModelInterval = interval;
+        fCorrelationModelAveraging = averaging;
+        fCorrelationModel.Reset();
+    }
+
+    /// Set the number of threads used to calibrate, deconvolve and find the
+    /// hits for the drift channels.  Each thread gets its own TPulseCalib,
+    /// TPulseDeconvolution and TWirePeaks objects, and the hits are merged
+    /// so the output is in the same order as a single threaded job.  The
+    /// default is one thread.
+    void SetThreads(int threads);
+
+    /// Get the number of threads used for the drift channels.
+    int GetThreads() const {return fThreads;}
+
+    /// Get the stage timer.  The stages are "PMT", "Select", "Calibrate",
+    /// "Correlations", "Deconvolve", "Hits", "Save" (making the saved
+    /// digits), "Drift" (all of the drift channel work) and "Event".  Each
+    /// channel is deconvolved and has its hits found before the thread
+    /// moves to the next channel, so the time for those stages is summed
+    /// over the threads (and can be more than the wall time).
+    const CP::TStageTimer& GetTimer() const {return fTimer;}
 private:
 
-    /// Apply the channel calibrations to all channels.  This takes a
-    /// container of raw digits and returns a container of calibrated digits.
-    CP::THandle<CP::TDigitContainer>
-    CalibrateChannels(CP::TEvent& event,
-                     CP::THandle<CP::TDigitContainer> drift);
+    /// Select the drift channels that should be calibrated and return their
+    /// indices in the drift container.  This must be called from the main
+    /// thread since it loads the channel information for the event, and
+    /// holds the CP::ChannelInfoMutex() while it does.
+    std::vector<std::size_t>
+    SelectChannels(CP::THandle<CP::TDigitContainer> drift);
+
+    /// Apply the channel calibrations to the selected channels, and fill
+    /// the waveform matrix.  The rows are in the same order as the selected
+    /// channels.
+    void CalibrateChannels(CP::THandle<CP::TDigitContainer> drift,
+                           const std::vector<std::size_t>& selected);
+
+    /// Add a digit container with a digit for each calibrated row of the
+    /// waveform matrix to the event.
+    void SaveWaveforms(CP::TEvent& event,
+                       CP::THandle<CP::TDigitContainer> drift,
+                       const char* name);
 
     /// Removes baseline fluctuations shared by channels.  It calculates the
     /// correlations, and then uses the correlations to calculate a pedestal
-    /// based on correlated channels.  It's pretty slow.
-    CP::THandle<CP::TDigitContainer>
-    RemoveCorrelatedPedestal(CP::TEvent& event,
-                             CP::THandle<CP::TDigitContainer> driftCalib);
+    /// based on correlated channels.  The pedestal is subtracted from the
+    /// rows of the waveform matrix.  The correlations and pedestals are
+    /// found with blocked matrix multiplies (see MatrixMultiply.hxx).  The
+    /// pedestal is found and subtracted in place for a block of samples at a
+    /// time, so there isn't a copy of the waveforms.
+    void RemoveCorrelatedPedestal();
+
+    /// Remove the coherent noise from each group of rows of the waveform
+    /// matrix by subtracting the strongest common components (see
+    /// TCoherentNoise).  This is an alternative to RemoveCorrelatedPedestal
+    /// that scales linearly with the number of channels.
+    void RemoveCoherentNoise();
+
+    /// Fill the correlation graph with an edge for each pair of good rows
+    /// that are in the same hardware neighborhood.  There is one edge for
+    /// each pair, and it goes from the lower row to the higher row.  This
+    /// must be called from the main thread since it uses TChannelInfo (and
+    /// holds the CP::ChannelInfoMutex() while it does).
+    void FindNeighborhood(const std::vector<std::size_t>& good);
+
+    /// Measure the correlations between the good rows, and fill the
+    /// correlation graph with an edge from the lower row to the higher row
+    /// for each strongly correlated pair.  The pairs are either all of the
+    /// pairs, or the pairs in the hardware neighborhood.  If there is a
+    /// model, the pairs that are in the model are also filled so they can be
+    /// averaged.
+    void MeasureCorrelations(const std::vector<std::size_t>& good,
+                             const std::vector<double>& sigmas,
+                             std::size_t pulseSamples,
+                             const CP::TCorrelationModel* model);
+
+    /// Remove the correlated pedestal using the run level correlation model.
+    /// The model is updated (see SetCorrelationModel), and the cached
+    /// weights are applied.  This returns the number of rows with strong
+    /// correlations.
+    int RemoveModelCorrelatedPedestal(const std::vector<std::size_t>& good,
+                                      const std::vector<double>& sigmas,
+                                      std::size_t pulseSamples);
+
+    /// Remove the correlated pedestal using only the pairs of rows in the
+    /// same hardware neighborhood.  The correlations with the pairs that are
+    /// strongly correlated are kept in fCorrelationGraph.  This returns the
+    /// number of rows with strong correlations.
+    int RemoveSparseCorrelatedPedestal(const std::vector<std::size_t>& good,
+                                       const std::vector<double>& sigmas,
+                                       std::size_t pulseSamples);
 
-    /// Applies the deconvolution to all channels.  It's pretty slow, but must
-    /// be done before the peaks are found.
-    CP::THandle<CP::TDigitContainer>
-    DeconvolveSignals(CP::TEvent& event,
-                      CP::THandle<CP::TDigitContainer> driftCalib);
+    /// Deconvolve each row of the waveform matrix in place and find the
+    /// hits.  Each row goes through the deconvolution and the peak finding
+    /// before the thread moves to the next row.  The deconvolved digits are
+    /// added to the event if they are being saved.
+    void FindDriftHits(CP::THitSelection& driftHits,
+                       CP::TEvent& event,
+                       CP::THandle<CP::TDigitContainer> drift,
+                       double t0);
 
     /// The maximum pulse length (in time).  The fft (time sequence) length is
     /// the pulse length plus the response length.  The exact value isn't
@@ -96,11 +236,25 @@ private:
     /// equivalence is guarranteed in the constructor.
     int fSampleCount;
 
-    /// A class to calibrate the digital pulses into calibrated charge pulses. 
-    CP::TPulseCalib* fCalibrate;
+    /// The context of the event being processed.  This is used to set the
+    /// context of the channel information each time it's used.
+    CP::TEventContext fContext;
 
-    /// A class to deconvolute the electronics shape 
-    CP::TPulseDeconvolution* fDeconvolution;
+    /// The number of threads used for the drift channels.
+    int fThreads;
+
+    /// Classes to calibrate the digital pulses into calibrated charge
+    /// pulses.  There is one per thread, and the first is also used for the
+    /// PMTs.
+    std::vector<CP::TPulseCalib*> fCalibrate;
+
+    /// Classes to deconvolute the electronics shape.  There is one per
+    /// thread.
+    std::vector<CP::TPulseDeconvolution*> fDeconvolution;
+
+    /// Classes to remove the coherent noise with a low rank approximation.
+    /// There is one per thread.
+    std::vector<CP::TCoherentNoise*> fCoherentNoise;
 
     /// A flag that the calibrated pulse digits should be saved on the output.
     bool fSaveCalibratedPulses;
@@ -128,7 +282,61 @@ private:
 
     /// A flag to remove baseline fluctuations shared by channels.  It
     /// calculates the correlations, and then uses the correlations to
-    /// calculate a pedestal based on correlated channels.  It's pretty slow.
+    /// calculate a pedestal based on correlated channels.
     bool fRemoveCorrelatedPedestal;
+
+    /// A flag that the matrix multiplies used to remove the correlated
+    /// pedestal should be done in single precision.  This is set by the
+    /// clusterCalib.correlations.singlePrecision parameter.
+    bool fSinglePrecisionCorrelations;
+
+    /// A flag to remove the coherent noise with the low rank approximation
+    /// instead of the correlated pedestal.
+    bool fLowRankNoise;
+
+    /// The groups of channels used for the low rank approximation.  See
+    /// SetCoherentGroups.
+    int fCoherentGroups;
+
+    /// The hardware neighborhood used to choose the pairs of channels that
+    /// are checked for correlations.  See SetCorrelationNeighborhood.
+    int fCorrelationNeighborhood;
+
+    /// The number of wires on each side of a wire that are in the
+    /// kAdjacentWires neighborhood.
+    int fCorrelationWireWindow;
+
+    /// The random projection signatures used to find candidate pairs for
+    /// the kSimilarSketch neighborhood.
+    CP::TCorrelationSketch fCorrelationSketch;
+
+    /// The strong correlations between rows of the waveform matrix found
+    /// with the sparse neighborhood.  The memory is reused for the next
+    /// event.
+    CP::TCorrelationGraph fCorrelationGraph;
+
+    /// The number of events between updates of the correlation model.  If
+    /// this is zero, the model isn't used.
+    int fCorrelationModelInterval;
+
+    /// The weight of a new measurement when the model is updated.
+    double fCorrelationModelAveraging;
+
+    /// The number of events since the correlation model was started.
+    int fCorrelationModelEvents;
+
+    /// The run of the events used to build the correlation model.  The
+    /// model is started again when the run changes.
+    int fCorrelationModelRun;
+
+    /// The correlations kept for the run.
+    CP::TCorrelationModel fCorrelationModel;
+
+    /// The calibrated drift waveforms for the current event.  The memory is
+    /// reused for the next event.
+    CP::TWaveformMatrix fWaveforms;
+
+    /// The time spent in each stage of the calibration.
+    CP::TStageTimer fTimer;
 };
 #endif
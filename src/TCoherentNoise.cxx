@@ -0,0 +1,230 @@
+#include "TCoherentNoise.hxx"
+#include "TWaveformMatrix.hxx"
+#include "ParallelFor.hxx"
+
+#include <TRuntimeParameters.hxx>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// Find the eigenvalues and eigenvectors of a small symmetric matrix
+    /// using Jacobi rotations.  The matrix is size by size, stored by row,
+    /// and is destroyed.  The eigenvalues are left on the diagonal, and the
+    /// eigenvectors are the columns of vectors.
+    void JacobiEigen(std::size_t size,
+                     std::vector<double>& matrix,
+                     std::vector<double>& vectors) {
+        vectors.assign(size*size, 0.0);
+        for (std::size_t i = 0; i < size; ++i) vectors[i*size+i] = 1.0;
+        for (int sweep = 0; sweep < 50; ++sweep) {
+            double offDiagonal = 0.0;
+            double diagonal = 0.0;
+            for (std::size_t p = 0; p < size; ++p) {
+                diagonal += std::abs(matrix[p*size+p]);
+                for (std::size_t q = p+1; q < size; ++q) {
+                    offDiagonal += std::abs(matrix[p*size+q]);
+                }
+            }
+            if (offDiagonal <= 1E-14*diagonal) break;
+            for (std::size_t p = 0; p < size; ++p) {
+                for (std::size_t q = p+1; q < size; ++q) {
+                    double apq = matrix[p*size+q];
+                    if (apq == 0.0) continue;
+                    double app = matrix[p*size+p];
+                    double aqq = matrix[q*size+q];
+                    double theta = 0.5*(aqq-app)/apq;
+                    double t = 1.0/(std::abs(theta)
+                                    + std::sqrt(theta*theta+1.0));
+                    if (theta < 0.0) t = -t;
+                    double c = 1.0/std::sqrt(t*t+1.0);
+                    double s = t*c;
+                    for (std::size_t k = 0; k < size; ++k) {
+                        double akp = matrix[k*size+p];
+                        double akq = matrix[k*size+q];
+                        matrix[k*size+p] = c*akp - s*akq;
+                        matrix[k*size+q] = s*akp + c*akq;
+                    }
+                    for (std::size_t k = 0; k < size; ++k) {
+                        double apk = matrix[p*size+k];
+                        double aqk = matrix[q*size+k];
+                        matrix[p*size+k] = c*apk - s*aqk;
+                        matrix[q*size+k] = s*apk + c*aqk;
+                    }
+                    for (std::size_t k = 0; k < size; ++k) {
+                        double vkp = vectors[k*size+p];
+                        double vkq = vectors[k*size+q];
+                        vectors[k*size+p] = c*vkp - s*vkq;
+                        vectors[k*size+q] = s*vkp + c*vkq;
+                    }
+                }
+            }
+        }
+    }
+}
+
+CP::TCoherentNoise::TCoherentNoise() {
+    fRank = CP::TRuntimeParameters::Get().GetParameterI(
+        "clusterCalib.coherent.rank");
+    fOversampling = CP::TRuntimeParameters::Get().GetParameterI(
+        "clusterCalib.coherent.oversampling");
+    fIterations = CP::TRuntimeParameters::Get().GetParameterI(
+        "clusterCalib.coherent.iterations");
+}
+
+CP::TCoherentNoise::~TCoherentNoise() {}
+
+int CP::TCoherentNoise::operator()(CP::TWaveformMatrix& waveforms,
+                                   const std::vector<std::size_t>& rows,
+                                   int threads) {
+    const std::size_t n = rows.size();
+    std::size_t samples = 0;
+    for (std::size_t r = 0; r < n; ++r) {
+        samples = std::max(samples, waveforms.GetSampleCount(rows[r]));
+    }
+    if (fRank < 1 || n < 2 || samples < 1) return 0;
+
+    std::size_t size = fRank + std::max(0,fOversampling);
+    size = std::min(size, std::min(n, samples));
+    fBasis.assign(size*samples, 0.0);
+    fCoefficients.assign(n*size, 0.0);
+
+    // Start from random combinations of the rows.
+    fRandom.SetSeed(1 + rows[0]);
+    for (std::size_t c = 0; c < fCoefficients.size(); ++c) {
+        fCoefficients[c] = fRandom.Gaus();
+    }
+    Combine(waveforms, rows, size, samples, threads);
+    Orthonormalize(size, samples);
+
+    // The power iterations favor the strongest components.
+    for (int iteration = 0; iteration < fIterations; ++iteration) {
+        Project(waveforms, rows, size, samples, threads);
+        Combine(waveforms, rows, size, samples, threads);
+        Orthonormalize(size, samples);
+    }
+    Project(waveforms, rows, size, samples, threads);
+
+    // Find the strongest components inside of the basis.  This is the
+    // eigenvalue problem for transpose(B)*B where B holds the projections of
+    // the rows on the basis.
+    fGram.assign(size*size, 0.0);
+    for (std::size_t r = 0; r < n; ++r) {
+        const double* b = &fCoefficients[r*size];
+        for (std::size_t p = 0; p < size; ++p) {
+            for (std::size_t q = 0; q < size; ++q) {
+                fGram[p*size+q] += b[p]*b[q];
+            }
+        }
+    }
+    JacobiEigen(size, fGram, fVectors);
+    std::vector<std::size_t> order(size);
+    for (std::size_t p = 0; p < size; ++p) order[p] = p;
+    std::sort(order.begin(), order.end(),
+              [this,size](std::size_t a, std::size_t b) {
+                  return fGram[a*size+a] > fGram[b*size+b];
+              });
+    std::size_t rank = std::min((std::size_t) fRank, size);
+    double largest = fGram[order[0]*size+order[0]];
+    while (rank > 0) {
+        double value = fGram[order[rank-1]*size+order[rank-1]];
+        if (value > 1E-12*largest && value > 0.0) break;
+        --rank;
+    }
+    if (rank < 1) return 0;
+
+    // Make the components and find their amplitudes in each row.
+    fComponents.assign(rank*samples, 0.0);
+    fAmplitudes.assign(n*rank, 0.0);
+    for (std::size_t j = 0; j < rank; ++j) {
+        double* component = &fComponents[j*samples];
+        for (std::size_t p = 0; p < size; ++p) {
+            double u = fVectors[p*size+order[j]];
+            const double* basis = &fBasis[p*samples];
+            for (std::size_t i = 0; i < samples; ++i) {
+                component[i] += u*basis[i];
+            }
+        }
+        for (std::size_t r = 0; r < n; ++r) {
+            double a = 0.0;
+            for (std::size_t p = 0; p < size; ++p) {
+                a += fCoefficients[r*size+p]*fVectors[p*size+order[j]];
+            }
+            fAmplitudes[r*rank+j] = a;
+        }
+    }
+
+    // Subtract the components from each row.
+    CP::ParallelFor(threads, n, [&](std::size_t r, int) {
+        float* row = waveforms.GetRow(rows[r]);
+        std::size_t count = waveforms.GetSampleCount(rows[r]);
+        for (std::size_t j = 0; j < rank; ++j) {
+            double a = fAmplitudes[r*rank+j];
+            const double* component = &fComponents[j*samples];
+            for (std::size_t i = 0; i < count; ++i) {
+                row[i] -= a*component[i];
+            }
+        }
+    });
+
+    return rank;
+}
+
+void CP::TCoherentNoise::Orthonormalize(std::size_t size,
+                                        std::size_t samples) {
+    // Modified Gram-Schmidt, done twice to keep the basis orthogonal when
+    // the vectors are nearly parallel.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (std::size_t p = 0; p < size; ++p) {
+            double* v = &fBasis[p*samples];
+            for (std::size_t q = 0; q < p; ++q) {
+                const double* u = &fBasis[q*samples];
+                double dot = 0.0;
+                for (std::size_t i = 0; i < samples; ++i) dot += u[i]*v[i];
+                for (std::size_t i = 0; i < samples; ++i) v[i] -= dot*u[i];
+            }
+            double norm = 0.0;
+            for (std::size_t i = 0; i < samples; ++i) norm += v[i]*v[i];
+            norm = std::sqrt(norm);
+            if (norm < 1E-12) {
+                std::fill(v, v+samples, 0.0);
+                continue;
+            }
+            for (std::size_t i = 0; i < samples; ++i) v[i] /= norm;
+        }
+    }
+}
+
+void CP::TCoherentNoise::Project(const CP::TWaveformMatrix& waveforms,
+                                 const std::vector<std::size_t>& rows,
+                                 std::size_t size, std::size_t samples,
+                                 int threads) {
+    CP::ParallelFor(threads, rows.size(), [&](std::size_t r, int) {
+        const float* row = waveforms.GetRow(rows[r]);
+        std::size_t count
+            = std::min(waveforms.GetSampleCount(rows[r]), samples);
+        for (std::size_t p = 0; p < size; ++p) {
+            const double* basis = &fBasis[p*samples];
+            double dot = 0.0;
+            for (std::size_t i = 0; i < count; ++i) dot += row[i]*basis[i];
+            fCoefficients[r*size+p] = dot;
+        }
+    });
+}
+
+void CP::TCoherentNoise::Combine(const CP::TWaveformMatrix& waveforms,
+                                 const std::vector<std::size_t>& rows,
+                                 std::size_t size, std::size_t samples,
+                                 int threads) {
+    CP::ParallelFor(threads, size, [&](std::size_t p, int) {
+        double* basis = &fBasis[p*samples];
+        std::fill(basis, basis+samples, 0.0);
+        for (std::size_t r = 0; r < rows.size(); ++r) {
+            const float* row = waveforms.GetRow(rows[r]);
+            std::size_t count
+                = std::min(waveforms.GetSampleCount(rows[r]), samples);
+            double c = fCoefficients[r*size+p];
+            for (std::size_t i = 0; i < count; ++i) basis[i] += c*row[i];
+        }
+    });
+}
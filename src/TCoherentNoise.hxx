@@ -0,0 +1,99 @@
+#ifndef TCoherentNoise_hxx_seen
+#define TCoherentNoise_hxx_seen
+
+#include <TRandom3.h>
+
+#include <vector>
+
+namespace CP {
+    class TCoherentNoise;
+    class TWaveformMatrix;
+};
+
+/// Remove the coherent (common mode) noise from a group of rows in the
+/// waveform matrix by subtracting a low rank approximation.  The largest
+/// few components shared by the rows are found with a randomized truncated
+/// SVD: the rows are projected onto a few random combinations, a couple of
+/// power iterations sharpen the basis, and a small eigenvalue problem picks
+/// the strongest components.  The projection of each row onto those
+/// components is subtracted in place.  For N rows with S samples and rank k,
+/// the cost is proportional to N*S*k, and the work areas are only (N+S)*k,
+/// so there is no N*S (or N*N) scratch array.  The random numbers are
+/// seeded from the first row of the group so the result doesn't depend on
+/// which thread does the work.  This is not thread safe, so each thread
+/// needs it's own object.
+/// \code
+/// CP::TCoherentNoise coherent;
+/// coherent(waveforms, rows, threads);
+/// \endcode
+class CP::TCoherentNoise {
+public:
+    TCoherentNoise();
+    virtual ~TCoherentNoise();
+
+    /// Remove the coherent noise from the rows of the waveform matrix in the
+    /// group.  The threads are used to split the work over the rows, and
+    /// should be one when the groups are being done in parallel.  This
+    /// returns the number of components that were removed.
+    int operator()(CP::TWaveformMatrix& waveforms,
+                   const std::vector<std::size_t>& rows,
+                   int threads = 1);
+
+    /// Set the number of components to remove.
+    void SetRank(int rank) {fRank = rank;}
+
+    /// Get the number of components to remove.
+    int GetRank() const {return fRank;}
+
+private:
+
+    /// Make the rows of the basis orthonormal.  Basis vectors that end up
+    /// with no length are set to zero.
+    void Orthonormalize(std::size_t size, std::size_t samples);
+
+    /// Fill fCoefficients with the dot product of each row with each basis
+    /// vector.
+    void Project(const CP::TWaveformMatrix& waveforms,
+                 const std::vector<std::size_t>& rows,
+                 std::size_t size, std::size_t samples, int threads);
+
+    /// Fill the basis with the combinations of the rows given by
+    /// fCoefficients.
+    void Combine(const CP::TWaveformMatrix& waveforms,
+                 const std::vector<std::size_t>& rows,
+                 std::size_t size, std::size_t samples, int threads);
+
+    /// The number of components to remove.  This is set with the
+    /// clusterCalib.coherent.rank parameter.
+    int fRank;
+
+    /// The number of extra random vectors used to find the components.
+    /// This is set with the clusterCalib.coherent.oversampling parameter.
+    int fOversampling;
+
+    /// The number of power iterations.  This is set with the
+    /// clusterCalib.coherent.iterations parameter.
+    int fIterations;
+
+    /// The random numbers used for the projections.
+    TRandom3 fRandom;
+
+    /// The basis vectors (one per row, with a row length of samples).
+    std::vector<double> fBasis;
+
+    /// The coefficients for each row of the group (one row per waveform).
+    std::vector<double> fCoefficients;
+
+    /// A work area for the small eigenvalue problem.
+    std::vector<double> fGram;
+
+    /// The eigenvectors of the small eigenvalue problem.
+    std::vector<double> fVectors;
+
+    /// The components that are removed (one per row).
+    std::vector<double> fComponents;
+
+    /// The amount of each component in each row of the group.
+    std::vector<double> fAmplitudes;
+};
+#endif
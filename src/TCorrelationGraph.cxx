@@ -0,0 +1,66 @@
+#include "TCorrelationGraph.hxx"
+
+#include <algorithm>
+
+namespace {
+    bool EdgeNodeLess(const CP::TCorrelationGraph::Edge& a,
+                      const CP::TCorrelationGraph::Edge& b) {
+        return a.fNode < b.fNode;
+    }
+
+    bool EdgeNodeEqual(const CP::TCorrelationGraph::Edge& a,
+                       const CP::TCorrelationGraph::Edge& b) {
+        return a.fNode == b.fNode;
+    }
+}
+
+CP::TCorrelationGraph::TCorrelationGraph() {}
+
+CP::TCorrelationGraph::~TCorrelationGraph() {}
+
+void CP::TCorrelationGraph::Resize(std::size_t nodes) {
+    if (fEdges.size() < nodes) fEdges.resize(nodes);
+    for (std::size_t n = 0; n < fEdges.size(); ++n) fEdges[n].clear();
+    fEdges.resize(nodes);
+}
+
+double CP::TCorrelationGraph::GetWeight(std::size_t node) const {
+    double weight = 0.0;
+    for (Edges::const_iterator e = fEdges[node].begin();
+         e != fEdges[node].end(); ++e) {
+        weight += e->fWeight;
+    }
+    return weight;
+}
+
+std::size_t CP::TCorrelationGraph::GetEdgeCount() const {
+    std::size_t edges = 0;
+    for (std::size_t n = 0; n < fEdges.size(); ++n) {
+        edges += fEdges[n].size();
+    }
+    return edges;
+}
+
+void CP::TCorrelationGraph::Symmetrize() {
+    // Only the edges that were there at the start get reversed.
+    std::vector<std::size_t> original(fEdges.size());
+    for (std::size_t n = 0; n < fEdges.size(); ++n) {
+        original[n] = fEdges[n].size();
+    }
+    for (std::size_t n = 0; n < fEdges.size(); ++n) {
+        for (std::size_t e = 0; e < original[n]; ++e) {
+            Edge edge = fEdges[n][e];
+            fEdges[edge.fNode].push_back(Edge(n,edge.fWeight));
+        }
+    }
+    Unique();
+}
+
+void CP::TCorrelationGraph::Unique() {
+    for (std::size_t n = 0; n < fEdges.size(); ++n) {
+        std::stable_sort(fEdges[n].begin(), fEdges[n].end(), EdgeNodeLess);
+        fEdges[n].erase(std::unique(fEdges[n].begin(), fEdges[n].end(),
+                                    EdgeNodeEqual),
+                        fEdges[n].end());
+    }
+}
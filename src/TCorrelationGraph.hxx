@@ -0,0 +1,80 @@
+#ifndef TCorrelationGraph_hxx_seen
+#define TCorrelationGraph_hxx_seen
+
+#include <vector>
+
+namespace CP {
+    class TCorrelationGraph;
+};
+
+/// A sparse graph of the correlations between the rows of the waveform
+/// matrix (i.e. the channels), kept as an adjacency list.  Each node (row)
+/// has a list of edges to the other rows it is correlated with, and each
+/// edge has a weight.  This replaces the dense rows*rows array when only a
+/// few of the pairs are ever used (e.g. channels that share an ASIC or a
+/// motherboard).  The lists for different nodes can be filled by different
+/// threads.
+/// \code
+/// CP::TCorrelationGraph graph;
+/// graph.Resize(rows);
+/// graph.AddEdge(row1, row2, weight);
+/// for (auto& e: graph.GetEdges(row1)) { ... e.fNode, e.fWeight ... }
+/// \endcode
+class CP::TCorrelationGraph {
+public:
+    /// An edge from one node to another.
+    struct Edge {
+        Edge() : fNode(0), fWeight(0.0) {}
+        Edge(std::size_t node, double weight) : fNode(node), fWeight(weight) {}
+
+        /// The node at the other end of the edge.
+        std::size_t fNode;
+
+        /// The weight of the edge.
+        double fWeight;
+    };
+
+    typedef std::vector<Edge> Edges;
+
+    TCorrelationGraph();
+    virtual ~TCorrelationGraph();
+
+    /// Set the number of nodes and remove all of the edges.  The memory is
+    /// kept for the next event.
+    void Resize(std::size_t nodes);
+
+    /// Get the number of nodes.
+    std::size_t GetNodes() const {return fEdges.size();}
+
+    /// Add an edge from node to other.  This only changes the list for node,
+    /// so it's safe to call from different threads for different nodes.
+    void AddEdge(std::size_t node, std::size_t other, double weight) {
+        fEdges[node].push_back(Edge(other,weight));
+    }
+
+    /// @{ Get the edges for a node.
+    Edges& GetEdges(std::size_t node) {return fEdges[node];}
+    const Edges& GetEdges(std::size_t node) const {return fEdges[node];}
+    /// @}
+
+    /// Get the sum of the edge weights for a node.
+    double GetWeight(std::size_t node) const;
+
+    /// Get the total number of edges.
+    std::size_t GetEdgeCount() const;
+
+    /// Sort the edges for each node, and remove the duplicate edges.  The
+    /// first edge to each other node is kept.
+    void Unique();
+
+    /// Add the reverse of every edge, so that an edge from a to b is also an
+    /// edge from b to a.  This is used when the graph was filled with only
+    /// one edge for each pair.  Duplicate edges are removed.
+    void Symmetrize();
+
+private:
+
+    /// The list of edges for each node.
+    std::vector<Edges> fEdges;
+};
+#endif
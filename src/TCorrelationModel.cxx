@@ -0,0 +1,100 @@
+#include "TCorrelationModel.hxx"
+#include "TWaveformMatrix.hxx"
+
+#include <algorithm>
+
+namespace {
+    bool EdgeNodeLess(const CP::TCorrelationGraph::Edge& a,
+                      const CP::TCorrelationGraph::Edge& b) {
+        return a.fNode < b.fNode;
+    }
+}
+
+CP::TCorrelationModel::TCorrelationModel()
+    : fThreshold(0.6), fUpdates(0) {}
+
+CP::TCorrelationModel::~TCorrelationModel() {}
+
+void CP::TCorrelationModel::Reset() {
+    fChannels.clear();
+    fCorrelations.Resize(0);
+    fWeights.Resize(0);
+    fUpdates = 0;
+}
+
+bool CP::TCorrelationModel::Matches(
+    const CP::TWaveformMatrix& waveforms) const {
+    if (fChannels.size() != waveforms.GetRows()) return false;
+    for (std::size_t r = 0; r < fChannels.size(); ++r) {
+        if (fChannels[r] != waveforms.GetChannelId(r)) return false;
+    }
+    return true;
+}
+
+void CP::TCorrelationModel::Start(const CP::TWaveformMatrix& waveforms) {
+    fChannels.resize(waveforms.GetRows());
+    for (std::size_t r = 0; r < fChannels.size(); ++r) {
+        fChannels[r] = waveforms.GetChannelId(r);
+    }
+    fCorrelations.Resize(fChannels.size());
+    fWeights.Resize(fChannels.size());
+    fUpdates = 0;
+}
+
+bool CP::TCorrelationModel::Contains(std::size_t row1,
+                                     std::size_t row2) const {
+    if (row2 < row1) std::swap(row1,row2);
+    if (row1 >= fCorrelations.GetNodes()) return false;
+    const CP::TCorrelationGraph::Edges& edges = fCorrelations.GetEdges(row1);
+    return std::binary_search(edges.begin(), edges.end(),
+                              CP::TCorrelationGraph::Edge(row2,0.0),
+                              EdgeNodeLess);
+}
+
+void CP::TCorrelationModel::Update(const CP::TCorrelationGraph& measured,
+                                   double averaging) {
+    bool average = (0.0 < averaging && averaging < 1.0 && fUpdates > 0);
+    CP::TCorrelationGraph::Edges current;
+    CP::TCorrelationGraph::Edges merged;
+    std::size_t nodes = std::min(measured.GetNodes(),
+                                 fCorrelations.GetNodes());
+    for (std::size_t n = 0; n < nodes; ++n) {
+        current = measured.GetEdges(n);
+        std::sort(current.begin(), current.end(), EdgeNodeLess);
+        CP::TCorrelationGraph::Edges& old = fCorrelations.GetEdges(n);
+        merged.clear();
+        // Merge the sorted lists of old and measured pairs.
+        std::size_t o = 0;
+        std::size_t c = 0;
+        while (o < old.size() || c < current.size()) {
+            if (c >= current.size()
+                || (o < old.size() && old[o].fNode < current[c].fNode)) {
+                merged.push_back(old[o++]);
+                continue;
+            }
+            CP::TCorrelationGraph::Edge edge = current[c++];
+            if (o < old.size() && old[o].fNode == edge.fNode) {
+                if (average) {
+                    edge.fWeight = (1.0-averaging)*old[o].fWeight
+                        + averaging*edge.fWeight;
+                }
+                ++o;
+            }
+            if (edge.fWeight < fThreshold) continue;
+            merged.push_back(edge);
+        }
+        old.swap(merged);
+    }
+    ++fUpdates;
+
+    // Make the weights.  Favor the channels with high correlations.
+    fWeights.Resize(fCorrelations.GetNodes());
+    for (std::size_t n = 0; n < fCorrelations.GetNodes(); ++n) {
+        const CP::TCorrelationGraph::Edges& edges = fCorrelations.GetEdges(n);
+        for (std::size_t e = 0; e < edges.size(); ++e) {
+            double w = edges[e].fWeight;
+            fWeights.AddEdge(n, edges[e].fNode, w*w*w);
+        }
+    }
+    fWeights.Symmetrize();
+}
@@ -0,0 +1,87 @@
+#ifndef TCorrelationModel_hxx_seen
+#define TCorrelationModel_hxx_seen
+
+#include "TCorrelationGraph.hxx"
+
+#include <TChannelId.hxx>
+
+#include <vector>
+
+namespace CP {
+    class TCorrelationModel;
+    class TWaveformMatrix;
+};
+
+/// The channel to channel correlations kept across events.  The correlation
+/// structure comes from the electronics so it barely changes during a run,
+/// and the model lets the correlated pedestal be found by applying cached
+/// weights instead of recalculating the correlations for every event.  The
+/// model is indexed by the rows of the waveform matrix, and remembers the
+/// channel for each row so it can tell when the rows change (and the model
+/// needs to be started again).  The model is updated with the correlations
+/// measured for an event.  The update can replace the correlations, or can
+/// take an exponentially weighted moving average.  Only pairs with a strong
+/// averaged correlation are kept.
+/// \code
+/// if (!model.Matches(waveforms)) model.Start(waveforms);
+/// model.Update(measured, averaging);
+/// const CP::TCorrelationGraph& weights = model.GetWeights();
+/// \endcode
+class CP::TCorrelationModel {
+public:
+    TCorrelationModel();
+    virtual ~TCorrelationModel();
+
+    /// Forget the model.
+    void Reset();
+
+    /// Check if the model was started with the same channels in the same
+    /// rows as the waveform matrix.
+    bool Matches(const CP::TWaveformMatrix& waveforms) const;
+
+    /// Start a new (empty) model for the rows of the waveform matrix.
+    void Start(const CP::TWaveformMatrix& waveforms);
+
+    /// Check if the model has a correlation for a pair of rows.
+    bool Contains(std::size_t row1, std::size_t row2) const;
+
+    /// Update the model with the correlations measured for an event.  The
+    /// measured graph has one edge from the lower row to the higher row for
+    /// each pair, and the edge weight is the correlation.  It should contain
+    /// every strong correlation, and every pair where Contains() is true (if
+    /// it could be measured).  The averaging is the weight given to the new
+    /// measurement.  If it is not between zero and one, the measurement
+    /// replaces the model for the measured pairs.  Pairs that weren't
+    /// measured keep their old value.
+    void Update(const CP::TCorrelationGraph& measured, double averaging);
+
+    /// Get the weights to be applied to find the correlated pedestal.  This
+    /// has an edge in both directions for each strongly correlated pair, and
+    /// the weight is the cube of the correlation.
+    const CP::TCorrelationGraph& GetWeights() const {return fWeights;}
+
+    /// Get the number of updates since the model was started.
+    int GetUpdates() const {return fUpdates;}
+
+    /// Set the minimum averaged correlation for a pair to be kept.
+    void SetThreshold(double threshold) {fThreshold = threshold;}
+
+private:
+
+    /// The channel for each row of the waveform matrix.
+    std::vector<CP::TChannelId> fChannels;
+
+    /// The averaged correlations.  There is one edge from the lower row to
+    /// the higher row for each pair, and the edges are sorted by row.
+    CP::TCorrelationGraph fCorrelations;
+
+    /// The weights made from fCorrelations.
+    CP::TCorrelationGraph fWeights;
+
+    /// The minimum correlation for a pair to be kept.
+    double fThreshold;
+
+    /// The number of updates since the model was started.
+    int fUpdates;
+};
+#endif
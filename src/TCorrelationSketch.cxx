@@ -0,0 +1,130 @@
+#include "TCorrelationSketch.hxx"
+#include "TCorrelationGraph.hxx"
+#include "TWaveformMatrix.hxx"
+#include "ParallelFor.hxx"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// The number of 64 bit words in a signature.
+    const int kSignatureWords = 4;
+
+    /// The number of bits in a signature.
+    const int kSignatureBits = 64*kSignatureWords;
+
+    /// The most tables that will be used.
+    const int kMaximumTables = 1000;
+}
+
+CP::TCorrelationSketch::TCorrelationSketch()
+    : fBits(12), fTables(1), fDepth(0) {
+    Configure(12, 0.9, 0.6);
+}
+
+CP::TCorrelationSketch::~TCorrelationSketch() {}
+
+void CP::TCorrelationSketch::Configure(int bits, double recall,
+                                       double threshold) {
+    // The key has to fit in one word.
+    fBits = std::max(1, std::min(64, bits));
+    recall = std::max(0.0, std::min(0.9999, recall));
+    threshold = std::max(-1.0, std::min(1.0, threshold));
+
+    // The chance that a pair at the threshold matches one table, and the
+    // number of tables needed to find it with the requested recall.
+    double agree = 1.0 - std::acos(threshold)/M_PI;
+    double match = std::pow(agree, fBits);
+    // The number of tables is clamped as a double since it can be huge (or
+    // infinite) when a match is unlikely.
+    double tables = 1.0;
+    if (match < 1.0 && recall > 0.0) {
+        tables = std::ceil(std::log(1.0-recall)/std::log(1.0-match));
+    }
+    if (!(tables >= 1.0)) tables = 1.0;
+    tables = std::min<double>(kMaximumTables, tables);
+    fTables = static_cast<int>(tables);
+
+    // Choose the signature bits for each table.
+    fRandom.SetSeed(4357);
+    fKeyBits.resize(fTables*fBits);
+    std::vector<int> bitList(kSignatureBits);
+    for (int t = 0; t < fTables; ++t) {
+        for (int b = 0; b < kSignatureBits; ++b) bitList[b] = b;
+        for (int b = 0; b < fBits; ++b) {
+            int pick = b + fRandom.Integer(kSignatureBits - b);
+            std::swap(bitList[b], bitList[pick]);
+            fKeyBits[t*fBits + b] = bitList[b];
+        }
+    }
+    fDepth = 0;
+}
+
+void CP::TCorrelationSketch::MakeDirections(std::size_t depth) {
+    if (depth == fDepth) return;
+    fDepth = depth;
+    fRandom.SetSeed(4358);
+    fDirections.resize(kSignatureBits*fDepth);
+    for (std::size_t i = 0; i < fDirections.size(); ++i) {
+        fDirections[i] = fRandom.Gaus();
+    }
+}
+
+std::size_t CP::TCorrelationSketch::FindCandidates(
+    const CP::TWaveformMatrix& waveforms,
+    const std::vector<std::size_t>& rows,
+    CP::TCorrelationGraph& graph,
+    int threads) {
+    const std::size_t n = rows.size();
+    if (n < 2) return 0;
+    std::size_t samples = 0;
+    for (std::size_t r = 0; r < n; ++r) {
+        samples = std::max(samples, waveforms.GetSampleCount(rows[r]));
+    }
+    MakeDirections((samples + 3)/4);
+
+    // Find the signature for each row.
+    fSignatures.assign(n*kSignatureWords, 0);
+    CP::ParallelFor(threads, n, [&](std::size_t r, int) {
+        const float* row = waveforms.GetRow(rows[r]);
+        std::size_t count = waveforms.GetSampleCount(rows[r]);
+        std::uint64_t* signature = &fSignatures[r*kSignatureWords];
+        for (int b = 0; b < kSignatureBits; ++b) {
+            const double* direction = &fDirections[b*fDepth];
+            double dot = 0.0;
+            for (std::size_t k = 0; 4*k < count; ++k) {
+                dot += row[4*k]*direction[k];
+            }
+            if (dot > 0.0) signature[b/64] |= (std::uint64_t(1) << (b%64));
+        }
+    });
+
+    // Hash the rows into each table, and add the pairs that share a key.
+    std::size_t added = 0;
+    std::vector< std::pair<std::uint64_t, std::size_t> > keys(n);
+    for (int t = 0; t < fTables; ++t) {
+        const int* keyBits = &fKeyBits[t*fBits];
+        for (std::size_t r = 0; r < n; ++r) {
+            const std::uint64_t* signature = &fSignatures[r*kSignatureWords];
+            std::uint64_t key = 0;
+            for (int b = 0; b < fBits; ++b) {
+                int bit = keyBits[b];
+                key = (key << 1) | ((signature[bit/64] >> (bit%64)) & 1);
+            }
+            keys[r] = std::make_pair(key, rows[r]);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (std::size_t k1 = 0; k1 < n; ++k1) {
+            for (std::size_t k2 = k1+1; k2 < n; ++k2) {
+                if (keys[k1].first != keys[k2].first) break;
+                graph.AddEdge(keys[k1].second, keys[k2].second, 0.0);
+                ++added;
+            }
+        }
+        // Strongly correlated rows share a key in most tables, so remove
+        // the duplicates as the tables are filled.
+        if (t%8 == 7) graph.Unique();
+    }
+    graph.Unique();
+    return added;
+}
@@ -0,0 +1,83 @@
+#ifndef TCorrelationSketch_hxx_seen
+#define TCorrelationSketch_hxx_seen
+
+#include <TRandom3.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace CP {
+    class TCorrelationSketch;
+    class TCorrelationGraph;
+    class TWaveformMatrix;
+};
+
+/// Find the pairs of rows in the waveform matrix that are likely to be
+/// strongly correlated without checking every pair.  Each row gets a 256
+/// bit signature made from the signs of it's projections on random
+/// directions (using every fourth sample, like the correlation).  Two rows
+/// with a correlation of c have the same sign for a direction with a
+/// probability of 1-acos(c)/pi.  The rows are hashed into several tables,
+/// where each table uses a random subset of the signature bits as the key,
+/// and the rows that share a key in any table are the candidate pairs.  The
+/// number of tables is chosen so that a pair at the correlation threshold is
+/// found with the requested recall (the tables share the signature bits, so
+/// this is approximate).  The exact correlation is then only calculated for
+/// the candidates.
+/// \code
+/// CP::TCorrelationSketch sketch;
+/// sketch.Configure(12, 0.9, 0.6);
+/// sketch.FindCandidates(waveforms, rows, graph, threads);
+/// \endcode
+class CP::TCorrelationSketch {
+public:
+    TCorrelationSketch();
+    virtual ~TCorrelationSketch();
+
+    /// Set the number of signature bits used as the key for each table, the
+    /// probability that a pair with a correlation at the threshold is found,
+    /// and the correlation threshold.
+    void Configure(int bits, double recall, double threshold);
+
+    /// Add an edge from the lower row to the higher row to the graph for
+    /// each candidate pair.  The graph must have a node for every row of the
+    /// waveform matrix.  The edges have a zero weight, and the edges for
+    /// each node are sorted without duplicates (see
+    /// TCorrelationGraph::Unique).  This returns the number of pairs found
+    /// (counting a pair once for each table).
+    std::size_t FindCandidates(const CP::TWaveformMatrix& waveforms,
+                               const std::vector<std::size_t>& rows,
+                               CP::TCorrelationGraph& graph,
+                               int threads = 1);
+
+    /// Get the number of tables.
+    int GetTables() const {return fTables;}
+
+private:
+
+    /// Make the random directions for a row length (in steps of four
+    /// samples).
+    void MakeDirections(std::size_t depth);
+
+    /// The number of signature bits in each key.
+    int fBits;
+
+    /// The number of tables.
+    int fTables;
+
+    /// The random directions.  There is one for each signature bit.
+    std::vector<double> fDirections;
+
+    /// The length of the random directions.
+    std::size_t fDepth;
+
+    /// The signature bits used by each table (fBits per table).
+    std::vector<int> fKeyBits;
+
+    /// The signature for each row (several words per row).
+    std::vector<std::uint64_t> fSignatures;
+
+    /// The random numbers for the directions and the key bits.
+    TRandom3 fRandom;
+};
+#endif
@@ -1,4 +1,7 @@
 #include "TElectronicsResponse.hxx"
+#include "TFFTPlans.hxx"
+#include "TFFTBatch.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TEvent.hxx>
 #include <TEventFolder.hxx>
@@ -9,103 +12,134 @@
 #include <TChannelId.hxx>
 #include <TChannelCalib.hxx>
 
-#include <TVirtualFFT.h>
 #include <TH1F.h>
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 
+namespace {
+    /// The position of the time step in the key.
+    const std::size_t kKeyStep = 2;
+}
+
 CP::TElectronicsResponse::TElectronicsResponse() 
-    : fMustRecalculate(true) {}
+    : fMustRecalculate(true), fSize(0) {}
 
 CP::TElectronicsResponse::TElectronicsResponse(int size) 
-    : fMustRecalculate(true) {
-    fResponse.resize(size);
-    fFrequency.resize(size);
-}
+    : fMustRecalculate(true), fSize(size) {}
 
 CP::TElectronicsResponse::~TElectronicsResponse() { }
 
 void CP::TElectronicsResponse::SetSize(int s) {
-    if (s == (int) fResponse.size()) return;
+    if (s == fSize) return;
     fMustRecalculate = true;
-    fResponse.resize(s);
-    fFrequency.resize(s);
+    fSize = s;
+    fKey.clear();
+    fEntry.reset();
 }
 
 CP::TElectronicsResponse::Response
 CP::TElectronicsResponse::GetResponse(int i) {
     if (i<0) return 0.0;
-    if ((int) fResponse.size() <= i) return 0.0;
+    if (fSize <= i) return 0.0;
+    Calculate();
+    return fEntry->fResponse[i];
+}
+
+const std::vector<double>& CP::TElectronicsResponse::GetMagnitudes() {
     Calculate();
-    return fResponse[i];
+    return fEntry->fMagnitude;
 }
 
 CP::TElectronicsResponse::Frequency 
 CP::TElectronicsResponse::GetFrequency(int i) {
     if (i<0) return Frequency(0,0);
-    if ((int) fFrequency.size() <= i) return Frequency(0,0);
+    if ((int) GetFrequencyCount() <= i) return Frequency(0,0);
     Calculate();
-    return fFrequency[i];
+    return fEntry->fFrequency[i];
+}
+
+void CP::TElectronicsResponse::MakeKey(CP::TResponseBank::Key& key) {
+    // The pulse shape is found from the time step and the shaping constants
+    // (the peaking time, and the rise and fall shapes are the gain
+    // constants of order 2 to 4), so these are the key, and the shape is
+    // only sampled when the response isn't in the bank.
+    CP::TChannelInfoLock lock(fEventContext);
+    TChannelCalib calib;
+    key.resize(kKeyStep + 5);
+    key[0] = 0; // The electronics responses.
+    key[1] = fSize;
+    key[kKeyStep] = calib.GetTimeConstant(fChannelId);
+    key[kKeyStep+1] = calib.GetGainConstant(fChannelId,2);
+    key[kKeyStep+2] = calib.GetGainConstant(fChannelId,3);
+    key[kKeyStep+3] = calib.GetGainConstant(fChannelId,4);
+    key[kKeyStep+4] = calib.IsBipolarSignal(fChannelId) ? 1 : 0;
 }
 
 bool CP::TElectronicsResponse::Calculate() {
-    if (!fMustRecalculate) return false;
+    if (!fMustRecalculate && fEntry) return false;
     fMustRecalculate = false;
+    if (fKey.empty()) MakeKey(fKey);
 
     TChannelCalib calib;
-    
+    std::shared_ptr<CP::TResponseBank::Entry> entry(
+        new CP::TResponseBank::Entry);
+    std::vector<Response>& response = entry->fResponse;
+
     // Fill the response function.  This explicitly normalizes so that the
     // pulse shaping is amplitude conserving (the pulse shaping for a
     // "delta-function" sample doesn't change the pulse height).
+    double step = fKey[kKeyStep];
+    response.resize(fSize);
     double normalization = 0.0;
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        double arg = calib.GetTimeConstant(fChannelId)*(1.0*i+0.5);
-        double v = calib.GetPulseShape(fChannelId,arg);
-        fResponse[i] = v;
-        normalization = std::max(normalization,v);
+    {
+        CP::TChannelInfoLock lock(fEventContext);
+        for (int i=0; i<fSize; ++i) {
+            double v = calib.GetPulseShape(fChannelId,step*(1.0*i+0.5));
+            response[i] = v;
+            normalization = std::max(normalization,v);
+        }
     }
-    if (normalization < 1E-20) return false;
-    for (std::vector<Response>::iterator r = fResponse.begin();
-         r != fResponse.end(); ++r) {
-        (*r) /= normalization;
+    if (normalization < 1E-20) {
+        CaptError("Electronics response is zero for " << fChannelId);
+        normalization = 1.0;
     }
+    for (int i=0; i<fSize; ++i) response[i] /= normalization;
 
     // Calculate the FFT of the response 
-    int size = fResponse.size();
-    std::unique_ptr<TVirtualFFT> fft(TVirtualFFT::FFT(1,&size,"R2C ES K"));
-    if (size != (int) fResponse.size()) {
-        CaptError("Invalid length for FFT");
-        CaptError("     original length: " << fResponse.size());
-        CaptError("     allocated length: " << size);
-    }
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        fft->SetPoint(i,fResponse[i]);
-    }
-    fft->Transform();
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        double rl,im;
-        fft->GetPointComplex(i,rl,im);
-        fFrequency[i] = std::complex<double>(rl,im);
+    CP::TFFTBatch* fft = CP::TFFTPlans::Get().AcquireBatch(fSize, 1, false);
+    std::copy(response.begin(), response.end(), fft->GetReal(0));
+    fft->Forward();
+    const CP::TFFTBatch::Complex* freq = fft->GetComplex(0);
+    entry->fFrequency.assign(freq, freq + GetFrequencyCount());
+    CP::TFFTPlans::Get().Release(fft);
+    entry->fMagnitude.resize(entry->fFrequency.size());
+    for (std::size_t i=0; i<entry->fFrequency.size(); ++i) {
+        entry->fMagnitude[i] = std::abs(entry->fFrequency[i]);
     }
 
+    // Share the response with the other channels that have the same
+    // constants.
+    fEntry = CP::TResponseBank::Get().Add(fKey, entry);
+
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* elecResp = new TH1F(
         (fChannelId.AsString()+"-elec").c_str(),
         ("Electronics Response for " + fChannelId.AsString()).c_str(),
-        fResponse.size(),
-        0.0, fResponse.size()*calib.GetTimeConstant(fChannelId));
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        elecResp->SetBinContent(i+1, std::abs(fResponse[i]));
+        response.size(),
+        0.0, response.size()*calib.GetTimeConstant(fChannelId));
+    for (std::size_t i=0; i<response.size(); ++i) {
+        elecResp->SetBinContent(i+1, std::abs(response[i]));
     }
     TH1F* elecFreq = new TH1F(
         (fChannelId.AsString()+"-elecFFT").c_str(),
         ("FFT of the electronics Response for" + fChannelId.AsString()).c_str(),
-        fFrequency.size(),
+        entry->fFrequency.size(),
         0.0, (0.5/calib.GetTimeConstant(fChannelId))/unit::hertz);
-    for (std::size_t i=0; i<fFrequency.size(); ++i) {
-        elecFreq->SetBinContent(i+1, std::abs(fFrequency[i]));
+    for (std::size_t i=0; i<entry->fFrequency.size(); ++i) {
+        elecFreq->SetBinContent(i+1, entry->fMagnitude[i]);
     }
 #endif
 
@@ -114,21 +148,17 @@ bool CP::TElectronicsResponse::Calculate() {
 
 bool CP::TElectronicsResponse::Calculate(const CP::TEventContext& context,
                                          const CP::TChannelId channel) {
-
-    // Check for all the things that might have changed.
-    if (channel.IsMCChannel() != fChannelId.IsMCChannel()) {
-        fMustRecalculate = true;
-    }
-
-    if (channel.IsTPCChannel() != fChannelId.IsTPCChannel()) {
-        fMustRecalculate = true;
-    }
-
-    if (context != fEventContext) {
-        fMustRecalculate = true;
-    }
-        
     fEventContext = context;
     fChannelId = channel;
+
+    // The response only changes if the constants for the channel are
+    // different.  A response for the constants that was already calculated
+    // (by any channel or thread) is taken from the bank, so the pulse shape
+    // is only sampled for new constants.
+    MakeKey(fNextKey);
+    if (fEntry && fNextKey == fKey) return false;
+    fKey.swap(fNextKey);
+    fEntry = CP::TResponseBank::Get().Find(fKey);
+    fMustRecalculate = !fEntry;
     return true;
 }
@@ -1,11 +1,15 @@
 #ifndef TElectronicsResponse_hxx_seen
 #define TElectronicsResponse_hxx_seen
 
+#include "TResponseBank.hxx"
+
 #include <TEventContext.hxx>
 #include <TChannelId.hxx>
 #include <HEPUnits.hxx>
 
 #include <complex>
+#include <memory>
+#include <vector>
 
 namespace CP {
     class TElectronicsResponse;
@@ -36,7 +40,7 @@ public:
 
     /// @{ Set (or Get) the number of samples.
     void SetSize(int s);
-    std::size_t GetSize() const {return fResponse.size();}
+    std::size_t GetSize() const {return fSize;}
     /// @}
 
     /// Get the response for a time bin.  This returns 0.0 if the bin is out
@@ -44,10 +48,20 @@ public:
     /// vector size).
     double GetResponse(int i);
 
-    /// Get the FFT for a frequency bin.  This returns 0+0*i if the bin is out
-    /// of the frequency range.
+    /// Get the FFT for a frequency bin.  The response is real, so only the
+    /// non-negative frequencies (bins 0 to GetSize()/2) are kept, and the
+    /// negative frequencies are their complex conjugates.  This returns
+    /// 0+0*i if the bin is out of the frequency range.
     Frequency GetFrequency(int i);
 
+    /// Get the number of frequency bins that are kept (GetSize()/2+1).
+    std::size_t GetFrequencyCount() const {return fSize/2+1;}
+
+    /// Get the magnitude of the FFT for all of the frequency bins.  This is
+    /// calculated with the frequencies, so the noise filter doesn't need to
+    /// find it for every channel.
+    const std::vector<double>& GetMagnitudes();
+
     /// Get the event context of the last event for which the response
     /// function was calculated.
     const CP::TEventContext& GetEventContext() const {return fEventContext;}
@@ -58,16 +72,25 @@ public:
 
     /// Calculate the delta function response for a particular
     /// CP::TEventContext and CP::TChannelId.  This also calculates the FFT
-    /// for use in a convolution or deconvolution.  This returns true if the
-    /// response function will be recalculated, but doesn't do the actual
-    /// recalculation.  The recalculation will be done on the first call to
-    /// GetResponse, or GetFrequency.
+    /// for use in a convolution or deconvolution.  The responses are kept
+    /// in the CP::TResponseBank keyed by the time constant and the pulse
+    /// shaping constants for the channel, so the shape is only sampled and
+    /// the FFT is only done once for each response.  This returns true if
+    /// the response changed.
+    /// If the response isn't in the bank, the recalculation is done on the
+    /// first call to GetResponse, or GetFrequency.
     bool Calculate(const CP::TEventContext& context, const CP::TChannelId id);
     
-    /// Calculate the delta function response for a particular peaking time.
-    /// This version of the Calculate method always returns true, and does the
-    /// actual recalculation.
+    /// Calculate the delta function response for the current channel, and
+    /// add it to the response bank.  This returns true if the response was
+    /// recalculated.
     bool Calculate();
+
+    /// Get the response that is being used.  The response is shared with
+    /// the other channels that have the same constants.
+    std::shared_ptr<const CP::TResponseBank::Entry> GetEntry() const {
+        return fEntry;
+    }
     
 private:
     /// Return true if the delta function response has changed since the last
@@ -89,10 +112,23 @@ private:
     /// The channel id of the last calculation.
     CP::TChannelId fChannelId;
 
-    /// The response distribution
-    std::vector<Response> fResponse;
+    /// Make the key for the response bank for the current channel.  The
+    /// key is the time step, the pulse shaping constants, and whether the
+    /// signal is bipolar.
+    void MakeKey(CP::TResponseBank::Key& key);
+
+    /// The number of samples in the response.
+    int fSize;
+
+    /// The key for the current response.
+    CP::TResponseBank::Key fKey;
+
+    /// The key for the next channel.  This is kept so the memory is reused
+    /// for each channel.
+    CP::TResponseBank::Key fNextKey;
 
-    /// The frequency distribution
-    std::vector<Frequency> fFrequency;
+    /// The response distribution, the frequency distribution for the
+    /// non-negative frequencies, and the magnitude of the frequencies.
+    std::shared_ptr<const CP::TResponseBank::Entry> fEntry;
 };
 #endif
@@ -0,0 +1,378 @@
+#include "TEventPipeline.hxx"
+
+#include <TCaptLog.hxx>
+
+#include <RVersion.h>
+#if ROOT_VERSION(6,0,0) < ROOT_VERSION_CODE
+#include <TROOT.h>
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    /// An event that is in flight through the pipeline.
+    struct TSlot {
+        explicit TSlot(CP::TEvent* event)
+            : fEvent(event), fFinished(false), fSave(false) {}
+        std::unique_ptr<CP::TEvent> fEvent;
+        bool fFinished;
+        bool fSave;
+    };
+
+    /// A queue of events between two threads.  Push blocks while the queue
+    /// is full, and Pop blocks while it's empty.  After the queue is closed,
+    /// Push refuses new events, and Pop returns false once the queue is
+    /// empty.  Any events left in the queue are deleted with the queue.
+    class TEventQueue {
+    public:
+        explicit TEventQueue(std::size_t depth)
+            : fDepth(std::max((std::size_t) 1, depth)), fClosed(false) {}
+
+        ~TEventQueue() {
+            for (std::size_t i = 0; i < fQueue.size(); ++i) delete fQueue[i];
+        }
+
+        /// Add an event to the queue.  This returns false (and the caller
+        /// still owns the event) if the queue has been closed.
+        bool Push(CP::TEvent* event) {
+            std::unique_lock<std::mutex> guard(fLock);
+            fNotFull.wait(guard, [&]{
+                    return fClosed || fQueue.size() < fDepth;});
+            if (fClosed) return false;
+            fQueue.push_back(event);
+            fNotEmpty.notify_one();
+            return true;
+        }
+
+        /// Get the next event.  This returns false when the queue is closed
+        /// and empty.
+        bool Pop(CP::TEvent*& event) {
+            std::unique_lock<std::mutex> guard(fLock);
+            fNotEmpty.wait(guard, [&]{return fClosed || !fQueue.empty();});
+            if (fQueue.empty()) return false;
+            event = fQueue.front();
+            fQueue.pop_front();
+            fNotFull.notify_one();
+            return true;
+        }
+
+        /// Close the queue.
+        void Close() {
+            std::lock_guard<std::mutex> guard(fLock);
+            fClosed = true;
+            fNotFull.notify_all();
+            fNotEmpty.notify_all();
+        }
+
+    private:
+        std::size_t fDepth;
+        bool fClosed;
+        std::deque<CP::TEvent*> fQueue;
+        std::mutex fLock;
+        std::condition_variable fNotFull;
+        std::condition_variable fNotEmpty;
+    };
+
+    /// Get the seconds since a start time.
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+CP::TEventPipeline::TEventPipeline(int workers, int window)
+    : fWorkers(workers), fWindow(window),
+      fReadAhead(0), fWriteBehind(0),
+      fEventsRead(0), fEventsWritten(0), fElapsedTime(0.0),
+      fInputWait(0.0), fOutputWait(0.0), fComputeTime(0.0),
+      fReadTime(0.0), fWriteTime(0.0) {
+    if (fWorkers < 0) fWorkers = 0;
+    if (fWindow < 1) fWindow = 2*fWorkers;
+    if (fWindow < fWorkers) fWindow = fWorkers;
+    if (fWindow < 1) fWindow = 1;
+}
+
+CP::TEventPipeline::~TEventPipeline() {}
+
+int CP::TEventPipeline::Process(CP::TRootInput& input,
+                                CP::TRootOutput* output,
+                                Function work, int maxEvents) {
+    std::chrono::steady_clock::time_point start
+        = std::chrono::steady_clock::now();
+
+#if ROOT_VERSION(6,0,0) < ROOT_VERSION_CODE
+    // The other threads create ROOT objects, so ROOT needs to protect it's
+    // global state.
+    if (fWorkers > 0 || fReadAhead > 0 || fWriteBehind > 0) {
+        ROOT::EnableThreadSafety();
+    }
+#endif
+
+    // The first exception thrown by any of the threads.
+    std::mutex errorLock;
+    std::exception_ptr error;
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (!error) error = e;
+    };
+    auto failed = [&]() {
+        std::lock_guard<std::mutex> guard(errorLock);
+        return (bool) error;
+    };
+
+    // Read the events, either with a reader thread, or directly when they
+    // are needed.
+    int eventsRead = 0;
+    double readTime = 0.0;
+    auto readEvent = [&]() -> CP::TEvent* {
+        if (0 <= maxEvents && maxEvents <= eventsRead) return NULL;
+        std::chrono::steady_clock::time_point t
+            = std::chrono::steady_clock::now();
+        CP::TEvent* event = input.NextEvent();
+        readTime += Seconds(t);
+        if (event) ++eventsRead;
+        return event;
+    };
+    std::unique_ptr<TEventQueue> readQueue;
+    std::thread reader;
+    if (fReadAhead > 0) {
+        readQueue.reset(new TEventQueue(fReadAhead));
+        reader = std::thread([&]() {
+                try {
+                    for (;;) {
+                        std::unique_ptr<CP::TEvent> event(readEvent());
+                        if (!event) break;
+                        if (!readQueue->Push(event.get())) break;
+                        event.release();
+                    }
+                }
+                catch (...) {
+                    fail(std::current_exception());
+                }
+                readQueue->Close();
+            });
+    }
+    double inputWait = 0.0;
+    auto nextEvent = [&]() -> CP::TEvent* {
+        std::chrono::steady_clock::time_point t
+            = std::chrono::steady_clock::now();
+        CP::TEvent* event = NULL;
+        if (readQueue) {
+            if (!readQueue->Pop(event)) event = NULL;
+        }
+        else event = readEvent();
+        inputWait += Seconds(t);
+        return event;
+    };
+
+    // Write the events, either with a writer thread, or directly.
+    int eventsWritten = 0;
+    double writeTime = 0.0;
+    auto writeEvent = [&](CP::TEvent* event) {
+        std::unique_ptr<CP::TEvent> owned(event);
+        std::chrono::steady_clock::time_point t
+            = std::chrono::steady_clock::now();
+        output->WriteEvent(*owned);
+        writeTime += Seconds(t);
+        ++eventsWritten;
+    };
+    std::unique_ptr<TEventQueue> writeQueue;
+    std::thread writer;
+    if (fWriteBehind > 0 && output) {
+        writeQueue.reset(new TEventQueue(fWriteBehind));
+        writer = std::thread([&]() {
+                CP::TEvent* event;
+                try {
+                    while (writeQueue->Pop(event)) writeEvent(event);
+                }
+                catch (...) {
+                    fail(std::current_exception());
+                }
+                writeQueue->Close();
+            });
+    }
+    double outputWait = 0.0;
+    auto saveEvent = [&](std::unique_ptr<CP::TEvent> event, bool save) {
+        if (!save || !output) return;
+        std::chrono::steady_clock::time_point t
+            = std::chrono::steady_clock::now();
+        if (writeQueue) {
+            if (writeQueue->Push(event.get())) event.release();
+        }
+        else writeEvent(event.release());
+        outputWait += Seconds(t);
+    };
+
+    // The time spent in the processing function by each worker.
+    std::vector<double> computeTime(std::max(1,fWorkers));
+    auto compute = [&](CP::TEvent& event, int worker) {
+        std::chrono::steady_clock::time_point t
+            = std::chrono::steady_clock::now();
+        bool save = work(event,worker);
+        computeTime[worker] += Seconds(t);
+        return save;
+    };
+
+    // The events in flight in the input order, and the events waiting for a
+    // worker.  Both are protected by the lock.
+    std::deque< std::shared_ptr<TSlot> > inFlight;
+    std::deque< std::shared_ptr<TSlot> > waiting;
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::condition_variable eventFinished;
+    bool stop = false;
+    bool workFailed = false;
+
+    auto worker = [&](int id) {
+        for (;;) {
+            std::shared_ptr<TSlot> slot;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                workReady.wait(guard,
+                               [&]{return stop || !waiting.empty();});
+                if (waiting.empty()) return;
+                slot = waiting.front();
+                waiting.pop_front();
+            }
+            bool save = false;
+            bool threw = false;
+            try {
+                save = compute(*slot->fEvent, id);
+            }
+            catch (...) {
+                fail(std::current_exception());
+                threw = true;
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                slot->fSave = save;
+                slot->fFinished = true;
+                if (threw) workFailed = true;
+            }
+            eventFinished.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < fWorkers; ++w) pool.push_back(std::thread(worker,w));
+
+    try {
+        if (fWorkers < 1) {
+            // Process the events one at a time in this thread.
+            while (!failed()) {
+                std::unique_ptr<CP::TEvent> event(nextEvent());
+                if (!event) break;
+                bool save = compute(*event,0);
+                saveEvent(std::move(event), save);
+            }
+        }
+        else {
+            bool endOfInput = false;
+            bool haveRun = false;
+            int currentRun = 0;
+            std::unique_ptr<CP::TEvent> next;
+            while (!failed()) {
+                // Read events until the window is full.  An event from a new
+                // run is held until the previous run has been drained.
+                for (;;) {
+                    std::size_t events;
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if (workFailed) break;
+                        events = inFlight.size();
+                    }
+                    if ((int) events >= fWindow) break;
+                    if (!next) {
+                        if (endOfInput) break;
+                        next.reset(nextEvent());
+                        if (!next) {
+                            endOfInput = true;
+                            break;
+                        }
+                    }
+                    // The channel information lookups set the context of
+                    // their event (see TChannelInfoLock.hxx), but the
+                    // calibration tables are loaded for a run, so the events
+                    // in flight must all be from the same run.
+                    int run = next->GetContext().GetRun();
+                    if (haveRun && run != currentRun && events > 0) break;
+                    haveRun = true;
+                    currentRun = run;
+                    std::shared_ptr<TSlot> slot(new TSlot(next.release()));
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        inFlight.push_back(slot);
+                        waiting.push_back(slot);
+                    }
+                    workReady.notify_one();
+                }
+
+                // Write the oldest event once it's finished.
+                std::shared_ptr<TSlot> slot;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    if (workFailed) break;
+                    if (inFlight.empty()) {
+                        if (endOfInput && !next) break;
+                        continue;
+                    }
+                    eventFinished.wait(guard, [&]{
+                            return workFailed || inFlight.front()->fFinished;});
+                    if (workFailed) break;
+                    slot = inFlight.front();
+                    inFlight.pop_front();
+                }
+                saveEvent(std::move(slot->fEvent), slot->fSave);
+            }
+        }
+    }
+    catch (...) {
+        fail(std::current_exception());
+    }
+
+    // Stop the workers.  Any events that haven't been started are dropped.
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        waiting.clear();
+    }
+    workReady.notify_all();
+    for (std::size_t w = 0; w < pool.size(); ++w) pool[w].join();
+
+    // Stop the reader, and wait for the writer to finish the events that it
+    // has been given.
+    if (readQueue) {
+        readQueue->Close();
+        reader.join();
+    }
+    if (writeQueue) {
+        writeQueue->Close();
+        writer.join();
+    }
+
+    fEventsRead += eventsRead;
+    fEventsWritten += eventsWritten;
+    fElapsedTime += Seconds(start);
+    fInputWait += inputWait;
+    fOutputWait += outputWait;
+    for (std::size_t w = 0; w < computeTime.size(); ++w) {
+        fComputeTime += computeTime[w];
+    }
+    if (readQueue) fReadTime += readTime;
+    if (writeQueue) fWriteTime += writeTime;
+
+    if (error) {
+        CaptError("Event pipeline stopped with "
+                  << inFlight.size() << " events in flight");
+        std::rethrow_exception(error);
+    }
+
+    return eventsRead;
+}
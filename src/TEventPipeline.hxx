@@ -0,0 +1,152 @@
+#ifndef TEventPipeline_hxx_seen
+#define TEventPipeline_hxx_seen
+
+#include <TEvent.hxx>
+#include <TRootInput.hxx>
+#include <TRootOutput.hxx>
+
+#include <algorithm>
+#include <functional>
+
+namespace CP {
+    class TEventPipeline;
+};
+
+/// Process the events from an input file, and write them to an output file
+/// in the original order.  The events are handed to a pool of worker
+/// threads.  Each worker has a number between zero and workers-1 that is
+/// passed to the processing function so that it can use its own calibration
+/// objects (e.g. a TClusterCalib per worker).  If there are no workers, the
+/// events are processed one at a time by the calling thread, which is what
+/// is needed when the processing function isn't thread safe (e.g. it fills
+/// histograms).  The number of events that are in memory at the same time
+/// is limited by the window, so an event won't be read until the oldest
+/// event has been written if the window is full.  The channel information
+/// and calibration tables are loaded for a run, so an event from a new run
+/// isn't started until all of the events from the previous run have been
+/// written.
+///
+/// The events are normally read and written by the calling thread.  If the
+/// read ahead is set, a reader thread decodes up to that many events before
+/// they are needed.  If the write behind is set, a writer thread saves up to
+/// that many events in the background.  The time the calling thread spends
+/// waiting on the input and output is kept separately from the time spent
+/// processing the events.
+/// \code
+/// CP::TEventPipeline pipeline(4);
+/// pipeline.SetReadAhead(2);
+/// pipeline.Process(input, &output,
+///                  [&](CP::TEvent& event, int worker) {
+///                      return (*calib[worker])(event);
+///                  });
+/// \endcode
+class CP::TEventPipeline {
+public:
+    /// The function applied to each event.  This is called from a worker
+    /// thread (or the calling thread if there are no workers), and should
+    /// return true if the event is to be written.
+    typedef std::function<bool (CP::TEvent& event, int worker)> Function;
+
+    /// Create a pipeline with "workers" threads.  The window is the maximum
+    /// number of events that can be in flight, and defaults to twice the
+    /// number of workers.
+    explicit TEventPipeline(int workers, int window = 0);
+    virtual ~TEventPipeline();
+
+    /// Set the number of events decoded ahead by the reader thread.  If
+    /// this is zero (the default), the events are read by the calling
+    /// thread when they are needed.
+    void SetReadAhead(int depth) {fReadAhead = std::max(0,depth);}
+
+    /// Get the number of events decoded ahead by the reader thread.
+    int GetReadAhead() const {return fReadAhead;}
+
+    /// Set the number of events that can be waiting for the writer thread.
+    /// If this is zero (the default), the events are written by the calling
+    /// thread.
+    void SetWriteBehind(int depth) {fWriteBehind = std::max(0,depth);}
+
+    /// Get the number of events that can be waiting for the writer thread.
+    int GetWriteBehind() const {return fWriteBehind;}
+
+    /// Process the events in the input file and write the events that are
+    /// accepted to the output file (if it's not NULL).  This returns after
+    /// the last event has been written.  If maxEvents is not negative, then
+    /// at most maxEvents are read.  If the processing function throws, the
+    /// events still in flight are dropped and the exception is rethrown.
+    /// This returns the number of events that were read.
+    int Process(CP::TRootInput& input, CP::TRootOutput* output,
+                Function work, int maxEvents = -1);
+
+    /// Get the number of worker threads.
+    int GetWorkers() const {return fWorkers;}
+
+    /// Get the maximum number of events in flight.
+    int GetWindow() const {return fWindow;}
+
+    /// Get the total number of events read.
+    int GetEventsRead() const {return fEventsRead;}
+
+    /// Get the total number of events written.
+    int GetEventsWritten() const {return fEventsWritten;}
+
+    /// Get the total wall clock time spent in Process (in seconds).
+    double GetElapsedTime() const {return fElapsedTime;}
+
+    /// Get the time the calling thread spent waiting for input events (in
+    /// seconds).  Without a read ahead, this is the time spent reading.
+    double GetInputWait() const {return fInputWait;}
+
+    /// Get the time the calling thread spent waiting to output events (in
+    /// seconds).  Without a write behind, this is the time spent writing.
+    double GetOutputWait() const {return fOutputWait;}
+
+    /// Get the time spent in the processing function summed over all of the
+    /// workers (in seconds).
+    double GetComputeTime() const {return fComputeTime;}
+
+    /// Get the time the reader thread spent decoding events (in seconds).
+    double GetReadTime() const {return fReadTime;}
+
+    /// Get the time the writer thread spent saving events (in seconds).
+    double GetWriteTime() const {return fWriteTime;}
+
+private:
+
+    /// The number of worker threads.
+    int fWorkers;
+
+    /// The maximum number of events in flight.
+    int fWindow;
+
+    /// The number of events decoded ahead by the reader thread.
+    int fReadAhead;
+
+    /// The number of events that can wait for the writer thread.
+    int fWriteBehind;
+
+    /// The total number of events read.
+    int fEventsRead;
+
+    /// The total number of events written.
+    int fEventsWritten;
+
+    /// The total wall clock time spent in Process.
+    double fElapsedTime;
+
+    /// The time the calling thread waited for input.
+    double fInputWait;
+
+    /// The time the calling thread waited for output.
+    double fOutputWait;
+
+    /// The time spent processing events.
+    double fComputeTime;
+
+    /// The time the reader thread spent reading.
+    double fReadTime;
+
+    /// The time the writer thread spent writing.
+    double fWriteTime;
+};
+#endif
@@ -0,0 +1,63 @@
+#include "TFFTBatch.hxx"
+
+#include <algorithm>
+
+CP::TFFTBatch::TFFTBatch(int length, int channels, bool measure)
+    : fLength(length), fChannels(std::max(1,channels)) {
+    const int frequencies = GetFrequencies();
+    fData = fftw_alloc_complex(frequencies*fChannels);
+    double* real = reinterpret_cast<double*>(fData);
+
+    // The transforms are in place, so the distance between the real samples
+    // for each channel is the padded length of 2*frequencies.
+    unsigned flags = measure ? FFTW_MEASURE : FFTW_ESTIMATE;
+    fForward = fftw_plan_many_dft_r2c(1, &fLength, fChannels,
+                                      real, NULL, 1, 2*frequencies,
+                                      fData, NULL, 1, frequencies,
+                                      flags);
+    fInverse = fftw_plan_many_dft_c2r(1, &fLength, fChannels,
+                                      fData, NULL, 1, frequencies,
+                                      real, NULL, 1, 2*frequencies,
+                                      flags);
+
+    // The single channel plans are applied to each channel in the buffer.
+    // Each channel starts on a complex entry so it has the same alignment as
+    // the start of the buffer.
+    fForwardSingle = fftw_plan_dft_r2c_1d(fLength, real, fData, flags);
+    fInverseSingle = fftw_plan_dft_c2r_1d(fLength, fData, real, flags);
+
+    // Planning can overwrite the buffer.
+    std::fill(real, real + 2*frequencies*fChannels, 0.0);
+}
+
+CP::TFFTBatch::~TFFTBatch() {
+    fftw_destroy_plan(fForward);
+    fftw_destroy_plan(fInverse);
+    fftw_destroy_plan(fForwardSingle);
+    fftw_destroy_plan(fInverseSingle);
+    fftw_free(fData);
+}
+
+void CP::TFFTBatch::Forward(int channels) {
+    if (channels < 1 || channels >= fChannels) {
+        fftw_execute(fForward);
+        return;
+    }
+    for (int c = 0; c < channels; ++c) {
+        fftw_complex* data = fData + c*GetFrequencies();
+        fftw_execute_dft_r2c(fForwardSingle,
+                             reinterpret_cast<double*>(data), data);
+    }
+}
+
+void CP::TFFTBatch::Inverse(int channels) {
+    if (channels < 1 || channels >= fChannels) {
+        fftw_execute(fInverse);
+        return;
+    }
+    for (int c = 0; c < channels; ++c) {
+        fftw_complex* data = fData + c*GetFrequencies();
+        fftw_execute_dft_c2r(fInverseSingle,
+                             data, reinterpret_cast<double*>(data));
+    }
+}
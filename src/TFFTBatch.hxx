@@ -0,0 +1,102 @@
+#ifndef TFFTBatch_hxx_seen
+#define TFFTBatch_hxx_seen
+
+#include <fftw3.h>
+
+#include <complex>
+
+namespace CP {
+    class TFFTBatch;
+    class TFFTPlans;
+};
+
+/// The buffers and plans to transform a block of channels at once.  Each
+/// channel has an aligned buffer that holds either the real samples or the
+/// (non-negative) frequencies, and the buffers for the channels are one
+/// after the other, so all of the channels can be transformed in place with
+/// one call to the FFTW "plan many" interface instead of one call per
+/// channel.  The caller reads and writes the arrays directly, so there
+/// isn't a copy or a virtual call for each sample.  The forward transform
+/// replaces the real samples with the frequencies (R2C), and the inverse
+/// replaces the frequencies with the real samples (C2R) without
+/// normalization (the result is "length" times the original samples).  A
+/// batch is made by the plan pool, and belongs to the caller until it is
+/// released.
+/// \code
+/// CP::TFFTBatch* batch = CP::TFFTPlans::Get().AcquireBatch(length, 16);
+/// for (int c = 0; c < batch->GetChannels(); ++c) {
+///     double* samples = batch->GetReal(c);
+///     ... fill the samples ...
+/// }
+/// batch->Forward();
+/// ... change batch->GetComplex(c) ...
+/// batch->Inverse();
+/// CP::TFFTPlans::Get().Release(batch);
+/// \endcode
+class CP::TFFTBatch {
+public:
+    /// The type of the frequencies.  This has the same layout as the
+    /// fftw_complex type.
+    typedef std::complex<double> Complex;
+
+    /// Get the number of real samples for each channel.
+    int GetLength() const {return fLength;}
+
+    /// Get the number of frequencies for each channel.  The negative
+    /// frequencies are the complex conjugates of the positive ones, so only
+    /// length/2+1 frequencies are kept.
+    int GetFrequencies() const {return fLength/2+1;}
+
+    /// Get the number of channels in the batch.
+    int GetChannels() const {return fChannels;}
+
+    /// Get the real samples for a channel.  This is the same memory as the
+    /// frequencies for the channel.
+    double* GetReal(int channel) {
+        return reinterpret_cast<double*>(fData + channel*GetFrequencies());
+    }
+
+    /// Get the frequencies for a channel.
+    Complex* GetComplex(int channel) {
+        return reinterpret_cast<Complex*>(fData + channel*GetFrequencies());
+    }
+
+    /// Transform the first "channels" channels from the real samples to the
+    /// frequencies.  If channels is less than one, or is more than the
+    /// number of channels in the batch, all of the channels are
+    /// transformed.
+    void Forward(int channels = 0);
+
+    /// Transform the first "channels" channels from the frequencies to the
+    /// real samples.
+    void Inverse(int channels = 0);
+
+private:
+    friend class CP::TFFTPlans;
+
+    /// Allocate the buffers and make the plans.  This must be called while
+    /// holding the CP::FFTPlanMutex().
+    TFFTBatch(int length, int channels, bool measure);
+    ~TFFTBatch();
+
+    /// The number of samples for each channel.
+    int fLength;
+
+    /// The number of channels.
+    int fChannels;
+
+    /// The buffer for all of the channels.  Each channel has
+    /// GetFrequencies() complex entries, which is room for the real samples
+    /// (plus one or two doubles of padding).
+    fftw_complex* fData;
+
+    /// The plans to transform all of the channels.
+    fftw_plan fForward;
+    fftw_plan fInverse;
+
+    /// The plans to transform a single channel.  These are used when only
+    /// part of the batch is filled.
+    fftw_plan fForwardSingle;
+    fftw_plan fInverseSingle;
+};
+#endif
@@ -0,0 +1,142 @@
+#include "TFFTPlans.hxx"
+#include "TFFTBatch.hxx"
+#include "FFTPlanMutex.hxx"
+
+#include <TCaptLog.hxx>
+
+#include <TVirtualFFT.h>
+
+#include <fftw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+
+CP::TFFTPlans& CP::TFFTPlans::Get() {
+    static TFFTPlans plans;
+    return plans;
+}
+
+CP::TFFTPlans::TFFTPlans()
+    : fPlanTime(0.0), fPlansMade(0), fNewPlans(0), fPlansReused(0) {
+    const char* wisdom = std::getenv("CLUSTERCALIB_FFTW_WISDOM");
+    if (wisdom && *wisdom) SetWisdomFile(wisdom);
+}
+
+CP::TFFTPlans::~TFFTPlans() {
+    // The plans are left for the process to clean up since the FFT library
+    // may already be gone when static objects are destroyed.
+}
+
+TVirtualFFT* CP::TFFTPlans::Acquire(int length, Direction direction,
+                                    bool measure) {
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    Key key = MakeKey(length, direction, measure);
+    std::vector<TVirtualFFT*>& free = fFree[key];
+    if (!free.empty()) {
+        TVirtualFFT* fft = free.back();
+        free.pop_back();
+        ++fPlansReused;
+        return fft;
+    }
+
+    std::string option = (direction == kForward) ? "R2C" : "C2R";
+    option += measure ? " M K" : " ES K";
+    int nSize = length;
+    std::chrono::steady_clock::time_point start
+        = std::chrono::steady_clock::now();
+    TVirtualFFT* fft = TVirtualFFT::FFT(1, &nSize, option.c_str());
+    fPlanTime += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    if (nSize != length) {
+        CaptError("Invalid length for FFT");
+        CaptError("     original length: " << length);
+        CaptError("     allocated length: " << nSize);
+    }
+    ++fPlansMade;
+    ++fNewPlans;
+    fKeys[fft] = key;
+    return fft;
+}
+
+void CP::TFFTPlans::Release(TVirtualFFT* fft) {
+    if (!fft) return;
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    std::map<TVirtualFFT*, Key>::iterator k = fKeys.find(fft);
+    if (k == fKeys.end()) {
+        CaptError("Releasing an FFT that isn't from the plan pool");
+        delete fft;
+        return;
+    }
+    fFree[k->second].push_back(fft);
+}
+
+CP::TFFTBatch* CP::TFFTPlans::AcquireBatch(int length, int channels,
+                                           bool measure) {
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    channels = std::max(1, channels);
+    Key key(length, measure ? -channels : channels);
+    std::vector<CP::TFFTBatch*>& free = fFreeBatches[key];
+    if (!free.empty()) {
+        CP::TFFTBatch* batch = free.back();
+        free.pop_back();
+        ++fPlansReused;
+        return batch;
+    }
+
+    std::chrono::steady_clock::time_point start
+        = std::chrono::steady_clock::now();
+    CP::TFFTBatch* batch = new CP::TFFTBatch(length, channels, measure);
+    fPlanTime += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    ++fPlansMade;
+    ++fNewPlans;
+    fBatchKeys[batch] = key;
+    return batch;
+}
+
+void CP::TFFTPlans::Release(CP::TFFTBatch* batch) {
+    if (!batch) return;
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    std::map<CP::TFFTBatch*, Key>::iterator k = fBatchKeys.find(batch);
+    if (k == fBatchKeys.end()) {
+        CaptError("Releasing a batch that isn't from the plan pool");
+        delete batch;
+        return;
+    }
+    fFreeBatches[k->second].push_back(batch);
+}
+
+void CP::TFFTPlans::SetWisdomFile(const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    fWisdomFile = fileName;
+    if (fWisdomFile.empty()) return;
+    if (fftw_import_wisdom_from_filename(fWisdomFile.c_str())) {
+        CaptLog("Loaded FFTW wisdom from " << fWisdomFile);
+    }
+    else {
+        CaptLog("No FFTW wisdom loaded from " << fWisdomFile);
+    }
+    fNewPlans = 0;
+}
+
+bool CP::TFFTPlans::SaveWisdom() {
+    std::lock_guard<std::mutex> lock(CP::FFTPlanMutex());
+    if (fWisdomFile.empty() || fNewPlans < 1) return false;
+    if (!fftw_export_wisdom_to_filename(fWisdomFile.c_str())) {
+        CaptError("Unable to save FFTW wisdom to " << fWisdomFile);
+        return false;
+    }
+    CaptLog("Saved FFTW wisdom to " << fWisdomFile);
+    fNewPlans = 0;
+    return true;
+}
+
+void CP::TFFTPlans::Print(std::ostream& out) const {
+    out << "FFT plans made: " << fPlansMade
+        << "  reused: " << fPlansReused
+        << "  planning time: " << fPlanTime << " s";
+    if (!fWisdomFile.empty()) out << "  wisdom: " << fWisdomFile;
+    out << std::endl;
+}
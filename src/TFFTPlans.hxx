@@ -0,0 +1,132 @@
+#ifndef TFFTPlans_hxx_seen
+#define TFFTPlans_hxx_seen
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TVirtualFFT;
+
+namespace CP {
+    class TFFTPlans;
+    class TFFTBatch;
+};
+
+/// A process wide pool of FFT plans.  Making an FFTW plan (especially with
+/// the "measure" option) can take much longer than using it, so the plans
+/// are kept by length and direction, and are handed out again when they are
+/// released.  A plan that has been acquired belongs to the caller until it
+/// is released, since a TVirtualFFT holds the input and output arrays.  The
+/// pool also manages the FFTW wisdom.  If the CLUSTERCALIB_FFTW_WISDOM
+/// environment variable names a file (or SetWisdomFile is called), the
+/// wisdom is loaded before the first plan is made, and SaveWisdom writes it
+/// back after new plans were made, so later jobs don't need to measure the
+/// plans again.  The time spent making plans is accumulated so it can be
+/// reported separately from the calibration.  This is thread safe, and uses
+/// the CP::FFTPlanMutex() to protect the planner.
+/// \code
+/// TVirtualFFT* fft = CP::TFFTPlans::Get().Acquire(size,
+///                                                 CP::TFFTPlans::kForward);
+/// ... fill, transform, and read the fft ...
+/// CP::TFFTPlans::Get().Release(fft);
+/// \endcode
+class CP::TFFTPlans {
+public:
+    /// The direction of the transform.  The forward transform takes a real
+    /// sequence to complex frequencies (R2C), and the inverse takes the
+    /// complex frequencies back to a real sequence (C2R).
+    enum Direction {kForward, kInverse};
+
+    /// Get the plan pool.
+    static TFFTPlans& Get();
+
+    /// Get a transform for a real sequence with "length" entries.  If
+    /// measure is true, the plan is chosen by timing the possible algorithms
+    /// (the FFTW "M" option), otherwise the plan is estimated ("ES").  The
+    /// transform must be returned with Release.
+    TVirtualFFT* Acquire(int length, Direction direction, bool measure = true);
+
+    /// Return a transform to the pool.  A NULL pointer is ignored, and a
+    /// transform that isn't from the pool is deleted.
+    void Release(TVirtualFFT* fft);
+
+    /// Get the buffers and plans to transform a block of "channels" real
+    /// sequences with "length" entries (see CP::TFFTBatch).  The batch must
+    /// be returned with Release.
+    CP::TFFTBatch* AcquireBatch(int length, int channels,
+                                bool measure = true);
+
+    /// Return a batch to the pool.  A NULL pointer is ignored, and a batch
+    /// that isn't from the pool is deleted.
+    void Release(CP::TFFTBatch* batch);
+
+    /// Set the file used for the FFTW wisdom.  The wisdom in the file (if
+    /// it exists) is loaded immediately.
+    void SetWisdomFile(const std::string& fileName);
+
+    /// Get the file used for the FFTW wisdom.  This is empty if there isn't
+    /// a file.
+    const std::string& GetWisdomFile() const {return fWisdomFile;}
+
+    /// Save the FFTW wisdom to the wisdom file if any new plans have been
+    /// made since the wisdom was loaded.  This returns true if the wisdom
+    /// was written.
+    bool SaveWisdom();
+
+    /// Get the total time spent making plans (in seconds).
+    double GetPlanTime() const {return fPlanTime;}
+
+    /// Get the number of plans that were made.
+    int GetPlansMade() const {return fPlansMade;}
+
+    /// Get the number of times a plan was reused from the pool.
+    int GetPlansReused() const {return fPlansReused;}
+
+    /// Print a summary of the planning.
+    void Print(std::ostream& out = std::cout) const;
+
+private:
+    TFFTPlans();
+    ~TFFTPlans();
+
+    /// The key for a plan is the length, the direction, and whether the
+    /// plan was measured.
+    typedef std::pair<int, int> Key;
+
+    /// Make the key for a plan.
+    static Key MakeKey(int length, Direction direction, bool measure) {
+        return Key(length, 2*direction + (measure ? 1 : 0));
+    }
+
+    /// The plans that are available to be acquired.
+    std::map<Key, std::vector<TVirtualFFT*> > fFree;
+
+    /// The key for every plan that has been made.
+    std::map<TVirtualFFT*, Key> fKeys;
+
+    /// The batches that are available to be acquired.  The key is the
+    /// length and the number of channels, and the measured batches have a
+    /// negative number of channels.
+    std::map<Key, std::vector<CP::TFFTBatch*> > fFreeBatches;
+
+    /// The key for every batch that has been made.
+    std::map<CP::TFFTBatch*, Key> fBatchKeys;
+
+    /// The file for the FFTW wisdom.
+    std::string fWisdomFile;
+
+    /// The total time spent making plans.
+    double fPlanTime;
+
+    /// The number of plans made.
+    int fPlansMade;
+
+    /// The number of plans made since the wisdom was loaded or saved.
+    int fNewPlans;
+
+    /// The number of times a plan was reused.
+    int fPlansReused;
+};
+#endif
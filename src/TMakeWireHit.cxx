@@ -1,4 +1,5 @@
 #include "TMakeWireHit.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
@@ -167,8 +168,11 @@ CP::TMakeWireHit::operator()(const CP::TCalibPulseDigit& digit,
                   << " Sigma: " << chargeUnc
                   << " (" << sigC << ")");
     
-    CP::TGeometryId geomId
-        = CP::TChannelInfo::Get().GetGeometry(digit.GetChannelId());
+    CP::TGeometryId geomId;
+    {
+        CP::TChannelInfoLock lock(fContext);
+        geomId = CP::TChannelInfo::Get().GetGeometry(digit.GetChannelId());
+    }
     
     if (!geomId.IsValid()) {
         // CaptError("Making hits for an invalid geometry id");
@@ -201,8 +205,10 @@ CP::TMakeWireHit::operator()(const CP::TCalibPulseDigit& digit,
     // vicinity of the wire.  For the collection wires, the measured electrons
     // and sensed electrons are the same thing.
     if (fCorrectCollectionEfficiency) {
-        charge /= calib.GetCollectionEfficiency(digit.GetChannelId());
-        chargeUnc /= calib.GetCollectionEfficiency(digit.GetChannelId());
+        CP::TChannelInfoLock lock(fContext);
+        double efficiency = calib.GetCollectionEfficiency(digit.GetChannelId());
+        charge /= efficiency;
+        chargeUnc /= efficiency;
     }
 
     // Check the hit validity.
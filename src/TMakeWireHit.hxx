@@ -3,6 +3,7 @@
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
+#include <TEventContext.hxx>
 
 namespace CP {
     class TMakeWireHit;
@@ -27,6 +28,10 @@ public:
     operator ()(const CP::TCalibPulseDigit& digit, 
                 double digitStep, double t0,
                 std::size_t beginIndex, std::size_t endIndex, bool split);
+
+    /// Set the context of the event being processed.  The geometry and the
+    /// collection efficiency are looked up for this context.
+    void SetContext(const CP::TEventContext& context) {fContext = context;}
     
 private:
 
@@ -36,5 +41,8 @@ private:
     /// constructor.
     bool fCorrectCollectionEfficiency;
 
+    /// The context of the event being processed.
+    CP::TEventContext fContext;
+
 };
 #endif
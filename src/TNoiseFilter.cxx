@@ -3,6 +3,7 @@
 #include "TElectronicsResponse.hxx"
 #include "TWireResponse.hxx"
 #include "TChannelCalib.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TChannelId.hxx>
 #include <TGeometryId.hxx>
@@ -10,7 +11,6 @@
 #include <TChannelInfo.hxx>
 #include <CaptGeomId.hxx>
 
-#include <TVirtualFFT.h>
 #include <TH1F.h>
 #include <TSpectrum.h>
 
@@ -25,17 +25,24 @@ CP::TNoiseFilter::TNoiseFilter(double noisePower, double spikePower)
 void CP::TNoiseFilter::Calculate(CP::TChannelId id,
                                  CP::TElectronicsResponse& elecFreq,
                                  CP::TWireResponse& wireFreq,
-                                 TVirtualFFT& measFreq) {
-
-    TChannelCalib channelCalib;
+                                 const std::complex<double>* measFreq) {
 
     fIsNoisy = false;
 
-    if (fFilter.size() != elecFreq.GetSize()) {
-        fFilter.resize(elecFreq.GetSize());
-        fWork.resize(fFilter.size());
-        fAverage.resize(fFilter.size());
+    // Only the non-negative frequencies are kept in the filter.  The
+    // negative frequencies are the complex conjugates, so they have the same
+    // power, and the sums over the spectrum count the bins that have a
+    // negative partner twice.  The power is kept for every frequency (the
+    // negative frequencies are mirrored) so the spike background is found
+    // for the full spectrum.
+    const std::size_t sampleCount = elecFreq.GetSize();
+    if (fFilter.size() != elecFreq.GetFrequencyCount()
+        || fWork.size() != sampleCount) {
+        fFilter.resize(elecFreq.GetFrequencyCount());
+        fWork.resize(sampleCount);
+        fAverage.resize(sampleCount);
     }
+    const std::vector<double>& response = elecFreq.GetMagnitudes();
     std::fill(fAverage.begin(), fAverage.end(), 0.0);
     std::fill(fFilter.begin(), fFilter.end(), 1.0);
 
@@ -43,11 +50,9 @@ void CP::TNoiseFilter::Calculate(CP::TChannelId id,
     double maxResponse = 0.0;
     double minResponse = 1E+6;
     for (std::size_t i = 0; i<fFilter.size(); ++i) {
-        double rl, im;
-        measFreq.GetPointComplex(i,rl,im);
-        std::complex<double> c(rl,im);
-        fWork[i] = std::abs(c);
-        double res = std::abs(elecFreq.GetFrequency(i));
+        fWork[i] = std::abs(measFreq[i]);
+        if (i > 0) fWork[sampleCount-i] = fWork[i];
+        double res = response[i];
         maxResponse = std::max(maxResponse,res);
         minResponse = std::min(minResponse,res);
     }
@@ -86,22 +91,23 @@ void CP::TNoiseFilter::Calculate(CP::TChannelId id,
     double maxSignalWeight = 0.0;
     double minSignal = 0.0;
     double minSignalWeight = 0.0;
-    for (std::size_t i=0; i<fWork.size(); ++i) {
-        double res = std::abs(elecFreq.GetFrequency(i));
+    for (std::size_t i=0; i<fFilter.size(); ++i) {
+        double res = response[i];
+        double m = (i == 0 || 2*i == sampleCount) ? 1.0 : 2.0;
         double w = res/maxResponse;
         w = w*w;
-        double p = fWork[i]*fWork[i]/fWork.size()/fWork.size();
-        maxSignalWeight += w;
-        maxSignal += w*p;
+        double p = fWork[i]*fWork[i]/sampleCount/sampleCount;
+        maxSignalWeight += m*w;
+        maxSignal += m*w*p;
         w = 1.0-res/maxResponse;
         w *= w;
-        minSignalWeight += w;
-        minSignal += w*p;
+        minSignalWeight += m*w;
+        minSignal += m*w*p;
     }
     maxSignal = maxSignal/maxSignalWeight;
     minSignal = minSignal/minSignalWeight;
-    maxSignal = std::sqrt(maxSignal*fWork.size()/2.0);
-    minSignal = std::sqrt(minSignal*fWork.size()/2.0);
+    maxSignal = std::sqrt(maxSignal*sampleCount/2.0);
+    minSignal = std::sqrt(minSignal*sampleCount/2.0);
 
     // Estimate the noise power relative to the averaged signal.
     double noise = 0.0;
@@ -117,8 +123,15 @@ void CP::TNoiseFilter::Calculate(CP::TChannelId id,
     // Add in the "noise" introduced by digitization.  This limits the RMS to
     // be greater than or equal to 2 ADC counts.  It's then normalized to be a
     // fraction of the expected MIP deposited charge.
-    double gain = channelCalib.GetGainConstant(id,1);
-    double slope = channelCalib.GetDigitizerConstant(id,1);
+    // The calibration is looked up for the event of the response.
+    double gain;
+    double slope;
+    {
+        CP::TChannelInfoLock lock(elecFreq.GetEventContext());
+        TChannelCalib channelCalib;
+        gain = channelCalib.GetGainConstant(id,1);
+        slope = channelCalib.GetDigitizerConstant(id,1);
+    }
     double adcNoise = 2.0/gain/slope;
 
     /// Combine the different noise components.  The 4 fC comes the nominal
@@ -137,15 +150,20 @@ void CP::TNoiseFilter::Calculate(CP::TChannelId id,
     /// (e.g. a Weiner Filter) where the filter value is F = S^2/(S^2 + N^2)
     /// (S being the true signal, and N being the true noise).  F will be
     /// between 0.0 and 1.0 (0.0 is more filtering, 1.0 is no filtering).
+    /// The spike filter for a frequency bin uses the background at the
+    /// mirrored bin (i.e. the negative frequency).  The inverse transform
+    /// fills each bin from its negative frequency, so this is the filter
+    /// that has always been applied.
     double maxFilter = 0.0;
     for (std::size_t i = 0; i<fFilter.size(); ++i) {
-        double measPower = fWork[i];
-        double respPower = std::abs(elecFreq.GetFrequency(i));
+        std::size_t mirror = (i > 0) ? sampleCount - i : 0;
+        double measPower = fWork[mirror];
+        double respPower = response[i];
         if (measPower < 1E-22) continue;
-        if (fAverage[i] < 1E-22) continue;
+        if (fAverage[mirror] < 1E-22) continue;
         // Apply filter for any spikes in the FFT.
         if (fSpikePower > 1E-3) {
-            double sigPower = fAverage[i]/fSpikePower;
+            double sigPower = fAverage[mirror]/fSpikePower;
             double excessPower = std::max(0.0, measPower-sigPower);
             fFilter[i] *= sigPower*sigPower
                 /(sigPower*sigPower+excessPower*excessPower);            
@@ -171,7 +189,8 @@ void CP::TNoiseFilter::Calculate(CP::TChannelId id,
     double filterNorm = 0.0;
     double responseNorm = 0.0;
     for (std::size_t i = 0; i<fFilter.size(); ++i) {
-        double res = std::abs(elecFreq.GetFrequency(i));
+        double m = (i == 0 || 2*i == sampleCount) ? 1.0 : 2.0;
+        double res = m*response[i];
         double resFiltered = res*fFilter[i];
         responseNorm += res;
         filterNorm += resFiltered;
@@ -7,9 +7,11 @@
 #include <TChannelId.hxx>
 #include <HEPUnits.hxx>
 
-#include <TVirtualFFT.h>
 #include <RVersion.h>
 
+#include <complex>
+#include <vector>
+
 namespace CP {
     class TNoiseFilter;
 };
@@ -34,14 +36,22 @@ public:
     TNoiseFilter(double noisePower, double spikePower);
     virtual ~TNoiseFilter();
 
-    /// Figure out the optimal filter.
+    /// Figure out the optimal filter.  The measured frequencies are the
+    /// non-negative frequencies of the real FFT of the samples (there are
+    /// elecFreq.GetFrequencyCount() of them), and the negative frequencies
+    /// are their complex conjugates.
     void Calculate(CP::TChannelId id,
                    CP::TElectronicsResponse& elecFreq,
                    CP::TWireResponse& wireFreq,
-                   TVirtualFFT& measFreq);
+                   const std::complex<double>* measFreq);
     
-    /// Return the filter value for a particular frequency bin.
+    /// Return the filter value for a particular frequency bin.  Only the
+    /// non-negative frequencies are kept.  The spike filter for a bin is
+    /// found from the power at the matching negative frequency.
     double GetFilter(int i) const {return fFilter[i];}
+
+    /// Return the filter values for all of the frequency bins.
+    const std::vector<double>& GetFilters() const {return fFilter;}
     
     /// Return a boolean whether this channel should be flagged as "noisy"
     bool IsNoisy() const {return fIsNoisy;} 
@@ -1,4 +1,5 @@
 #include "TPMTMakeHits.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
@@ -20,8 +21,11 @@ CP::TPMTMakeHits::~TPMTMakeHits() {}
 
 void CP::TPMTMakeHits::operator() (CP::THitSelection& hits, 
                                    const CP::TCalibPulseDigit& digit) {
-    CP::TGeometryId geomId 
-        = CP::TChannelInfo::Get().GetGeometry(digit.GetChannelId());
+    CP::TGeometryId geomId;
+    {
+        CP::TChannelInfoLock lock(fContext);
+        geomId = CP::TChannelInfo::Get().GetGeometry(digit.GetChannelId());
+    }
 
     double digitStep = digit.GetLastSample()-digit.GetFirstSample();
     digitStep /= digit.GetSampleCount();
@@ -3,6 +3,7 @@
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
+#include <TEventContext.hxx>
 
 namespace CP {
     class TPMTMakeHits;
@@ -20,7 +21,14 @@ public:
     void operator () (CP::THitSelection& output, 
                       const CP::TCalibPulseDigit& input);
 
+    /// Set the context of the event being processed.  The geometry for the
+    /// PMT is looked up for this context.
+    void SetContext(const CP::TEventContext& context) {fContext = context;}
+
 private:
+
+    /// The context of the event being processed.
+    CP::TEventContext fContext;
     
     /// The threshold for defining a hit.
     double fThreshold;
@@ -3,6 +3,8 @@
 #include "FindPedestal.hxx"
 #include "GaussianNoise.hxx"
 #include "TruncatedRMS.hxx"
+#include "TADCHistogram.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TCalibPulseDigit.hxx>
 #include <TPulseDigit.hxx>
@@ -19,37 +21,69 @@ CP::TPulseCalib::TPulseCalib()
 CP::TPulseCalib::~TPulseCalib() {}
 
 CP::TCalibPulseDigit* 
-CP::TPulseCalib::operator()(const CP::TDigitProxy& digit) {
+CP::TPulseCalib::operator()(const CP::TDigitProxy& digit,
+                            const CP::TEventContext& context) {
     const CP::TPulseDigit* pulse = digit.As<const CP::TPulseDigit>();
     if (!pulse) return NULL;
 
-    TChannelId chan(pulse->GetChannelId());
+    CP::TCalibPulseDigit::Vector samples(pulse->GetSampleCount());
+    double startTime;
+    double stopTime;
+    Calibrate(*pulse, context, samples.data(), startTime, stopTime);
+    return new CP::TCalibPulseDigit(digit,startTime,stopTime,samples);
+}
+
+void CP::TPulseCalib::Calibrate(const CP::TPulseDigit& pulseDigit,
+                                const CP::TEventContext& context,
+                                float* samples,
+                                double& startTime, double& stopTime) {
+    const CP::TPulseDigit* pulse = &pulseDigit;
 
-    CP::TChannelCalib calib;
+    TChannelId chan(pulse->GetChannelId());
 
-    double timeOffset = calib.GetTimeConstant(chan,0);
-    double digitStep = calib.GetTimeConstant(chan,1);
-    fPedestal = calib.GetDigitizerConstant(chan,0);
-    double slope = calib.GetDigitizerConstant(chan,1);
-    double gain = calib.GetGainConstant(chan,1);
+    double timeOffset;
+    double digitStep;
+    double slope;
+    double gain;
+    {
+        CP::TChannelInfoLock lock(context);
+        CP::TChannelCalib calib;
+        timeOffset = calib.GetTimeConstant(chan,0);
+        digitStep = calib.GetTimeConstant(chan,1);
+        fPedestal = calib.GetDigitizerConstant(chan,0);
+        slope = calib.GetDigitizerConstant(chan,1);
+        gain = calib.GetGainConstant(chan,1);
+    }
 
-    double startTime = digitStep*pulse->GetFirstSample() + timeOffset;
-    double stopTime 
+    startTime = digitStep*pulse->GetFirstSample() + timeOffset;
+    stopTime 
         = digitStep*(pulse->GetFirstSample()+pulse->GetSampleCount()) 
         + timeOffset;
 
-    // Use the median ADC value as the pedestal
-    fPedestal = CP::FindPedestal(pulse->begin(), pulse->end());;
-
-    std::pair<double,double> avgRMS
-        = CP::TruncatedRMS(pulse->begin(), pulse->end());
+    // Find the statistics for the channel.  The raw samples are integers,
+    // so all of the statistics are found from histograms of the values and
+    // the sample to sample differences that are filled in one pass.  The
+    // sorting versions are only used if the samples can't be histogrammed.
+    std::pair<double,double> avgRMS;
+    if (CP::TADCHistogram::Fill(pulse->begin(), pulse->end(),
+                                fValues, fDifferences)) {
+        // Use the median ADC value as the pedestal
+        fPedestal = fValues.GetQuantile(0.5);
+        avgRMS = fValues.GetTruncatedRMS();
+        fGaussianSigma = fDifferences.GetQuantile(0.52);
+    }
+    else {
+        // Use the median ADC value as the pedestal
+        fPedestal = CP::FindPedestal(pulse->begin(), pulse->end(), fWork);
+        avgRMS = CP::TruncatedRMSWork(pulse->begin(), pulse->end(), fWork);
+        fGaussianSigma = CP::GaussianNoise(pulse->begin(), pulse->end(),
+                                           fWork);
+    }
 
     fAverage = avgRMS.first;
     fSigma = avgRMS.second;
-    fGaussianSigma = CP::GaussianNoise(pulse->begin(), pulse->end());
     
     // Actually apply the calibration.
-    CP::TCalibPulseDigit::Vector samples(pulse->GetSampleCount());
     for (std::size_t i=0; i< pulse->GetSampleCount(); ++i) {
         double p = 1.0*(pulse->GetSample(i)-fPedestal)/gain/slope;
         samples[i] = p;
@@ -58,5 +92,4 @@ CP::TPulseCalib::operator()(const CP::TDigitProxy& digit) {
                       << " w/ invalid sample " << i);
         }
     }
-    return new CP::TCalibPulseDigit(digit,startTime,stopTime,samples);
 }
@@ -1,11 +1,17 @@
 #ifndef TPulseCalib_hxx_seen
 #define TPulseCalib_hxx_seen
 
+#include "TADCHistogram.hxx"
+
 #include <TCalibPulseDigit.hxx>
 #include <TChannelId.hxx>
+#include <TEventContext.hxx>
+
+#include <vector>
 
 namespace CP {
     class TPulseCalib;
+    class TPulseDigit;
 };
 
 /// Take a digit, that must be derived from a TPulseDigit, and apply
@@ -21,8 +27,25 @@ public:
     TPulseCalib();
     virtual ~TPulseCalib();
 
-    /// Do the actual calibration.
-    CP::TCalibPulseDigit* operator()(const CP::TDigitProxy& digit);
+    /// Do the actual calibration.  The calibration constants are looked up
+    /// for the event context.  If the context isn't provided, the context
+    /// already set for the channel information is used.
+    CP::TCalibPulseDigit* operator()(
+        const CP::TDigitProxy& digit,
+        const CP::TEventContext& context = CP::TEventContext());
+
+    /// Apply the calibration to a pulse, and write the calibrated samples
+    /// into a buffer that must have room for all of the samples in the
+    /// pulse.  The time of the start of the first sample and the end of the
+    /// last sample are returned in startTime and stopTime.  This is used to
+    /// fill a CP::TWaveformMatrix without making a digit for each channel.
+    /// The calibration constants are looked up for the event context while
+    /// holding the channel information lock, so several threads can
+    /// calibrate pulses at the same time.
+    void Calibrate(const CP::TPulseDigit& pulse,
+                   const CP::TEventContext& context,
+                   float* samples,
+                   double& startTime, double& stopTime);
 
     /// Get the last pedestal value.
     double GetPedestal() {return fPedestal;}
@@ -50,5 +73,14 @@ private:
     /// The most recent channe to channel Gaussian noise
     double fGaussianSigma;
 
+    /// A work area for the sample statistics.  This is owned by the object
+    /// so that different TPulseCalib objects can be used in parallel.
+    std::vector<double> fWork;
+
+    /// The histograms of the raw values and the sample to sample
+    /// differences used to find the sample statistics.
+    CP::TADCHistogram fValues;
+    CP::TADCHistogram fDifferences;
+
 };
 #endif
@@ -4,20 +4,81 @@
 #include "TNoiseFilter.hxx"
 #include "TChannelCalib.hxx"
 #include "GaussianNoise.hxx"
+#include "TFFTPlans.hxx"
+#include "FastFFTLength.hxx"
+#include "TWaveformMatrix.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TCalibPulseDigit.hxx>
-#include <TEvent.hxx>
-#include <TEventFolder.hxx>
 #include <TRuntimeParameters.hxx>
 #include <TMCChannelId.hxx>
 
-#include <TVirtualFFT.h>
 #include <TH1F.h>
 
+#include <algorithm>
 #include <memory>
 #include <numeric>
 #include <cmath>
 
+namespace {
+    /// Find the largest difference between each sample and the "zone"
+    /// samples that come before it when stepping from "first" to "last"
+    /// (the step is +1 or -1, and the samples before "first" are outside of
+    /// the array).  The difference is only stored into drift if it is
+    /// larger than the current value.  The samples in the zone with the
+    /// smallest and largest value are kept in monotonic queues (each sample
+    /// is added and removed once), so this is linear in the number of
+    /// samples, not in the number of samples times the zone.
+    void MaximumDrift(const float* samples, int first, int last, int step,
+                      int zone, double* drift,
+                      std::vector<int>& lowQueue,
+                      std::vector<int>& highQueue) {
+        const std::size_t count = std::abs(last-first) + 1;
+        lowQueue.resize(count);
+        highQueue.resize(count);
+        int lowBegin = 0, lowEnd = 0;
+        int highBegin = 0, highEnd = 0;
+        for (int i = first; i != last; i += step) {
+            // Add the previous sample to the zone.
+            int j = i - step;
+            if (zone > 0 && j != first - step) {
+                while (lowBegin < lowEnd
+                       && samples[j] <= samples[lowQueue[lowEnd-1]]) {
+                    --lowEnd;
+                }
+                lowQueue[lowEnd++] = j;
+                while (highBegin < highEnd
+                       && samples[j] >= samples[highQueue[highEnd-1]]) {
+                    --highEnd;
+                }
+                highQueue[highEnd++] = j;
+            }
+            // Remove the samples that have left the zone.
+            while (lowBegin < lowEnd
+                   && step*(i-lowQueue[lowBegin]) > zone) ++lowBegin;
+            while (highBegin < highEnd
+                   && step*(i-highQueue[highBegin]) > zone) ++highBegin;
+            if (lowBegin == lowEnd) continue;
+            double deltaSample = std::max(
+                std::abs((double) samples[i] - samples[lowQueue[lowBegin]]),
+                std::abs((double) samples[i] - samples[highQueue[highBegin]]));
+            drift[i] = std::max(drift[i], deltaSample);
+        }
+    }
+
+    /// Fill "next" with the index of the first finite value at or after each
+    /// entry in values.  If there isn't one, the index is values.size().
+    void NextFinite(const std::vector<double>& values,
+                    std::vector<std::size_t>& next) {
+        next.resize(values.size());
+        std::size_t k = values.size();
+        for (std::size_t i = values.size(); 0 < i; --i) {
+            if (std::isfinite(values[i-1])) k = i-1;
+            next[i-1] = k;
+        }
+    }
+}
+
 CP::TPulseDeconvolution::TPulseDeconvolution(int sampleCount) {
     fSampleCount = sampleCount;
     fSmoothingWindow = CP::TRuntimeParameters::Get().GetParameterI(
@@ -44,163 +105,288 @@ CP::TPulseDeconvolution::TPulseDeconvolution(int sampleCount) {
     fDriftCut
         = CP::TRuntimeParameters::Get().GetParameterD(
             "clusterCalib.deconvolution.driftCut");
-    fFFT = NULL;
-    fInverseFFT = NULL;
+    fBatchSize = CP::TRuntimeParameters::Get().GetParameterI(
+        "clusterCalib.deconvolution.batch");
+    fBatchSize = std::max(1,fBatchSize);
+    fBatch = NULL;
+    fRemoveBaseline = true;
     fElectronicsResponse = NULL;
     fWireResponse = NULL;
+    fKernel = NULL;
     double noisePower = CP::TRuntimeParameters::Get().GetParameterD(
         "clusterCalib.deconvolution.noisePower");
     double spikePower = CP::TRuntimeParameters::Get().GetParameterD(
         "clusterCalib.deconvolution.spikePower");
     fNoiseFilter = new CP::TNoiseFilter(noisePower, spikePower);
     fBaselineSigma = 0.0;
-    for (int i=0; i<kMaxSampleSigmas; ++i) fSampleSigma[i] = 0.0;
+    ResetSampleSigma();
     Initialize();
 }
 
-CP::TPulseDeconvolution::~TPulseDeconvolution() {}
+CP::TPulseDeconvolution::~TPulseDeconvolution() {
+    CP::TFFTPlans::Get().Release(fBatch);
+    if (fElectronicsResponse) delete fElectronicsResponse;
+    if (fWireResponse) delete fWireResponse;
+    if (fNoiseFilter) delete fNoiseFilter;
+}
 
 void CP::TPulseDeconvolution::Initialize() {
-    fSampleCount = 2*(1+fSampleCount/2);
+    // The FFT covers the digit plus the region where the end of the digit is
+    // tapered to zero, and is rounded up to a length that FFTW transforms
+    // quickly.  The response functions are calculated at the same length.
+    fSampleCount = CP::FastFFTLength(fSampleCount + kTaperSamples);
     int nSize = fSampleCount;
     CaptLog("Initialize pulse deconvolution to " << nSize << " entries");
-    
-    if (fFFT) delete fFFT;
-    fFFT = TVirtualFFT::FFT(1, &nSize, "R2C M K");
-    if (nSize != fSampleCount) {
-        CaptError("Invalid length for FFT");
-        CaptError("     original length: " << fSampleCount);
-        CaptError("     allocated length: " << nSize);
-    }
 
-    if (fInverseFFT) delete fInverseFFT;
-    fInverseFFT = TVirtualFFT::FFT(1, &nSize, "C2R M K");
-    if (nSize != fSampleCount) {
-        CaptError("Invalid length for inverse FFT");
-        CaptError("     original length: " << fSampleCount);
-        CaptError("     allocated length: " << nSize);
-    }
+    // The plans are shared through the pool, so a length that has been used
+    // before doesn't need to be planned again.
+    CP::TFFTPlans::Get().Release(fBatch);
+    fBatch = CP::TFFTPlans::Get().AcquireBatch(nSize, fBatchSize);
 
     if (fElectronicsResponse) delete fElectronicsResponse;
     fElectronicsResponse = new CP::TElectronicsResponse(nSize);
 
     if (fWireResponse) delete fWireResponse;
     fWireResponse = new CP::TWireResponse(nSize);
+    fKernels.clear();
+    fKernel = NULL;
 
     fBaselineSigma = 0.0;
-    for (int i=0; i<kMaxSampleSigmas; ++i) fSampleSigma[i] = 0.0;
+    ResetSampleSigma();
 }
 
 CP::TCalibPulseDigit* CP::TPulseDeconvolution::operator() 
-    (const CP::TCalibPulseDigit& calib) {
+    (const CP::TCalibPulseDigit& calib, const CP::TEventContext& context) {
+    std::unique_ptr<CP::TCalibPulseDigit> deconv(
+        new CP::TCalibPulseDigit(calib));
+    if (!Deconvolve(*deconv, context)) return NULL;
+    return deconv.release();
+}
+
+bool CP::TPulseDeconvolution::Deconvolve(CP::TCalibPulseDigit& calib,
+                                         const CP::TEventContext& context) {
+    fSamples.resize(calib.GetSampleCount());
+    for (std::size_t i = 0; i<fSamples.size(); ++i) {
+        fSamples[i] = calib.GetSample(i);
+    }
+    if (!Deconvolve(calib.GetChannelId(), fSamples.data(), fSamples.size(),
+                    context)) {
+        return false;
+    }
+    for (std::size_t i = 0; i<fSamples.size(); ++i) {
+        calib.SetSample(i,fSamples[i]);
+    }
+    return true;
+}
 
+bool CP::TPulseDeconvolution::Deconvolve(const CP::TChannelId& id,
+                                         float* samples,
+                                         std::size_t sampleCount,
+                                         const CP::TEventContext& context) {
+    fContext = context;
     fBaselineSigma = 0.0;
-    for (int i=0; i<kMaxSampleSigmas; ++i) fSampleSigma[i] = 0.0;
+    ResetSampleSigma();
     
-    CP::TEvent* ev = CP::TEventFolder::GetCurrentEvent();
-    TChannelCalib channelCalib;
+    if (fSampleCount < (int) sampleCount + kTaperSamples) {
+        CaptLog("Deconvolution size needs to be increased from "
+                << fSampleCount << " for " << sampleCount << " samples");
+        fSampleCount = sampleCount;
+        Initialize();
+    }
+
+    FillBuffer(id, samples, sampleCount, fBatch->GetReal(0));
+    fBatch->Forward(1);
+    if (!Filter(id, context, fBatch->GetComplex(0))) return false;
+    fBatch->Inverse(1);
+    Finish(id, fBatch->GetReal(0), samples, sampleCount);
+
+    return true;
+}
 
-    if (fSampleCount < (int) calib.GetSampleCount()) {
+std::size_t CP::TPulseDeconvolution::Deconvolve(
+    CP::TWaveformMatrix& waveforms,
+    const std::vector<std::size_t>& rows,
+    const CP::TEventContext& context) {
+    fContext = context;
+
+    std::size_t maxSamples = 0;
+    for (std::size_t r = 0; r < rows.size(); ++r) {
+        maxSamples = std::max(maxSamples, waveforms.GetSampleCount(rows[r]));
+    }
+    if (fSampleCount < (int) maxSamples + kTaperSamples) {
         CaptLog("Deconvolution size needs to be increased from "
-                << fSampleCount << " to " << calib.GetSampleCount());
-        fSampleCount = calib.GetSampleCount();
+                << fSampleCount << " for " << maxSamples << " samples");
+        fSampleCount = maxSamples;
         Initialize();
     }
 
-    fElectronicsResponse->Calculate(ev->GetContext(),
-                                    calib.GetChannelId());
-    fWireResponse->Calculate(ev->GetContext(),
-                             calib.GetChannelId());
-
-    // Copy the digit into the buffer for the FFT and then apply the
-    // transformation.  The FFT buffer may be longer than the number of
-    // samples read for this digit.  If there aren't enough samples, then make
-    // sure the FFT buffer smoothly goes to zero.
-    for (int i=0; i<fSampleCount; ++i) {
-        // Apply error checking for invalid calibration results.  This should
-        // never happen (and after fixing bugs it doesn't seem to).
-        double p = calib.GetSample(i);
-        if (!std::isfinite(p)) {
-            CaptError("Channel " << calib.GetChannelId() 
-                      << " w/ invalid sample " << i);
+    // The rows are done a batch at a time.  All of the forward transforms in
+    // the batch are done together, then the frequencies for each channel are
+    // filtered, and the inverse transforms are done together.
+    std::size_t deconvolved = 0;
+    const std::size_t batchSize = fBatch->GetChannels();
+    std::vector<char> good(batchSize);
+    for (std::size_t first = 0; first < rows.size(); first += batchSize) {
+        std::size_t count = std::min(batchSize, rows.size()-first);
+        // The sigmas are found from the transform of the last row that was
+        // deconvolved, so keep it before the batch is overwritten.  This
+        // is only done once for each batch.
+        if (fSigmaBuffer && fSigmaBuffer != fSigmaCopy.data()) {
+            fSigmaCopy.assign(fSigmaBuffer, fSigmaBuffer + fSigmaCount);
+            fSigmaBuffer = fSigmaCopy.data();
         }
-        // Check if the FFT buffer is being filled past the end of the digit.
-        // If it is, then smoothly go to zero.
-        if ((int) calib.GetSampleCount() <= i) {
-            int last = calib.GetSampleCount()-1;
-            double scale = 10.0;
-            double delta = (i-last)/scale; delta *= delta;
-            double val = 0.0;
-            if (delta < 40) {
-                val = fFFT->GetPointReal(last,kTRUE)*std::exp(-delta);
-            }
-            fFFT->SetPoint(i,val);
-            continue;
+        for (std::size_t c = 0; c < count; ++c) {
+            std::size_t r = rows[first+c];
+            FillBuffer(waveforms.GetChannelId(r), waveforms.GetRow(r),
+                       waveforms.GetSampleCount(r), fBatch->GetReal(c));
         }
-        // Apply smoothing to the input signal.  The signal is not smoothed if
-        // fSmoothingWindow is one.
-        double val = 0.0;
-        double weight = 0.0;
-        for (int j=0; j<fSmoothingWindow; ++j) {
-            double w = fSmoothingWindow - j;
-            if (j == 0) {
-                val += w * calib.GetSample(i);
-                weight += w;
+        fBatch->Forward(count);
+        for (std::size_t c = 0; c < count; ++c) {
+            std::size_t r = rows[first+c];
+            good[c] = Filter(waveforms.GetChannelId(r), context,
+                             fBatch->GetComplex(c));
+            if (good[c]) continue;
+            // Don't leave the noise in the frequencies of a rejected
+            // channel.
+            std::fill(fBatch->GetComplex(c),
+                      fBatch->GetComplex(c) + fBatch->GetFrequencies(),
+                      CP::TFFTBatch::Complex(0.0,0.0));
+        }
+        fBatch->Inverse(count);
+        for (std::size_t c = 0; c < count; ++c) {
+            std::size_t r = rows[first+c];
+            if (!good[c]) {
+                waveforms.SetFlag(r, CP::TWaveformMatrix::kNoisy);
                 continue;
             }
-            if (0 <= (i-j)) {
-                val += w * calib.GetSample(i-j);
-                weight += w;
-            }
-            if ((i+j) < (int) calib.GetSampleCount()) {
-                val += w * calib.GetSample(i+j);
-                weight += w;
-            }
+            fBaselineSigma = 0.0;
+            ResetSampleSigma();
+            Finish(waveforms.GetChannelId(r), fBatch->GetReal(c),
+                   waveforms.GetRow(r), waveforms.GetSampleCount(r));
+            waveforms.SetFlag(r, CP::TWaveformMatrix::kDeconvolved);
+            ++deconvolved;
         }
-        val /= weight;
-        // Make sure that the signal is zero at the very start.  This
-        // distorts the beginning of the signal, but there is a long
-        // buffer of noise there anyway.
-        double scale = 100.001;
-        if (i<scale) val *= 1.0*i/scale;
-        if (i > calib.GetSampleCount()-scale
-            && i < (int) calib.GetSampleCount()) {
-            val *= 1.0*(calib.GetSampleCount()-i)/scale;
+    }
+
+    return deconvolved;
+}
+
+void CP::TPulseDeconvolution::FillBuffer(const CP::TChannelId& id,
+                                         const float* samples,
+                                         std::size_t sampleCount,
+                                         double* buffer) {
+#ifdef FILL_HISTOGRAM
+#undef FILL_HISTOGRAM
+    TH1F* calibHist 
+        = new TH1F((id.AsString()+"-calib").c_str(),
+                   ("Calibibrated signal before deconvolution " 
+                    + id.AsString()).c_str(),
+                   sampleCount,
+                   0, sampleCount);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
+        calibHist->SetBinContent(i+1,samples[i]);
+    }
+#endif
+
+    // Apply error checking for invalid calibration results.  This should
+    // never happen (and after fixing bugs it doesn't seem to).
+    const int nSamples = std::min((int) sampleCount, fSampleCount);
+    for (int i=0; i<nSamples; ++i) {
+        if (!std::isfinite(samples[i])) {
+            CaptError("Channel " << id 
+                      << " w/ invalid sample " << i);
         }
-        
-        fFFT->SetPoint(i,val);
     }
 
-    fFFT->Transform();
+    // Copy the digit into the buffer for the FFT.  The copy is a simple
+    // loop unless the signal is smoothed.
+    if (fSmoothingWindow < 2) {
+        for (int i=0; i<nSamples; ++i) buffer[i] = samples[i];
+    }
+    else {
+        for (int i=0; i<nSamples; ++i) {
+            // Apply smoothing to the input signal.
+            double val = 0.0;
+            double weight = 0.0;
+            for (int j=0; j<fSmoothingWindow; ++j) {
+                double w = fSmoothingWindow - j;
+                if (j == 0) {
+                    val += w * samples[i];
+                    weight += w;
+                    continue;
+                }
+                if (0 <= (i-j)) {
+                    val += w * samples[i-j];
+                    weight += w;
+                }
+                if ((i+j) < (int) sampleCount) {
+                    val += w * samples[i+j];
+                    weight += w;
+                }
+            }
+            buffer[i] = val/weight;
+        }
+    }
+
+    // Make sure that the signal is zero at the very start and the very end.
+    // This distorts the beginning of the signal, but there is a long buffer
+    // of noise there anyway.
+    const double scale = 100.001;
+    for (int i=0; i<nSamples && i<scale; ++i) {
+        buffer[i] *= 1.0*i/scale;
+    }
+    for (int i=std::max(0, (int) sampleCount-100); i<nSamples; ++i) {
+        buffer[i] *= 1.0*(sampleCount-i)/scale;
+    }
+
+    // The FFT buffer is longer than the number of samples read for this
+    // digit, so make sure the FFT buffer smoothly goes to zero.
+    const int last = nSamples-1;
+    const double tail = (last < 0) ? 0.0 : buffer[last];
+    for (int i=nSamples; i<fSampleCount; ++i) {
+        double delta = (i-last)/10.0; delta *= delta;
+        double val = 0.0;
+        if (delta < 40) val = tail*std::exp(-delta);
+        buffer[i] = val;
+    }
+}
+
+bool CP::TPulseDeconvolution::Filter(const CP::TChannelId& id,
+                                     const CP::TEventContext& context,
+                                     CP::TFFTBatch::Complex* frequencies) {
+    TChannelCalib channelCalib;
+
+    // The inverse of the combined response only changes when one of the
+    // responses changes.
+    bool changed = fElectronicsResponse->Calculate(context, id);
+    changed = fWireResponse->Calculate(context, id) || changed;
+    if (changed || !fKernel) FindKernel();
 
     /// Make an optimal filter based on the electronics response, and the
     /// observed signal.
-    fNoiseFilter->Calculate(calib.GetChannelId(), *fElectronicsResponse,
-                            *fWireResponse, *fFFT);
+    fNoiseFilter->Calculate(id, *fElectronicsResponse,
+                            *fWireResponse, frequencies);
 
     // Check if this is a valid channel.
     if (fNoiseFilter->IsNoisy()) {
-        CaptLog("Noisy channel: " << calib.GetChannelId());
-        return NULL;
+        CaptLog("Noisy channel: " << id);
+        return false;
     }
     
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     {
-        double timeStep = channelCalib.GetTimeConstant(calib.GetChannelId());
+        double timeStep = channelCalib.GetTimeConstant(id);
     
         TH1F* fftHist 
-            = new TH1F((calib.GetChannelId().AsString()+"-fft").c_str(),
+            = new TH1F((id.AsString()+"-fft").c_str(),
                        ("FFT for " 
-                        + calib.GetChannelId().AsString()).c_str(),
+                        + id.AsString()).c_str(),
                        fSampleCount/2,
                        0,
                        (0.5/timeStep)/unit::hertz);
         for (std::size_t i = 0; i<fSampleCount/2; ++i) {
-            double rl, im;
-            fFFT->GetPointComplex(i,rl,im);
-            std::complex<double> c(rl,im);
-            fftHist->SetBinContent(i+1, std::abs(c));
+            fftHist->SetBinContent(i+1, std::abs(frequencies[i]));
         }
     }
 #endif
@@ -208,11 +394,11 @@ CP::TCalibPulseDigit* CP::TPulseDeconvolution::operator()
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     {
-        double timeStep = channelCalib.GetTimeConstant(calib.GetChannelId());
+        double timeStep = channelCalib.GetTimeConstant(id);
         TH1F* respHist 
-            = new TH1F((calib.GetChannelId().AsString()+"-respFFT").c_str(),
+            = new TH1F((id.AsString()+"-respFFT").c_str(),
                        ("FFT of Response for " 
-                        + calib.GetChannelId().AsString()).c_str(),
+                        + id.AsString()).c_str(),
                        fSampleCount/2,
                        0,
                        (0.5/timeStep)/unit::hertz);
@@ -228,11 +414,11 @@ CP::TCalibPulseDigit* CP::TPulseDeconvolution::operator()
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     {
-        double timeStep = channelCalib.GetTimeConstant(calib.GetChannelId());
+        double timeStep = channelCalib.GetTimeConstant(id);
         TH1F* filterHist 
-            = new TH1F((calib.GetChannelId().AsString()+"-filter").c_str(),
+            = new TH1F((id.AsString()+"-filter").c_str(),
                        ("FFT Filter for " 
-                        + calib.GetChannelId().AsString()).c_str(),
+                        + id.AsString()).c_str(),
                        fSampleCount/2,
                        0,
                        (0.5/timeStep)/unit::hertz);
@@ -242,114 +428,187 @@ CP::TCalibPulseDigit* CP::TPulseDeconvolution::operator()
     }
 #endif
 
-    // Use the transformed values to do the deconvolution.  This fills the
-    // buffer for the inverse FFT.
-    for (int i=0; i<fSampleCount; ++i) {
-        double rl, im;
-        fFFT->GetPointComplex(i,rl,im);
-        std::complex<double> c(rl,im);
-        c /= fElectronicsResponse->GetFrequency(i);
-        c /= fWireResponse->GetFrequency(i);
-        c *= fNoiseFilter->GetFilter(i);
-        fInverseFFT->SetPoint(i,c.real(), c.imag());
-    }
+    // Use the transformed values to do the deconvolution in place.  Only
+    // the non-negative frequencies are kept since the inverse transform
+    // produces a real signal.  This is a complex multiply by the inverse
+    // response scaled by the (real) filter, and is written out with the
+    // real and imaginary parts so the compiler can vectorize it.
+    const int nFrequencies = fKernel->size();
+    double* freq = reinterpret_cast<double*>(frequencies);
+    const double* kernel = reinterpret_cast<const double*>(fKernel->data());
+    const double* filter = fNoiseFilter->GetFilters().data();
+    for (int i=0; i<nFrequencies; ++i) {
+        double kr = kernel[2*i]*filter[i];
+        double ki = kernel[2*i+1]*filter[i];
+        double fr = freq[2*i];
+        double fi = freq[2*i+1];
+        freq[2*i] = fr*kr - fi*ki;
+        freq[2*i+1] = fr*ki + fi*kr;
+    }
+
+    return true;
+}
 
-    fInverseFFT->Transform();
-    std::unique_ptr<CP::TCalibPulseDigit> deconv(new CP::TCalibPulseDigit(calib));
+void CP::TPulseDeconvolution::FindKernel() {
+    // Make sure both responses are in the bank so the entries identify
+    // them.
+    fElectronicsResponse->Calculate();
+    fWireResponse->Calculate();
+    KernelKey key(fElectronicsResponse->GetEntry().get(),
+                  fWireResponse->GetEntry().get());
+    std::map<KernelKey, Kernel>::iterator k = fKernels.find(key);
+    if (k != fKernels.end()) {
+        fKernel = &k->second.fInverse;
+        return;
+    }
+
+    Kernel& kernel = fKernels[key];
+    kernel.fElectronics = fElectronicsResponse->GetEntry();
+    kernel.fWire = fWireResponse->GetEntry();
+    std::vector<CP::TFFTBatch::Complex>& inverse = kernel.fInverse;
+    inverse.resize(fElectronicsResponse->GetFrequencyCount());
+    for (std::size_t i=0; i<inverse.size(); ++i) {
+        std::complex<double> response = fElectronicsResponse->GetFrequency(i);
+        response *= fWireResponse->GetFrequency(i);
+        inverse[i] = 1.0/response;
+    }
+    fKernel = &inverse;
+}
 
-    // Set the samples into the calibrated pulse digit.
-    for (std::size_t i=0; i<deconv->GetSampleCount(); ++i) {
-        double v = fInverseFFT->GetPointReal(i)/fSampleCount;
-        deconv->SetSample(i,v);
-    }
+bool CP::TPulseDeconvolution::IsBipolar(const CP::TChannelId& id) {
+    CP::TChannelInfoLock lock(fContext);
+    TChannelCalib channelCalib;
+    return channelCalib.IsBipolarSignal(id);
+}
+
+void CP::TPulseDeconvolution::ResetSampleSigma() {
+    for (int i=0; i<kMaxSampleSigmas; ++i) fSampleSigma[i] = 0.0;
+    fSigmaBuffer = NULL;
+    fSigmaCount = 0;
+    fSigmaBipolar = false;
+    fSampleSigmaFilled = false;
+}
+
+void CP::TPulseDeconvolution::FillSampleSigma() const {
+    fSampleSigmaFilled = true;
+    if (!fSigmaBuffer) return;
+    const std::size_t sampleCount = fSigmaCount;
 
     // Calculate the uncertainty in the sum (RMS) as a function of number of
-    // samples in sum.
-    std::vector<double> integral;
-    integral.resize(deconv->GetSampleCount());
+    // samples in sum.  The uncertainty is the 68% quantile of the change in
+    // the integral over "step" samples, which only needs a selection, not a
+    // full sort.  The samples are found from the inverse transform the same
+    // way that Finish finds them.
+    fSigmaWork.resize(3*sampleCount);
+    double* samples = fSigmaWork.data();
+    double* integral = samples + sampleCount;
+    double* diff = integral + sampleCount;
+    const double norm = 1.0/fSampleCount;
     double sum = 0.0;
-    for (std::size_t i = 0; i<deconv->GetSampleCount(); ++i) {
-        sum += deconv->GetSample(i);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
+        samples[i] = static_cast<float>(fSigmaBuffer[i]*norm);
+        sum += samples[i];
         integral[i] = sum;
     }
-    std::vector<double> diff;
-    diff.resize(deconv->GetSampleCount());
-    bool bipolar = channelCalib.IsBipolarSignal(deconv->GetChannelId());
     for (std::size_t step=1; step<kMaxSampleSigmas; ++step) {
-        for (std::size_t i=0; i<diff.size()-step; ++i) {
+        if (sampleCount <= step) break;
+        const std::size_t count = sampleCount-step;
+        for (std::size_t i=0; i<count; ++i) {
             double v = integral[i+step]-integral[i];
-            if (bipolar) {
-                double q = 0.5*(deconv->GetSample(i+step)+deconv->GetSample(i));
+            if (fSigmaBipolar) {
+                double q = 0.5*(samples[i+step]+samples[i]);
                 v = v - step*q;
             }
             diff[i] = std::abs(v);
         }
-        std::sort(diff.begin(), diff.end()-step);
-        fSampleSigma[step] = diff[0.68*diff.size()];
+        std::size_t quantile = std::min<std::size_t>(0.68*sampleCount,
+                                                     count-1);
+        std::nth_element(diff, diff+quantile, diff+count);
+        fSampleSigma[step] = diff[quantile];
     }
-    
+}
+
+void CP::TPulseDeconvolution::Finish(const CP::TChannelId& id,
+                                     const double* buffer,
+                                     float* samples,
+                                     std::size_t sampleCount) {
+    // Replace the calibrated samples with the deconvolution.  The input
+    // samples have all been copied into the FFT, so they can be
+    // overwritten.
+    const double norm = 1.0/fSampleCount;
+    for (std::size_t i=0; i<sampleCount; ++i) samples[i] = buffer[i]*norm;
+
+    // Remember the inverse transform so the uncertainty in a sum of samples
+    // can be found if it's asked for.  The transform isn't changed until
+    // the next deconvolution, and doesn't have the baseline removed.
+    fSigmaBuffer = buffer;
+    fSigmaCount = sampleCount;
+    fSigmaBipolar = IsBipolar(id);
+    fSampleSigmaFilled = false;
+
     // Find the sample to sample variation in the deconvolved signal.
     if (fMinimumSigma < -1) {
         fSampleSigma[0] = - fMinimumSigma;
     }
     else {
-        fSampleSigma[0] = GaussianNoise(deconv->begin(), deconv->end());
+        fSampleSigma[0] = GaussianNoise(samples, samples+sampleCount,
+                                        fNoiseWork);
         fSampleSigma[0] = std::max(fMinimumSigma,fSampleSigma[0]);
     }
 
-    RemoveBaseline(*deconv, calib);
+    if (fRemoveBaseline) RemoveBaseline(id, samples, sampleCount);
+}
 
-    return deconv.release();
+void CP::TPulseDeconvolution::RemoveBaseline(CP::TCalibPulseDigit& digit) {
+    fSamples.resize(digit.GetSampleCount());
+    for (std::size_t i = 0; i<fSamples.size(); ++i) {
+        fSamples[i] = digit.GetSample(i);
+    }
+    RemoveBaseline(digit.GetChannelId(), fSamples.data(), fSamples.size());
+    for (std::size_t i = 0; i<fSamples.size(); ++i) {
+        digit.SetSample(i,fSamples[i]);
+    }
 }
 
-void CP::TPulseDeconvolution::RemoveBaseline(
-    CP::TCalibPulseDigit& digit,
-    const CP::TCalibPulseDigit& calib) {
-    TChannelCalib channelCalib;
+void CP::TPulseDeconvolution::RemoveBaseline(const CP::TChannelId& id,
+                                             float* samples,
+                                             std::size_t sampleCount) {
+    bool bipolar = IsBipolar(id);
 
 #define ONLY_BIPOLAR_BASELINE
 #ifdef ONLY_BIPOLAR_BASELINE
     // Only remove the baseline if it's a bipolar channel.
-    if (!channelCalib.IsBipolarSignal(digit.GetChannelId())) return;
+    if (!bipolar) return;
 #endif
 
     std::vector<double> diff;
-    diff.resize(digit.GetSampleCount());
+    diff.resize(sampleCount);
 
-#ifdef FILL_HISTOGRAM
-#undef FILL_HISTOGRAM
-    TH1F* calibHist 
-        = new TH1F((calib.GetChannelId().AsString()+"-calib").c_str(),
-                   ("Calibibrated signal before deconvolution " 
-                    + calib.GetChannelId().AsString()).c_str(),
-                   calib.GetSampleCount(),
-                   calib.GetFirstSample(), calib.GetLastSample());
-    for (std::size_t i = 0; i<calib.GetSampleCount(); ++i) {
-        calibHist->SetBinContent(i+1,calib.GetSample(i));
-    }
-#endif
-    
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* offsetHist 
-        = new TH1F((digit.GetChannelId().AsString()+"-offset").c_str(),
+        = new TH1F((id.AsString()+"-offset").c_str(),
                    ("Deconvoluted signal before baseline removal for " 
-                    + digit.GetChannelId().AsString()).c_str(),
-                   digit.GetSampleCount(),
-                   digit.GetFirstSample(), digit.GetLastSample());
-    for (std::size_t i = 0; i<digit.GetSampleCount(); ++i) {
-        offsetHist->SetBinContent(i+1,digit.GetSample(i));
+                    + id.AsString()).c_str(),
+                   sampleCount,
+                   0, sampleCount);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
+        offsetHist->SetBinContent(i+1,samples[i]);
     }
 #endif
 
-    // Find the sample median and it's "sigma".
-    for (std::size_t i=1; i<digit.GetSampleCount(); ++i) {
-        diff[i] = digit.GetSample(i);
-    }
-    std::sort(diff.begin(), diff.end());
-
-    double baselineMedian = diff[0.5*digit.GetSampleCount()];
-    double baselineSigma = diff[0.16*digit.GetSampleCount()];
+    // Find the sample median and it's "sigma".  The 16% quantile is below
+    // the median, so it's selected from the samples before the median.
+    for (std::size_t i=1; i<sampleCount; ++i) {
+        diff[i] = samples[i];
+    }
+    std::size_t medianIndex = 0.5*sampleCount;
+    std::size_t sigmaIndex = 0.16*sampleCount;
+    std::nth_element(diff.begin(), diff.begin()+medianIndex, diff.end());
+    double baselineMedian = diff[medianIndex];
+    std::nth_element(diff.begin(), diff.begin()+sigmaIndex,
+                     diff.begin()+medianIndex);
+    double baselineSigma = diff[sigmaIndex];
     baselineSigma = std::abs(baselineSigma-baselineMedian);
 
     // The minimum baseline fluctuation is 1 electron charge.
@@ -372,7 +631,7 @@ void CP::TPulseDeconvolution::RemoveBaseline(
     // Define a cut for the maximum drift in one direction within a coherence
     // zone.  If the drift is more than this, then the region is not baseline.
     double driftSigma = fSampleSigma[0];
-    if (channelCalib.IsBipolarSignal(digit.GetChannelId())) {
+    if (bipolar) {
         driftSigma  *= std::sqrt(fDriftZone);
     }
     double driftCut = fDriftCut * driftSigma;
@@ -381,7 +640,7 @@ void CP::TPulseDeconvolution::RemoveBaseline(
     // existing variable (instead of allocating extra space).
     diff[0] = 0;
     for (std::size_t i=1; i < diff.size(); ++i) {
-        double delta = std::abs(digit.GetSample(i) - digit.GetSample(i-1));
+        double delta = std::abs((double) samples[i] - samples[i-1]);
         diff[i] = delta;
     }
 
@@ -389,63 +648,45 @@ void CP::TPulseDeconvolution::RemoveBaseline(
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* diffHist 
-        = new TH1F((digit.GetChannelId().AsString()+"-diff").c_str(),
+        = new TH1F((id.AsString()+"-diff").c_str(),
                    ("Differences from previous sample for " 
-                    + digit.GetChannelId().AsString()).c_str(),
-                   digit.GetSampleCount(),
-                   digit.GetFirstSample(), digit.GetLastSample());
-    for (std::size_t i = 0; i<digit.GetSampleCount(); ++i) {
+                    + id.AsString()).c_str(),
+                   sampleCount,
+                   0, sampleCount);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
         diffHist->SetBinContent(i+1,diff[i]/fSampleSigma);
     }
 #endif
         
     // Estimate the baseline for regions where there isn't much change.
     std::vector<double> baseline;
-    baseline.resize(digit.GetSampleCount());
+    baseline.resize(sampleCount);
     const double unfilledBaseline = std::numeric_limits<double>::quiet_NaN();
     std::fill(baseline.begin(), baseline.end(), unfilledBaseline);
     
     std::vector<double> drift;
-    drift.resize(digit.GetSampleCount());
-
-    // Fill the drifts for the samples.
-    for (std::size_t i=0; i<drift.size(); ++i) {
-        // Find the start of the coherence zone.
-        int startZone = i - fDriftZone;
-
-        if (startZone < 0) startZone = 0;
-
-        double deltaSample = 0.0;
-        for (std::size_t j = startZone; j<i; ++j) {
-            deltaSample = std::max(deltaSample,
-                                   std::abs(digit.GetSample(i)
-                                            -digit.GetSample(j)));
-        }
-        drift[i] = deltaSample;
-    }
-
-    for (std::size_t i=drift.size()-1; 0 < i; --i) {
-        // Find the start of the coherence zone.
-        std::size_t startZone = i + fDriftZone;
-
-        double deltaSample = 0.0;
-        for (std::size_t j = i+1; j<=startZone; ++j) {
-            deltaSample = std::max(deltaSample,
-                                   std::abs(digit.GetSample(i)
-                                            -digit.GetSample(j)));
-        }
-        drift[i] = std::max(deltaSample, drift[i]);
-    }
+    drift.resize(sampleCount);
+
+    // Fill the drifts for the samples.  The drift is the largest difference
+    // between a sample and the samples in the coherence zone before and
+    // after it.  The first sample only looks backward.
+    std::fill(drift.begin(), drift.end(), 0.0);
+    std::vector<int> lowQueue;
+    std::vector<int> highQueue;
+    MaximumDrift(samples, 0, sampleCount, +1, fDriftZone,
+                 drift.data(), lowQueue, highQueue);
+    MaximumDrift(samples, sampleCount-1, 0, -1, fDriftZone,
+                 drift.data(), lowQueue, highQueue);
 
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* driftHist 
-        = new TH1F((digit.GetChannelId().AsString()+"-drift").c_str(),
+        = new TH1F((id.AsString()+"-drift").c_str(),
                    ("Drift for " 
-                    + digit.GetChannelId().AsString()).c_str(),
-                   digit.GetSampleCount(),
-                   digit.GetFirstSample(), digit.GetLastSample());
-    for (std::size_t i = 0; i<digit.GetSampleCount(); ++i) {
+                    + id.AsString()).c_str(),
+                   sampleCount,
+                   0, sampleCount);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
         driftHist->SetBinContent(i+1, drift[i]/driftSigma);
     }
 #endif
@@ -467,12 +708,12 @@ void CP::TPulseDeconvolution::RemoveBaseline(
         // want to be very explicit about which criteria is triggered.
         if (startZone < 0) {
             // The first several bins are always considered baseline...
-            baseline[i] = digit.GetSample(i);
+            baseline[i] = samples[i];
             continue;
         }
 
         // Don't consider very high signals to be baseline
-        if (digit.GetSample(i) > baselineCut) {
+        if (samples[i] > baselineCut) {
             continue;
         }
 
@@ -493,7 +734,7 @@ void CP::TPulseDeconvolution::RemoveBaseline(
         // We've found a sample that should be considered part of the
         // baseline, so add it to the vector for book keeping.
         int offset = (int) (0.5*fCoherenceZone);
-        baseline[i-offset] = digit.GetSample(i-offset);
+        baseline[i-offset] = samples[i-offset];
     }
 
     coh = 0;
@@ -515,12 +756,12 @@ void CP::TPulseDeconvolution::RemoveBaseline(
         // want to be very explicit about which criteria is triggered.
         if (diff.size() <= startZone) {
             // The first several bins are always considered baseline...
-            baseline[i] = digit.GetSample(i);
+            baseline[i] = samples[i];
             continue;
         }
 
         // Don't consider very high signals to be baseline
-        if (digit.GetSample(i) > baselineCut) {
+        if (samples[i] > baselineCut) {
             continue;
         }
 
@@ -541,7 +782,7 @@ void CP::TPulseDeconvolution::RemoveBaseline(
         // We've found a sample that should be considered part of the
         // baseline, so add it to the vector for bookkeeping.
         int offset = (int) (0.5*fCoherenceZone);
-        baseline[i+offset] = digit.GetSample(i+offset);
+        baseline[i+offset] = samples[i+offset];
     }
 
     ///////////////////////////////////////////////////////////////////////
@@ -561,19 +802,29 @@ void CP::TPulseDeconvolution::RemoveBaseline(
     // allocation (i.e. false optimization!).  After the end of this section,
     // drift will have a value for anyplace where the signal is baseline like,
     // but not already part of the baseline.
+    // The neighboring baseline samples are found with one sweep in each
+    // direction: "next" holds the following baseline sample, and the
+    // previous one is tracked while looping.
+    std::vector<std::size_t> next;
+    NextFinite(baseline, next);
+    std::size_t previous = 0;
     for (std::size_t i = 1; i<baseline.size()-1; ++i) {
         drift[i] = unfilledBaseline;
-        if (std::isfinite(baseline[i])) continue;
-        std::size_t j = i;
-        while (0<j && !std::isfinite(baseline[j])) --j;
-        std::size_t k = i;
-        while (k<baseline.size() && !std::isfinite(baseline[k])) ++k;
-        double interp = (k-i)*baseline[j] + (i-j)*baseline[k];
-        interp /= 1.0*(k-j);
-        if (digit.GetSample(i) < interp
+        if (std::isfinite(baseline[i])) {
+            previous = i;
+            continue;
+        }
+        std::size_t j = previous;
+        std::size_t k = next[i];
+        double interp = baseline[j];
+        if (k < baseline.size()) {
+            interp = (k-i)*baseline[j] + (i-j)*baseline[k];
+            interp /= 1.0*(k-j);
+        }
+        if (samples[i] < interp
             && diff[i]/fSampleSigma[0] < 3.0
             && diff[i+1]/fSampleSigma[0] < 3.0) {
-            drift[i] = digit.GetSample(i);
+            drift[i] = samples[i];
         }
     }
 
@@ -632,29 +883,33 @@ void CP::TPulseDeconvolution::RemoveBaseline(
 
     // At this point, drift contains the smoothed baseline.  Now copy it back
     // into baseline and interpolate any unfilled values.
+    NextFinite(drift, next);
+    previous = 0;
     for (std::size_t i = 0; i<baseline.size(); ++i) {
         if (std::isfinite(drift[i])) {
             baseline[i] = drift[i];
+            previous = i;
             continue;
         }
-        std::size_t j = i;
-        while (0<j && !std::isfinite(drift[j])) --j;
-        std::size_t k = i;
-        while (k<drift.size() && !std::isfinite(drift[k])) ++k;
-        double interp = (k-i)*drift[j] + (i-j)*drift[k];
-        interp /= 1.0*(k-j);
+        std::size_t j = previous;
+        std::size_t k = next[i];
+        double interp = drift[j];
+        if (k < drift.size()) {
+            interp = (k-i)*drift[j] + (i-j)*drift[k];
+            interp /= 1.0*(k-j);
+        }
         baseline[i] = interp;
     }
 
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* bkgHist 
-        = new TH1F((digit.GetChannelId().AsString()+"-baseline").c_str(),
+        = new TH1F((id.AsString()+"-baseline").c_str(),
                    ("Estimated baseline for " 
-                    + digit.GetChannelId().AsString()).c_str(),
-                   digit.GetSampleCount(),
-                   digit.GetFirstSample(), digit.GetLastSample());
-    for (std::size_t i = 0; i<digit.GetSampleCount(); ++i) {
+                    + id.AsString()).c_str(),
+                   sampleCount,
+                   0, sampleCount);
+    for (std::size_t i = 0; i<sampleCount; ++i) {
         if (!std::isfinite(baseline[i])) {
             CaptError("Baseline not filled at " << i);
         }
@@ -666,17 +921,17 @@ void CP::TPulseDeconvolution::RemoveBaseline(
     // baseline (relative to the mean baseline).
     fBaselineSigma = 0.0;
     double aveBaseline = 0.0;
-    for (std::size_t i=0; i<digit.GetSampleCount(); ++i) {
+    for (std::size_t i=0; i<sampleCount; ++i) {
         if (!std::isfinite(baseline[i])) {
             CaptError("Baseline not filled at " << i);
         }
         fBaselineSigma += baseline[i]*baseline[i];
         aveBaseline += baseline[i];
-        double d = digit.GetSample(i) - baseline[i];
-        digit.SetSample(i,d);
+        double d = samples[i] - baseline[i];
+        samples[i] = d;
     }
-    fBaselineSigma /= digit.GetSampleCount();
-    aveBaseline /= digit.GetSampleCount();
+    fBaselineSigma /= sampleCount;
+    aveBaseline /= sampleCount;
     if (fBaselineSigma > 0.0) {
         fBaselineSigma = std::sqrt(fBaselineSigma-aveBaseline*aveBaseline);
     }
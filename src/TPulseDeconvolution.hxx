@@ -1,18 +1,26 @@
 #ifndef TPulseDeconvolution_hxx_seen
 #define TPulseDeconvolution_hxx_seen
 
+#include "TFFTBatch.hxx"
+#include "TResponseBank.hxx"
+
 #include <TCalibPulseDigit.hxx>
 #include <TChannelId.hxx>
+#include <TEventContext.hxx>
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace CP {
     class TPulseDeconvolution;
     class TElectronicsResponse;
     class TWireResponse;
     class TNoiseFilter;
+    class TWaveformMatrix;
 };
 
-class TVirtualFFT;
-
 /// Take a digit, that must be derived from a TCalibPulseDigit, and
 /// deconvolute the distribution to get an inferred current. The resulting
 /// digit will have the time, and pedestal subtracted charge in the standard
@@ -20,29 +28,92 @@ class TVirtualFFT;
 /// The time is measured relative to the start of the digitization period, and
 /// not the time of the particle.  The charge is not corrected for the
 /// electron lifetime.  The caller owns the resulting
-/// CP::TCalibPulseDigit pointer and is responsible for deleting it.
+/// CP::TCalibPulseDigit pointer and is responsible for deleting it.  The
+/// object keeps the FFT plans, the response functions and the noise filter,
+/// so each thread doing a deconvolution needs its own TPulseDeconvolution.
 class CP::TPulseDeconvolution {
     static const int kMaxSampleSigmas = 50;
+
+    /// The number of samples past the end of the digit where the FFT buffer
+    /// is tapered to zero.  The taper is exp(-(n/10)^2) after n samples, so
+    /// it is zero after about 64 samples.
+    static const int kTaperSamples = 64;
     
 public:
     explicit TPulseDeconvolution(int sampleCount);
     virtual ~TPulseDeconvolution();
 
-    /// Do the actual calibration.
-    CP::TCalibPulseDigit* operator()(const CP::TCalibPulseDigit& digit);
+    /// Do the actual calibration.  The event context is used to find the
+    /// response functions for the channel.
+    CP::TCalibPulseDigit* operator()(const CP::TCalibPulseDigit& digit,
+                                     const CP::TEventContext& context);
+
+    /// Do the deconvolution in place, replacing the calibrated samples in
+    /// the digit with the deconvolved samples.  This returns false if the
+    /// channel is noisy, and the digit contents should then not be used.
+    bool Deconvolve(CP::TCalibPulseDigit& digit,
+                    const CP::TEventContext& context);
+
+    /// Do the deconvolution in place on a buffer of calibrated samples
+    /// (e.g. a row of a CP::TWaveformMatrix) for a channel.  This returns
+    /// false if the channel is noisy, and the samples should then not be
+    /// used.
+    bool Deconvolve(const CP::TChannelId& id,
+                    float* samples, std::size_t sampleCount,
+                    const CP::TEventContext& context);
+
+    /// Do the deconvolution in place for several rows of a waveform matrix.
+    /// The rows are done in batches (set by
+    /// clusterCalib.deconvolution.batch) so that the FFTs for a batch are
+    /// done together.  Each row is flagged as kDeconvolved, or kNoisy if
+    /// the channel is noisy (and the row should then not be used).  This
+    /// returns the number of rows that were deconvolved.  The sigmas are
+    /// for the last row that was deconvolved.
+    std::size_t Deconvolve(CP::TWaveformMatrix& waveforms,
+                           const std::vector<std::size_t>& rows,
+                           const CP::TEventContext& context);
+
+    /// Remove the baseline drift from the deconvolution.  This looks at the
+    /// sample to sample fluctuations to estimate the background, so it uses
+    /// the sample sigmas found by the last call to Deconvolve.  This is
+    /// called by Deconvolve, and is public so it can be timed by itself.
+    void RemoveBaseline(CP::TCalibPulseDigit& digit);
+
+    /// Remove the baseline drift from a buffer of deconvolved samples.
+    void RemoveBaseline(const CP::TChannelId& id,
+                        float* samples, std::size_t sampleCount);
+
+    /// Set if Deconvolve removes the baseline (the default).  If this is
+    /// false, the deconvolution is left with the baseline so that
+    /// RemoveBaseline can be applied (or timed) separately.
+    void SetRemoveBaseline(bool value) {fRemoveBaseline = value;}
+
+    /// Set the sample to sample sigma used by RemoveBaseline.  This is
+    /// normally found by Deconvolve, and is set when the baseline is removed
+    /// from a deconvolution that was done earlier.
+    void SetSampleSigma(double sigma) {
+        ResetSampleSigma();
+        fSampleSigma[0] = sigma;
+    }
 
     /// Get the number of samples in the FFT.
     int GetSampleCount() const {return fSampleCount;}
 
+    /// Get the number of channels that are transformed together.
+    int GetBatchSize() const {return fBatchSize;}
+
     /// Get the baseline uncertainty.  This is calculated relative to the
     /// average baseline and represents the per sample uncertainty in the
     /// deconvolution.
     double GetBaselineSigma() const {return fBaselineSigma;}
 
     /// Get the sample to sample sigma.  Represents the uncorrelated
-    /// uncertainty between samples.
+    /// uncertainty between samples.  The sigma for a sum of "i" samples is
+    /// only calculated the first time it is asked for after a
+    /// deconvolution.
     double GetSampleSigma(int i=0) const {
         if (i<1) return fSampleSigma[0];
+        if (!fSampleSigmaFilled) FillSampleSigma();
         if (i<kMaxSampleSigmas) return fSampleSigma[i];
         // Scale the uncertainty beyond 50 channels.
         return 1.0*i*fSampleSigma[kMaxSampleSigmas-1]/(kMaxSampleSigmas-1);
@@ -53,21 +124,57 @@ private:
     /// Initialize the class.
     void Initialize();
 
-    /// Remove the baseline drift from the deconvolution.  This looks at the
-    /// sample to sample fluctuations to estimate the background.
-    void RemoveBaseline(CP::TCalibPulseDigit& digit,
-                        const CP::TCalibPulseDigit& calib);
+    /// Copy the samples into an FFT buffer with fSampleCount entries,
+    /// applying the smoothing, and making the ends go to zero.
+    void FillBuffer(const CP::TChannelId& id,
+                    const float* samples, std::size_t sampleCount,
+                    double* buffer);
+
+    /// Calculate the noise filter for the transformed samples, and then
+    /// replace the frequencies with the filtered deconvolution.  This
+    /// returns false if the channel is noisy.
+    bool Filter(const CP::TChannelId& id,
+                const CP::TEventContext& context,
+                CP::TFFTBatch::Complex* frequencies);
+
+    /// Find the inverse of the combined electronics and wire response for
+    /// the current responses, and make it if it hasn't been used before.
+    void FindKernel();
+
+    /// Check if a channel has a bipolar signal.  The calibration is looked
+    /// up for the context of the last deconvolution while holding the
+    /// channel information lock since the deconvolutions can be done by
+    /// several threads.
+    bool IsBipolar(const CP::TChannelId& id);
+
+    /// Zero the sample sigmas and forget the samples they are found from.
+    void ResetSampleSigma();
+
+    /// Fill the sample sigmas for sums of more than one sample from the
+    /// inverse transform remembered by Finish.
+    void FillSampleSigma() const;
+
+    /// Copy the inverse transform back into the samples, find the sample
+    /// sigmas and remove the baseline.
+    void Finish(const CP::TChannelId& id, const double* buffer,
+                float* samples, std::size_t sampleCount);
 
     /// A convenient holder for the number of samples used in the FFT.  This
-    /// must equivalent to fFFT->GetN()[0], or there is a bug.  The
+    /// must equivalent to fBatch->GetLength(), or there is a bug.  The
     /// equivalence is guarranteed in the constructor.
     int fSampleCount;
 
-    /// The fft class to take the fourier transform.
-    TVirtualFFT *fFFT;
+    /// The number of channels transformed together.
+    int fBatchSize;
 
-    /// The fft class to take the inverse fourier transform.
-    TVirtualFFT *fInverseFFT;
+    /// If true, Deconvolve removes the baseline.
+    bool fRemoveBaseline;
+
+    /// The event context of the last deconvolution.
+    CP::TEventContext fContext;
+
+    /// The buffers and plans for the forward and inverse transforms.
+    CP::TFFTBatch* fBatch;
 
     /// The electronics response.  For now, there is only one object, but if
     /// the difference classes of electronics end up with different responses,
@@ -79,6 +186,27 @@ private:
     /// then it may pay to have more than one.
     TWireResponse* fWireResponse;
 
+    /// The inverse of the product of the electronics and wire responses for
+    /// each non-negative frequency.  The responses that were used are kept
+    /// so that the bank entries can't be reused while the kernel is cached.
+    struct Kernel {
+        std::shared_ptr<const CP::TResponseBank::Entry> fElectronics;
+        std::shared_ptr<const CP::TResponseBank::Entry> fWire;
+        std::vector<CP::TFFTBatch::Complex> fInverse;
+    };
+
+    /// The kernels for each pair of electronics and wire responses that has
+    /// been used.  The collection and induction wires have different
+    /// responses, so this keeps the kernels from being recalculated every
+    /// time the wire type changes.
+    typedef std::pair<const CP::TResponseBank::Entry*,
+                      const CP::TResponseBank::Entry*> KernelKey;
+    std::map<KernelKey, Kernel> fKernels;
+
+    /// The kernel for the current responses.  This points into fKernels, so
+    /// a channel only needs a multiply for each frequency.
+    const std::vector<CP::TFFTBatch::Complex>* fKernel;
+
     /// An optimal filter can be applied to reduce the effect of high
     /// frequency noise.  This sets the frequency cut-off as a fraction of the
     /// Nyquist frequency.  A "cut" of 1.0 means no cut-off.  Since the
@@ -145,7 +273,35 @@ private:
     /// The baseline sigma relative to the average baseline.
     double fBaselineSigma;
     
-    /// The sample to sample sigma.
-    double fSampleSigma[kMaxSampleSigmas];
+    /// The sample to sample sigma.  Only the first entry is filled by the
+    /// deconvolution, and the rest are filled by FillSampleSigma when they
+    /// are needed.
+    mutable double fSampleSigma[kMaxSampleSigmas];
+
+    /// True if the sample sigmas for sums of samples have been filled.
+    mutable bool fSampleSigmaFilled;
+
+    /// The inverse transform of the last channel that was deconvolved, and
+    /// the number of samples.  This is used to fill the sample sigmas for
+    /// sums of samples, and points into the FFT batch, so it's only valid
+    /// until the next deconvolution (it is reset with the sample sigmas).
+    const double* fSigmaBuffer;
+    std::size_t fSigmaCount;
+
+    /// A copy of the transform used for the sample sigmas when the batch
+    /// that holds it is reused before the end of a deconvolution.
+    std::vector<double> fSigmaCopy;
+
+    /// True if fSigmaBuffer is from a bipolar (induction) signal.
+    bool fSigmaBipolar;
+
+    /// A work area used to fill the sample sigmas.
+    mutable std::vector<double> fSigmaWork;
+
+    /// A work area used to find the Gaussian noise of the deconvolution.
+    std::vector<CP::TCalibPulseDigit::Vector::value_type> fNoiseWork;
+
+    /// A copy of the samples when a digit is deconvolved.
+    std::vector<float> fSamples;
 };
 #endif
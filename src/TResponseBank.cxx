@@ -0,0 +1,33 @@
+#include "TResponseBank.hxx"
+
+CP::TResponseBank& CP::TResponseBank::Get() {
+    static TResponseBank bank;
+    return bank;
+}
+
+std::shared_ptr<const CP::TResponseBank::Entry>
+CP::TResponseBank::Find(const Key& key) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::map<Key, std::shared_ptr<const Entry> >::iterator e
+        = fEntries.find(key);
+    if (e == fEntries.end()) return std::shared_ptr<const Entry>();
+    return e->second;
+}
+
+std::shared_ptr<const CP::TResponseBank::Entry>
+CP::TResponseBank::Add(const Key& key, std::shared_ptr<const Entry> entry) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::pair<std::map<Key, std::shared_ptr<const Entry> >::iterator, bool>
+        result = fEntries.insert(std::make_pair(key, entry));
+    return result.first->second;
+}
+
+void CP::TResponseBank::Clear() {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fEntries.clear();
+}
+
+std::size_t CP::TResponseBank::GetEntries() {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fEntries.size();
+}
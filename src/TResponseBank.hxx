@@ -0,0 +1,76 @@
+#ifndef TResponseBank_hxx_seen
+#define TResponseBank_hxx_seen
+
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CP {
+    class TResponseBank;
+};
+
+/// A process wide bank of the response functions used by the
+/// deconvolution.  A response only depends on the calibration constants
+/// for a channel (e.g. the pulse shape and the time per sample), and not on
+/// the event, so the responses are kept for the whole job and are shared by
+/// every channel (and thread) with the same constants.  The key is made by
+/// the response class from the constants that determine the response, and
+/// the entry holds the time domain response, the non-negative frequencies
+/// and their magnitudes.  An entry is never changed after it is added, so
+/// it can be used without a lock.  This is thread safe.
+/// \code
+/// CP::TResponseBank::Key key;
+/// key.push_back(kind); key.push_back(size); key.push_back(timeConstant);
+/// std::shared_ptr<const CP::TResponseBank::Entry> entry
+///     = CP::TResponseBank::Get().Find(key);
+/// if (!entry) entry = CP::TResponseBank::Get().Add(key, MakeEntry());
+/// \endcode
+class CP::TResponseBank {
+public:
+    /// The constants that determine a response.
+    typedef std::vector<double> Key;
+
+    /// A response function.
+    struct Entry {
+        /// The response for each time bin.
+        std::vector<double> fResponse;
+
+        /// The FFT of the response for the non-negative frequencies.
+        std::vector< std::complex<double> > fFrequency;
+
+        /// The magnitude of fFrequency.
+        std::vector<double> fMagnitude;
+    };
+
+    /// Get the response bank.
+    static TResponseBank& Get();
+
+    /// Find the response for a key.  This returns an empty pointer if the
+    /// response isn't in the bank.
+    std::shared_ptr<const Entry> Find(const Key& key);
+
+    /// Add a response to the bank, and return the response that is in the
+    /// bank for the key.  If another thread already added a response for
+    /// the key, that response is returned (and the new one is dropped).
+    std::shared_ptr<const Entry> Add(const Key& key,
+                                     std::shared_ptr<const Entry> entry);
+
+    /// Remove all of the responses.  The responses that are being used
+    /// stay valid until they are released.
+    void Clear();
+
+    /// Get the number of responses in the bank.
+    std::size_t GetEntries();
+
+private:
+    TResponseBank() {}
+
+    /// Protect the map.
+    std::mutex fMutex;
+
+    /// The responses.
+    std::map<Key, std::shared_ptr<const Entry> > fEntries;
+};
+#endif
@@ -0,0 +1,246 @@
+#include "TStageTimer.hxx"
+
+#include <TCaptLog.hxx>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+void CP::TStageTimer::Totals::Add(const Totals& other) {
+    fEvents += other.fEvents;
+    fTime += other.fTime;
+    fChannels += other.fChannels;
+    fSamples += other.fSamples;
+    fHits += other.fHits;
+}
+
+CP::TStageTimer::TStageTimer() {}
+
+CP::TStageTimer::~TStageTimer() {}
+
+std::size_t CP::TStageTimer::FindStage(const std::string& stage) {
+    for (std::size_t i = 0; i < fStages.size(); ++i) {
+        if (fStages[i] == stage) return i;
+    }
+    fStages.push_back(stage);
+    fEvent.resize(fStages.size());
+    fJob.resize(fStages.size());
+    for (std::size_t r = 0; r < fRuns.size(); ++r) {
+        fRuns[r].fStages.resize(fStages.size());
+    }
+    return fStages.size()-1;
+}
+
+void CP::TStageTimer::StartEvent(const CP::TEventContext& context) {
+    fEvent.clear();
+    fEvent.resize(fStages.size());
+    int run = context.GetRun();
+    if (!fRuns.empty() && fRuns.back().fRun == run) return;
+    RunTotals runTotals;
+    runTotals.fRun = run;
+    runTotals.fStages.resize(fStages.size());
+    fRuns.push_back(runTotals);
+}
+
+void CP::TStageTimer::FinishEvent() {
+    if (fRuns.empty()) StartEvent(CP::TEventContext());
+    std::ostringstream summary;
+    for (std::size_t i = 0; i < fEvent.size(); ++i) {
+        Totals& event = fEvent[i];
+        if (event.fTime <= 0.0 && event.fChannels == 0) continue;
+        event.fEvents = 1;
+        fRuns.back().fStages[i].Add(event);
+        fJob[i].Add(event);
+        summary << " " << fStages[i] << ": "
+                << std::fixed << std::setprecision(1)
+                << 1000.0*event.fTime << " ms";
+    }
+    CaptNamedInfo("timing", "Stage times:" << summary.str());
+}
+
+void CP::TStageTimer::Add(const std::string& stage, double seconds,
+                          long channels, long samples, long hits) {
+    Totals& totals = fEvent[FindStage(stage)];
+    totals.fTime += seconds;
+    totals.fChannels += channels;
+    totals.fSamples += samples;
+    totals.fHits += hits;
+}
+
+void CP::TStageTimer::Merge(const CP::TStageTimer& other) {
+    for (std::size_t i = 0; i < other.fStages.size(); ++i) {
+        std::size_t stage = FindStage(other.fStages[i]);
+        fJob[stage].Add(other.fJob[i]);
+        for (std::size_t r = 0; r < other.fRuns.size(); ++r) {
+            const RunTotals& otherRun = other.fRuns[r];
+            std::size_t run = 0;
+            while (run < fRuns.size() && fRuns[run].fRun != otherRun.fRun) {
+                ++run;
+            }
+            if (run == fRuns.size()) {
+                RunTotals runTotals;
+                runTotals.fRun = otherRun.fRun;
+                runTotals.fStages.resize(fStages.size());
+                fRuns.push_back(runTotals);
+            }
+            fRuns[run].fStages[stage].Add(otherRun.fStages[i]);
+        }
+    }
+}
+
+CP::TStageTimer::Totals
+CP::TStageTimer::GetEventTotals(const std::string& stage) const {
+    for (std::size_t i = 0; i < fStages.size(); ++i) {
+        if (fStages[i] == stage) return fEvent[i];
+    }
+    return Totals();
+}
+
+CP::TStageTimer::Totals
+CP::TStageTimer::GetJobTotals(const std::string& stage) const {
+    for (std::size_t i = 0; i < fStages.size(); ++i) {
+        if (fStages[i] == stage) return fJob[i];
+    }
+    return Totals();
+}
+
+void CP::TStageTimer::PrintRow(std::ostream& out,
+                               const std::string& stage,
+                               const Totals& totals) const {
+    double perEvent = 0.0;
+    if (totals.fEvents > 0) perEvent = 1000.0*totals.fTime/totals.fEvents;
+    double sampleRate = 0.0;
+    double hitRate = 0.0;
+    if (totals.fTime > 0.0) {
+        sampleRate = totals.fSamples/totals.fTime;
+        hitRate = totals.fHits/totals.fTime;
+    }
+    out << std::left << std::setw(20) << stage << std::right
+        << std::setw(8) << totals.fEvents
+        << std::fixed << std::setprecision(3)
+        << std::setw(12) << totals.fTime
+        << std::setw(12) << perEvent
+        << std::setw(10) << totals.fChannels
+        << std::setw(12) << totals.fSamples
+        << std::scientific << std::setprecision(3)
+        << std::setw(12) << sampleRate
+        << std::setw(10) << totals.fHits
+        << std::setw(12) << hitRate
+        << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+void CP::TStageTimer::Print(std::ostream& out) const {
+    out << "Stage timing summary" << std::endl;
+    out << std::left << std::setw(20) << "Stage" << std::right
+        << std::setw(8) << "Events"
+        << std::setw(12) << "Time(s)"
+        << std::setw(12) << "ms/event"
+        << std::setw(10) << "Channels"
+        << std::setw(12) << "Samples"
+        << std::setw(12) << "Samples/s"
+        << std::setw(10) << "Hits"
+        << std::setw(12) << "Hits/s"
+        << std::endl;
+    for (std::size_t i = 0; i < fStages.size(); ++i) {
+        PrintRow(out, fStages[i], fJob[i]);
+    }
+}
+
+bool CP::TStageTimer::Write(const std::string& fileName) const {
+    std::ofstream out(fileName.c_str());
+    if (!out) {
+        CaptError("Cannot write the stage timing to " << fileName);
+        return false;
+    }
+    const std::string json(".json");
+    if (fileName.size() >= json.size()
+        && fileName.compare(fileName.size()-json.size(),
+                            json.size(), json) == 0) {
+        WriteJSON(out);
+    }
+    else WriteCSV(out);
+    return true;
+}
+
+namespace {
+    void WriteJSONTotals(std::ostream& out,
+                         const std::vector<std::string>& stages,
+                         const std::vector<CP::TStageTimer::Totals>& totals,
+                         const std::string& indent) {
+        out << "{";
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            const CP::TStageTimer::Totals& t = totals[i];
+            double sampleRate = 0.0;
+            double hitRate = 0.0;
+            if (t.fTime > 0.0) {
+                sampleRate = t.fSamples/t.fTime;
+                hitRate = t.fHits/t.fTime;
+            }
+            if (i > 0) out << ",";
+            out << std::endl << indent << "  \"" << stages[i] << "\": {"
+                << "\"events\": " << t.fEvents
+                << ", \"time\": " << t.fTime
+                << ", \"channels\": " << t.fChannels
+                << ", \"samples\": " << t.fSamples
+                << ", \"hits\": " << t.fHits
+                << ", \"samplesPerSecond\": " << sampleRate
+                << ", \"hitsPerSecond\": " << hitRate
+                << "}";
+        }
+        out << std::endl << indent << "}";
+    }
+
+    void WriteCSVTotals(std::ostream& out,
+                        const std::string& scope,
+                        const std::vector<std::string>& stages,
+                        const std::vector<CP::TStageTimer::Totals>& totals) {
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            const CP::TStageTimer::Totals& t = totals[i];
+            double sampleRate = 0.0;
+            double hitRate = 0.0;
+            if (t.fTime > 0.0) {
+                sampleRate = t.fSamples/t.fTime;
+                hitRate = t.fHits/t.fTime;
+            }
+            out << scope << "," << stages[i]
+                << "," << t.fEvents
+                << "," << t.fTime
+                << "," << t.fChannels
+                << "," << t.fSamples
+                << "," << t.fHits
+                << "," << sampleRate
+                << "," << hitRate
+                << std::endl;
+        }
+    }
+}
+
+void CP::TStageTimer::WriteJSON(std::ostream& out) const {
+    out << std::setprecision(6);
+    out << "{" << std::endl;
+    out << "  \"runs\": [";
+    for (std::size_t r = 0; r < fRuns.size(); ++r) {
+        if (r > 0) out << ",";
+        out << std::endl << "    {\"run\": " << fRuns[r].fRun
+            << ", \"stages\": ";
+        WriteJSONTotals(out, fStages, fRuns[r].fStages, "    ");
+        out << "}";
+    }
+    out << std::endl << "  ]," << std::endl;
+    out << "  \"job\": ";
+    WriteJSONTotals(out, fStages, fJob, "  ");
+    out << std::endl << "}" << std::endl;
+}
+
+void CP::TStageTimer::WriteCSV(std::ostream& out) const {
+    out << std::setprecision(6);
+    out << "scope,stage,events,time,channels,samples,hits,"
+        << "samplesPerSecond,hitsPerSecond" << std::endl;
+    for (std::size_t r = 0; r < fRuns.size(); ++r) {
+        std::ostringstream scope;
+        scope << "run " << fRuns[r].fRun;
+        WriteCSVTotals(out, scope.str(), fStages, fRuns[r].fStages);
+    }
+    WriteCSVTotals(out, "job", fStages, fJob);
+}
@@ -0,0 +1,136 @@
+#ifndef TStageTimer_hxx_seen
+#define TStageTimer_hxx_seen
+
+#include <TEventContext.hxx>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace CP {
+    class TStageTimer;
+};
+
+/// Accumulate the wall clock time, and the number of channels, samples and
+/// hits handled by each stage of the calibration.  The totals are kept for
+/// the current event, for each run, and for the whole job.  The stages are
+/// identified by name, and are reported in the order they are first used.
+/// This is not thread safe, so the times for work done in worker threads
+/// should be collected by the caller and added from the main thread.
+/// \code
+/// CP::TStageTimer::Clock::time_point start = CP::TStageTimer::Now();
+/// ... do the work ...
+/// timer.Add("Deconvolve", CP::TStageTimer::Seconds(start),
+///           channels, samples);
+/// \endcode
+class CP::TStageTimer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// The totals for one stage.
+    struct Totals {
+        Totals()
+            : fEvents(0), fTime(0.0), fChannels(0), fSamples(0), fHits(0) {}
+
+        /// Add the totals from another stage.
+        void Add(const Totals& other);
+
+        /// The number of events that used this stage.
+        int fEvents;
+
+        /// The wall clock time in seconds.
+        double fTime;
+
+        /// The number of channels processed.
+        long fChannels;
+
+        /// The number of samples processed.
+        long fSamples;
+
+        /// The number of hits found.
+        long fHits;
+    };
+
+    TStageTimer();
+    virtual ~TStageTimer();
+
+    /// Get the current time.
+    static Clock::time_point Now() {return Clock::now();}
+
+    /// Get the number of seconds since a start time.
+    static double Seconds(Clock::time_point start) {
+        return std::chrono::duration<double>(Now() - start).count();
+    }
+
+    /// Start the timing for an event.  This clears the event totals, and
+    /// starts a new set of run totals if the run has changed.
+    void StartEvent(const CP::TEventContext& context);
+
+    /// Finish the timing for an event.  This adds the event totals to the
+    /// run and job totals.
+    void FinishEvent();
+
+    /// Add the time, and the number of channels, samples and hits for a
+    /// stage to the current event.
+    void Add(const std::string& stage, double seconds,
+             long channels = 0, long samples = 0, long hits = 0);
+
+    /// Add the run and job totals from another timer.  This is used to
+    /// combine the timers when several events are processed at the same
+    /// time.
+    void Merge(const CP::TStageTimer& other);
+
+    /// Get the names of the stages.
+    const std::vector<std::string>& GetStages() const {return fStages;}
+
+    /// Get the totals for a stage in the current event.
+    Totals GetEventTotals(const std::string& stage) const;
+
+    /// Get the totals for a stage for the whole job.
+    Totals GetJobTotals(const std::string& stage) const;
+
+    /// Print a summary table of the job totals.
+    void Print(std::ostream& out = std::cout) const;
+
+    /// Write the run and job totals to a file.  The file is written as JSON
+    /// if the name ends in ".json", and otherwise as comma separated values.
+    /// This returns false if the file couldn't be written.
+    bool Write(const std::string& fileName) const;
+
+    /// Write the run and job totals as JSON.
+    void WriteJSON(std::ostream& out) const;
+
+    /// Write the run and job totals as comma separated values.  There is a
+    /// header line followed by a line for each stage in each run, and then a
+    /// line for each stage in the job.
+    void WriteCSV(std::ostream& out) const;
+
+private:
+
+    /// The totals for a run.
+    struct RunTotals {
+        int fRun;
+        std::vector<Totals> fStages;
+    };
+
+    /// Find the index of a stage, adding it if it doesn't exist.
+    std::size_t FindStage(const std::string& stage);
+
+    /// Write a row of the summary table.
+    void PrintRow(std::ostream& out,
+                  const std::string& stage, const Totals& totals) const;
+
+    /// The names of the stages.
+    std::vector<std::string> fStages;
+
+    /// The totals for the current event, indexed by stage.
+    std::vector<Totals> fEvent;
+
+    /// The totals for each run in the order they were seen.
+    std::vector<RunTotals> fRuns;
+
+    /// The totals for the job.
+    std::vector<Totals> fJob;
+};
+#endif
@@ -0,0 +1,212 @@
+#include "TSyntheticEvents.hxx"
+#include "TElectronicsResponse.hxx"
+#include "TWireResponse.hxx"
+
+#include <TChannelCalib.hxx>
+
+#include <TPulseDigit.hxx>
+#include <TDigitContainer.hxx>
+#include <TDataVector.hxx>
+#include <TMCChannelId.hxx>
+#include <TEventContext.hxx>
+#include <HEPUnits.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace {
+    /// The number of wire planes for the drift channels.
+    const int kPlanes = 3;
+
+    /// The maximum length of the shaped response in samples.
+    const int kMaxShape = 1000;
+}
+
+CP::TSyntheticEvents::TSyntheticEvents()
+    : fChannels(1000), fSamples(4096), fPMTs(4),
+      fPedestal(2048.0), fGaussianNoise(3.0),
+      fCoherentNoise(2.0), fCoherentGroup(32),
+      fTracks(2), fTrackCharge(20000*unit::eplus),
+      fRandom(4357) {}
+
+CP::TSyntheticEvents::~TSyntheticEvents() {}
+
+void CP::TSyntheticEvents::AddNoiseLine(double frequency, double amplitude) {
+    fLineFrequency.push_back(frequency);
+    fLineAmplitude.push_back(amplitude);
+}
+
+void CP::TSyntheticEvents::FillShape(const CP::TEventContext& context,
+                                     const CP::TChannelId& channel,
+                                     std::vector<double>& shape) {
+    int size = std::min(fSamples, kMaxShape);
+    CP::TElectronicsResponse electronics(size);
+    CP::TWireResponse wire(size);
+    electronics.Calculate(context,channel);
+    wire.Calculate(context,channel);
+
+    // Convolve the wire and electronics responses.
+    shape.assign(size, 0.0);
+    for (int i = 0; i < size; ++i) {
+        double e = electronics.GetResponse(i);
+        if (std::abs(e) < 1E-6) continue;
+        for (int j = 0; i+j < size; ++j) {
+            shape[i+j] += e*wire.GetResponse(j);
+        }
+    }
+
+    // Remove the negligible tail.
+    double maxShape = 0.0;
+    for (int i = 0; i < size; ++i) {
+        maxShape = std::max(maxShape, std::abs(shape[i]));
+    }
+    while (!shape.empty() && std::abs(shape.back()) < 1E-4*maxShape) {
+        shape.pop_back();
+    }
+}
+
+template <typename vector>
+void CP::TSyntheticEvents::Digitize(const std::vector<double>& waveform,
+                                    vector& adc) {
+    adc.resize(waveform.size());
+    for (std::size_t i = 0; i < waveform.size(); ++i) {
+        double v = std::floor(waveform[i] + 0.5);
+        v = std::max(0.0, std::min(4095.0, v));
+        adc[i] = (typename vector::value_type) v;
+    }
+}
+
+CP::TEvent* CP::TSyntheticEvents::Generate(int eventNumber) {
+    CP::TEventContext context;
+    context.SetPartition(CP::TEventContext::kMCData);
+    context.SetRun(0);
+    context.SetSubRun(0);
+    context.SetEvent(eventNumber);
+
+    std::unique_ptr<CP::TEvent> event(new CP::TEvent(context));
+    if (!event->Get<CP::TDataVector>("~/digits")) {
+        event->AddDatum(new CP::TDataVector("digits",
+                                            "Synthetic digits"));
+    }
+    if (!event->Get<CP::TDataVector>("~/hits")) {
+        event->AddDatum(new CP::TDataVector("hits",
+                                            "Hits for the event"));
+    }
+    CP::THandle<CP::TDataVector> digits
+        = event->Get<CP::TDataVector>("~/digits");
+
+    CP::TChannelCalib calib;
+
+    ///////////////////////////////////////////////////////////////////////
+    // Drift channels.  The channels are split evenly between the planes.
+    ///////////////////////////////////////////////////////////////////////
+    int wires = std::max(1, (fChannels + kPlanes - 1)/kPlanes);
+
+    // The shaped response for each plane.
+    std::vector< std::vector<double> > shapes(kPlanes);
+    for (int plane = 0; plane < kPlanes; ++plane) {
+        FillShape(context, CP::TMCChannelId(0,plane,0), shapes[plane]);
+    }
+
+    // The tracks are straight lines in wire and time.  The ends are given
+    // as fractions of the wire plane and of the digitization window.
+    std::vector<double> trackStartWire(fTracks);
+    std::vector<double> trackStopWire(fTracks);
+    std::vector<double> trackStartTime(fTracks);
+    std::vector<double> trackStopTime(fTracks);
+    for (int t = 0; t < fTracks; ++t) {
+        trackStartWire[t] = fRandom.Uniform();
+        trackStopWire[t] = fRandom.Uniform();
+        trackStartTime[t] = fRandom.Uniform(0.1,0.8);
+        trackStopTime[t] = fRandom.Uniform(0.1,0.8);
+    }
+
+    std::unique_ptr<CP::TDigitContainer> drift(
+        new CP::TDigitContainer("drift"));
+    std::vector<double> coherent(fSamples);
+    std::vector<double> phases(fLineFrequency.size());
+    std::vector<double> waveform(fSamples);
+    CP::TPulseDigit::Vector adc;
+    const double decay = 0.95;
+    const double kick = std::sqrt(1.0-decay*decay);
+    for (int c = 0; c < fChannels; ++c) {
+        int plane = c/wires;
+        int wire = c%wires;
+        CP::TMCChannelId channel(0,plane,wire);
+        double digitStep = calib.GetTimeConstant(channel,1);
+        double toADC = calib.GetGainConstant(channel,1)
+            *calib.GetDigitizerConstant(channel,1);
+
+        // Start a new group of channels with coherent noise.
+        if (fCoherentGroup < 1 || c%fCoherentGroup == 0) {
+            double v = fRandom.Gaus();
+            for (int i = 0; i < fSamples; ++i) {
+                v = decay*v + kick*fRandom.Gaus();
+                coherent[i] = fCoherentNoise*v;
+            }
+            for (std::size_t l = 0; l < phases.size(); ++l) {
+                phases[l] = fRandom.Uniform(2.0*M_PI);
+            }
+        }
+
+        double pedestal = fPedestal + fRandom.Uniform(-20.0,20.0);
+        for (int i = 0; i < fSamples; ++i) {
+            double v = pedestal + coherent[i];
+            v += fRandom.Gaus(0.0,fGaussianNoise);
+            for (std::size_t l = 0; l < phases.size(); ++l) {
+                double arg = 2.0*M_PI*fLineFrequency[l]*digitStep*i;
+                v += fLineAmplitude[l]*std::sin(arg + phases[l]);
+            }
+            waveform[i] = v;
+        }
+
+        // Add the track charge.
+        const std::vector<double>& shape = shapes[plane];
+        double w = (wire + 0.5)/wires;
+        for (int t = 0; t < fTracks; ++t) {
+            double w0 = std::min(trackStartWire[t],trackStopWire[t]);
+            double w1 = std::max(trackStartWire[t],trackStopWire[t]);
+            if (w < w0 || w1 < w) continue;
+            double f = 0.5;
+            if (w1 > w0) f = (w - trackStartWire[t])
+                             /(trackStopWire[t] - trackStartWire[t]);
+            double time = trackStartTime[t]
+                + f*(trackStopTime[t] - trackStartTime[t]);
+            int start = time*fSamples;
+            double q = fTrackCharge*toADC;
+            for (std::size_t k = 0; k < shape.size(); ++k) {
+                if (fSamples <= start + (int) k) break;
+                waveform[start+k] += q*shape[k];
+            }
+        }
+
+        Digitize(waveform, adc);
+        drift->push_back(new CP::TPulseDigit(channel,0,adc));
+    }
+    digits->AddDatum(drift.release());
+
+    ///////////////////////////////////////////////////////////////////////
+    // PMT channels.  Each PMT gets a few narrow pulses.
+    ///////////////////////////////////////////////////////////////////////
+    std::unique_ptr<CP::TDigitContainer> pmt(
+        new CP::TDigitContainer("pmt"));
+    for (int p = 0; p < fPMTs; ++p) {
+        CP::TMCChannelId channel(1,0,p);
+        for (int i = 0; i < fSamples; ++i) {
+            waveform[i] = fPedestal + fRandom.Gaus(0.0,fGaussianNoise);
+        }
+        for (int pulse = 0; pulse < 3; ++pulse) {
+            int start = fRandom.Integer(std::max(1,fSamples-10));
+            double height = fRandom.Uniform(100.0,1000.0);
+            for (int i = 0; i < 10 && start+i < fSamples; ++i) {
+                waveform[start+i] += height*std::exp(-0.5*i);
+            }
+        }
+        Digitize(waveform, adc);
+        pmt->push_back(new CP::TPulseDigit(channel,0,adc));
+    }
+    digits->AddDatum(pmt.release());
+
+    return event.release();
+}
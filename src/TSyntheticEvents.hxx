@@ -0,0 +1,146 @@
+#ifndef TSyntheticEvents_hxx_seen
+#define TSyntheticEvents_hxx_seen
+
+#include <TEvent.hxx>
+#include <TChannelId.hxx>
+
+#include <TRandom3.h>
+
+#include <vector>
+
+namespace CP {
+    class TSyntheticEvents;
+};
+
+/// Generate events with "drift" and "pmt" digit containers in memory so the
+/// calibration can be timed without an input file.  The drift channels are
+/// MC wire channels with a pedestal, uncorrelated Gaussian noise, coherent
+/// noise shared by groups of channels (like an ASIC), noise lines at fixed
+/// frequencies, and straight tracks that cross the channels.  The track
+/// charge is shaped with the TWireResponse and TElectronicsResponse for each
+/// channel, and converted to ADC counts with the channel calibration, so
+/// CP::TClusterCalib will find hits on the tracks.  The events are MC events
+/// (the drift channels don't need to be attached to a wire, so they should
+/// be calibrated with TClusterCalib::CalibrateAllChannels).  The random
+/// sequence is fixed by the seed, so the same events are generated for
+/// every job.
+/// \code
+/// CP::TSyntheticEvents generator;
+/// generator.SetChannels(2000);
+/// std::unique_ptr<CP::TEvent> event(generator.Generate(1));
+/// \endcode
+class CP::TSyntheticEvents {
+public:
+    TSyntheticEvents();
+    virtual ~TSyntheticEvents();
+
+    /// Generate an event.  The caller owns the event.
+    CP::TEvent* Generate(int eventNumber);
+
+    /// @{ Set (or Get) the number of drift channels.
+    void SetChannels(int n) {fChannels = n;}
+    int GetChannels() const {return fChannels;}
+    /// @}
+
+    /// @{ Set (or Get) the number of samples in each drift and PMT digit.
+    void SetSamples(int n) {fSamples = n;}
+    int GetSamples() const {return fSamples;}
+    /// @}
+
+    /// @{ Set (or Get) the number of PMT channels.
+    void SetPMTs(int n) {fPMTs = n;}
+    int GetPMTs() const {return fPMTs;}
+    /// @}
+
+    /// @{ Set (or Get) the pedestal in ADC counts.
+    void SetPedestal(double v) {fPedestal = v;}
+    double GetPedestal() const {return fPedestal;}
+    /// @}
+
+    /// @{ Set (or Get) the uncorrelated Gaussian noise in ADC counts.
+    void SetGaussianNoise(double v) {fGaussianNoise = v;}
+    double GetGaussianNoise() const {return fGaussianNoise;}
+    /// @}
+
+    /// @{ Set (or Get) the coherent noise in ADC counts.  The coherent noise
+    /// is a low frequency fluctuation shared by a group of channels.
+    void SetCoherentNoise(double v) {fCoherentNoise = v;}
+    double GetCoherentNoise() const {return fCoherentNoise;}
+    /// @}
+
+    /// @{ Set (or Get) the number of channels that share coherent noise.
+    void SetCoherentGroup(int n) {fCoherentGroup = n;}
+    int GetCoherentGroup() const {return fCoherentGroup;}
+    /// @}
+
+    /// Add a noise line with a frequency (in HEPUnits) and an amplitude in
+    /// ADC counts.  The phase is different for each coherent group.
+    void AddNoiseLine(double frequency, double amplitude);
+
+    /// Remove all of the noise lines.
+    void ClearNoiseLines() {fLineFrequency.clear(); fLineAmplitude.clear();}
+
+    /// @{ Set (or Get) the number of tracks in each event.
+    void SetTracks(int n) {fTracks = n;}
+    int GetTracks() const {return fTracks;}
+    /// @}
+
+    /// @{ Set (or Get) the charge deposited on each wire by a track (in
+    /// HEPUnits, so electrons are "unit::eplus").
+    void SetTrackCharge(double q) {fTrackCharge = q;}
+    double GetTrackCharge() const {return fTrackCharge;}
+    /// @}
+
+    /// Set the random seed.
+    void SetSeed(unsigned int seed) {fRandom.SetSeed(seed);}
+
+private:
+
+    /// Fill the shaped response for a channel.  The response is the wire
+    /// response convolved with the electronics response, and is truncated
+    /// once it becomes negligible.
+    void FillShape(const CP::TEventContext& context,
+                   const CP::TChannelId& channel,
+                   std::vector<double>& shape);
+
+    /// Convert a waveform (in ADC counts) into the samples of a digit.
+    template <typename vector>
+    void Digitize(const std::vector<double>& waveform, vector& adc);
+
+    /// The number of drift channels.
+    int fChannels;
+
+    /// The number of samples per digit.
+    int fSamples;
+
+    /// The number of PMTs.
+    int fPMTs;
+
+    /// The pedestal in ADC counts.
+    double fPedestal;
+
+    /// The uncorrelated noise in ADC counts.
+    double fGaussianNoise;
+
+    /// The coherent noise in ADC counts.
+    double fCoherentNoise;
+
+    /// The number of channels sharing the coherent noise.
+    int fCoherentGroup;
+
+    /// The frequency of each noise line.
+    std::vector<double> fLineFrequency;
+
+    /// The amplitude of each noise line in ADC counts.
+    std::vector<double> fLineAmplitude;
+
+    /// The number of tracks per event.
+    int fTracks;
+
+    /// The charge per wire for a track.
+    double fTrackCharge;
+
+    /// The random number generator.
+    TRandom3 fRandom;
+};
+#endif
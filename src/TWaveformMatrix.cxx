@@ -0,0 +1,56 @@
+#include "TWaveformMatrix.hxx"
+
+#include <TCalibPulseDigit.hxx>
+#include <TDigitContainer.hxx>
+
+#include <algorithm>
+#include <cstdint>
+
+CP::TWaveformMatrix::TWaveformMatrix()
+    : fData(NULL), fRows(0), fSamples(0), fStride(0) {}
+
+CP::TWaveformMatrix::~TWaveformMatrix() {}
+
+void CP::TWaveformMatrix::Resize(std::size_t rows, std::size_t samples) {
+    const std::size_t alignedFloats = kAlignment/sizeof(float);
+    fRows = rows;
+    fSamples = samples;
+    fStride = alignedFloats*((samples + alignedFloats - 1)/alignedFloats);
+
+    // Leave room to move the first row to an aligned address.
+    std::size_t size = fRows*fStride + alignedFloats;
+    if (fBuffer.size() < size) fBuffer.resize(size);
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&fBuffer[0]);
+    std::size_t offset = ((kAlignment - address%kAlignment)%kAlignment)
+        /sizeof(float);
+    fData = &fBuffer[0] + offset;
+    std::fill(fData, fData + fRows*fStride, 0.0);
+
+    fDigitIndex.assign(fRows, 0);
+    fChannelId.assign(fRows, CP::TChannelId());
+    fSampleCount.assign(fRows, 0);
+    fStartTime.assign(fRows, 0.0);
+    fStopTime.assign(fRows, 0.0);
+    fFlags.assign(fRows, 0);
+}
+
+void CP::TWaveformMatrix::SetRow(std::size_t row, std::size_t index,
+                                 const CP::TChannelId& id,
+                                 std::size_t sampleCount,
+                                 double startTime, double stopTime) {
+    fDigitIndex[row] = index;
+    fChannelId[row] = id;
+    fSampleCount[row] = std::min(sampleCount, fSamples);
+    fStartTime[row] = startTime;
+    fStopTime[row] = stopTime;
+    fFlags[row] |= kCalibrated;
+}
+
+CP::TCalibPulseDigit* CP::TWaveformMatrix::MakeDigit(
+    std::size_t row, const CP::TDigitContainer& drift) const {
+    const float* samples = GetRow(row);
+    CP::TCalibPulseDigit::Vector values(samples, samples + fSampleCount[row]);
+    CP::TDigitProxy proxy(drift, fDigitIndex[row]);
+    return new CP::TCalibPulseDigit(proxy, fStartTime[row], fStopTime[row],
+                                    values);
+}
@@ -0,0 +1,146 @@
+#ifndef TWaveformMatrix_hxx_seen
+#define TWaveformMatrix_hxx_seen
+
+#include <TChannelId.hxx>
+
+#include <vector>
+
+namespace CP {
+    class TWaveformMatrix;
+    class TCalibPulseDigit;
+    class TDigitContainer;
+};
+
+/// The calibrated drift waveforms for an event, kept as one contiguous
+/// buffer with a row of samples for each channel.  The rows start on 64 byte
+/// boundaries, and are padded with zeros past the last sample, so the stages
+/// that loop over the samples (or over pairs of channels) work on plain
+/// memory instead of through the TCalibPulseDigit accessors.  The channel
+/// id, the index of the raw digit in the drift container, the number of
+/// samples, the time range and a set of flags are kept in parallel arrays
+/// indexed by the row.  The buffer is reused between events, so it only
+/// grows.  A row can be turned back into a TCalibPulseDigit with MakeDigit
+/// when it needs to be saved or handed to code that works on digits.
+/// \code
+/// CP::TWaveformMatrix waveforms;
+/// waveforms.Resize(channels, samples);
+/// float* row = waveforms.GetRow(r);
+/// ... fill row[0] to row[samples-1] ...
+/// waveforms.SetRow(r, index, channelId, samples, startTime, stopTime);
+/// \endcode
+class CP::TWaveformMatrix {
+public:
+    /// The flags for a row.
+    enum {
+        /// The row has been filled with calibrated samples.
+        kCalibrated = 0x01,
+        /// The row has been replaced by the deconvolution.
+        kDeconvolved = 0x02,
+        /// The deconvolution found a noisy channel.
+        kNoisy = 0x04
+    };
+
+    /// The alignment of each row in bytes.
+    static const std::size_t kAlignment = 64;
+
+    TWaveformMatrix();
+    virtual ~TWaveformMatrix();
+
+    /// Set the number of rows and the maximum number of samples in a row.
+    /// All of the samples are set to zero and the flags are cleared.
+    void Resize(std::size_t rows, std::size_t samples);
+
+    /// Get the number of rows.
+    std::size_t GetRows() const {return fRows;}
+
+    /// Get the maximum number of samples in a row.
+    std::size_t GetSamples() const {return fSamples;}
+
+    /// Get the distance between the start of two rows (in samples).  This is
+    /// at least GetSamples().
+    std::size_t GetStride() const {return fStride;}
+
+    /// @{ Get the samples for a row.
+    float* GetRow(std::size_t row) {return fData + row*fStride;}
+    const float* GetRow(std::size_t row) const {return fData + row*fStride;}
+    /// @}
+
+    /// Set the description of a row after it has been filled.  The index is
+    /// the position of the raw digit in the drift container.  This sets the
+    /// kCalibrated flag.
+    void SetRow(std::size_t row, std::size_t index,
+                const CP::TChannelId& id, std::size_t sampleCount,
+                double startTime, double stopTime);
+
+    /// Get the index of the raw digit for a row.
+    std::size_t GetDigitIndex(std::size_t row) const {
+        return fDigitIndex[row];
+    }
+
+    /// Get the channel for a row.
+    const CP::TChannelId& GetChannelId(std::size_t row) const {
+        return fChannelId[row];
+    }
+
+    /// Get the number of samples filled for a row.
+    std::size_t GetSampleCount(std::size_t row) const {
+        return fSampleCount[row];
+    }
+
+    /// Get the time of the start of the first sample in a row.
+    double GetStartTime(std::size_t row) const {return fStartTime[row];}
+
+    /// Get the time of the end of the last sample in a row.
+    double GetStopTime(std::size_t row) const {return fStopTime[row];}
+
+    /// @{ Get, set, or clear the flags for a row.
+    int GetFlags(std::size_t row) const {return fFlags[row];}
+    bool HasFlag(std::size_t row, int flag) const {
+        return (fFlags[row] & flag) != 0;
+    }
+    void SetFlag(std::size_t row, int flag) {fFlags[row] |= flag;}
+    void ClearFlag(std::size_t row, int flag) {fFlags[row] &= ~flag;}
+    /// @}
+
+    /// Make a calibrated digit from the samples in a row.  The parent of the
+    /// digit is the raw digit in the drift container the row was filled
+    /// from.  The caller owns the digit.
+    CP::TCalibPulseDigit* MakeDigit(std::size_t row,
+                                    const CP::TDigitContainer& drift) const;
+
+private:
+
+    /// The memory for the samples.  This has room for the alignment.
+    std::vector<float> fBuffer;
+
+    /// The first row (aligned inside of fBuffer).
+    float* fData;
+
+    /// The number of rows.
+    std::size_t fRows;
+
+    /// The maximum number of samples in a row.
+    std::size_t fSamples;
+
+    /// The distance between rows.
+    std::size_t fStride;
+
+    /// The index of the raw digit for each row.
+    std::vector<std::size_t> fDigitIndex;
+
+    /// The channel for each row.
+    std::vector<CP::TChannelId> fChannelId;
+
+    /// The number of samples filled in each row.
+    std::vector<std::size_t> fSampleCount;
+
+    /// The start time for each row.
+    std::vector<double> fStartTime;
+
+    /// The stop time for each row.
+    std::vector<double> fStopTime;
+
+    /// The flags for each row.
+    std::vector<int> fFlags;
+};
+#endif
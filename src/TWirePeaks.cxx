@@ -1,6 +1,7 @@
 #include "TWirePeaks.hxx"
 #include "TMakeWireHit.hxx"
 #include "TChannelCalib.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
@@ -194,6 +195,9 @@ double CP::TWirePeaks::operator() (CP::THitSelection& hits,
         fWork.resize(deconv.GetSampleCount());
     }
     
+    // The channel information is shared by all of the threads, so it's
+    // used for the context of this event while holding the lock.
+    CP::TChannelInfoLock lock(fContext);
     CP::TChannelCalib channelCalib;
     bool wireIsBipolar = channelCalib.IsBipolarSignal(deconv.GetChannelId());
 
@@ -235,6 +239,7 @@ double CP::TWirePeaks::operator() (CP::THitSelection& hits,
     histTitle << "-" << CP::GeomId::Captain::GetWireNumber(id)
               << " (" << deconv.GetChannelId().AsString() << ")";
 #endif
+    lock.Unlock();
 
     // Find the magnitude of noise for this channel.
     for (std::size_t i = 0; i<deconv.GetSampleCount(); ++i) {
@@ -362,6 +367,7 @@ double CP::TWirePeaks::operator() (CP::THitSelection& hits,
 
     // Make all the hits.  
     CP::TMakeWireHit makeHit(fCorrectCollectionEfficiency);
+    makeHit.SetContext(fContext);
     for(std::vector< std::pair<int,int> >::iterator p = peaks.begin();
         p != peaks.end(); ++p) {
         CP::THandle<CP::THit> newHit
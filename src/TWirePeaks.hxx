@@ -3,6 +3,7 @@
 
 #include <THitSelection.hxx>
 #include <TCalibPulseDigit.hxx>
+#include <TEventContext.hxx>
 
 namespace CP {
     class TWirePeaks;
@@ -32,6 +33,11 @@ public:
                         const CP::TCalibPulseDigit& deconv,
                         double t0);
 
+    /// Set the context of the event being processed.  The channel
+    /// information and calibration for the wires are looked up for this
+    /// context.
+    void SetContext(const CP::TEventContext& context) {fContext = context;}
+
 private:
 
     /// Determine the bounds of the peak.  This returns a pair with the first
@@ -51,6 +57,9 @@ private:
     /// constructor.
     bool fCorrectCollectionEfficiency;
 
+    /// The context of the event being processed.
+    CP::TEventContext fContext;
+
     /// A buffer for local work.
     std::vector<float> fWork;
 
@@ -1,4 +1,7 @@
 #include "TWireResponse.hxx"
+#include "TFFTPlans.hxx"
+#include "TFFTBatch.hxx"
+#include "TChannelInfoLock.hxx"
 
 #include <TEvent.hxx>
 #include <TEventFolder.hxx>
@@ -10,55 +13,67 @@
 #include <TChannelCalib.hxx>
 #include <EClusterCalib.hxx>
 
-#include <TVirtualFFT.h>
 #include <TH1F.h>
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 
 CP::TWireResponse::TWireResponse() 
-    : fMustRecalculate(true), fWireClass(kDeltaFunction) {}
+    : fMustRecalculate(true), fWireClass(kDeltaFunction), fSize(0) {}
 
 CP::TWireResponse::TWireResponse(int size) 
-    : fMustRecalculate(true), fWireClass(kDeltaFunction) {
-    fResponse.resize(size);
-    fFrequency.resize(size);
-}
+    : fMustRecalculate(true), fWireClass(kDeltaFunction), fSize(size) {}
 
 CP::TWireResponse::~TWireResponse() { }
 
 void CP::TWireResponse::SetSize(int s) {
-    if (s == (int) fResponse.size()) return;
+    if (s == fSize) return;
     fMustRecalculate = true;
-    fResponse.resize(s);
-    fFrequency.resize(s);
+    fSize = s;
+    fKey.clear();
+    fEntry.reset();
 }
 
 CP::TWireResponse::Response
 CP::TWireResponse::GetResponse(int i) {
     if (i<0) return 0.0;
-    if ((int) fResponse.size() <= i) return 0.0;
-    if (fMustRecalculate) Calculate();
-    return fResponse[i];
+    if (fSize <= i) return 0.0;
+    Calculate();
+    return fEntry->fResponse[i];
 }
 
 CP::TWireResponse::Frequency 
 CP::TWireResponse::GetFrequency(int i) {
     if (i<0) return Frequency(0,0);
-    if ((int) fFrequency.size() <= i) return Frequency(0,0);
-    if (fMustRecalculate) Calculate();
-    return fFrequency[i];
+    if ((int) GetFrequencyCount() <= i) return Frequency(0,0);
+    Calculate();
+    return fEntry->fFrequency[i];
+}
+
+CP::TResponseBank::Key CP::TWireResponse::MakeKey() {
+    CP::TResponseBank::Key key;
+    key.push_back(1); // The wire responses.
+    key.push_back(fSize);
+    key.push_back(fWireClass);
+    // Only the derivative depends on the time per sample.
+    if (fWireClass == kTimeDerivative) {
+        CP::TChannelInfoLock lock(fEventContext);
+        CP::TChannelCalib calib;
+        key.push_back(calib.GetTimeConstant(fChannelId));
+    }
+    return key;
 }
 
 bool CP::TWireResponse::Calculate() {
+    if (!fMustRecalculate && fEntry) return false;
     fMustRecalculate = false;
+    if (fKey.empty()) fKey = MakeKey();
 
-    CP::TChannelCalib calib;
-
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        fResponse[i] = 0;
-        fFrequency[i] = Frequency(1,0); // Initialize, will be overwritten.
-    }
+    std::shared_ptr<CP::TResponseBank::Entry> entry(
+        new CP::TResponseBank::Entry);
+    std::vector<Response>& response = entry->fResponse;
+    response.assign(fSize, 0.0);
 
     // Fill the response function.  This explicitly normalizes.
     switch (fWireClass) {
@@ -67,7 +82,7 @@ bool CP::TWireResponse::Calculate() {
         // Use a delta function in time for the wire response.  This is an
         // appropriate approximation for the collection wires (i.e. the X
         // plane).
-        fResponse[0] = 1;
+        response[0] = 1;
         break;
     case kTimeDerivative:
         CaptLog("Calculate differential function wire response");
@@ -75,11 +90,17 @@ bool CP::TWireResponse::Calculate() {
         // This is appropriate for the induction wires (i.e. the U and V
         // planes).
         {
+            double step;
+            {
+                CP::TChannelInfoLock lock(fEventContext);
+                CP::TChannelCalib calib;
+                step = calib.GetTimeConstant(fChannelId);
+            }
             double norm = 1.0/std::sqrt(2.0);
             // Correct for the bin size.
-            norm *= calib.GetTimeConstant(fChannelId)/(1*unit::microsecond);
-            fResponse[0] = -1.0/norm;
-            fResponse[fResponse.size()-1] = 1.0/norm;
+            norm *= step/(1*unit::microsecond);
+            response[0] = -1.0/norm;
+            response[response.size()-1] = 1.0/norm;
         }
         break;
     default:
@@ -88,46 +109,46 @@ bool CP::TWireResponse::Calculate() {
     }
 
     // Calculate the FFT of the response 
-    int size = fResponse.size();
-    std::unique_ptr<TVirtualFFT> fft(TVirtualFFT::FFT(1,&size,"R2C ES K"));
-    if (size != (int) fResponse.size()) {
-        CaptError("Invalid length for FFT");
-        CaptError("     original length: " << fResponse.size());
-        CaptError("     allocated length: " << size);
-    }
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        fft->SetPoint(i,fResponse[i]);
-    }
-    fft->Transform();
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        double rl,im;
-        fft->GetPointComplex(i,rl,im);
-        fFrequency[i] = std::complex<double>(rl,im);
-    }
+    CP::TFFTBatch* fft = CP::TFFTPlans::Get().AcquireBatch(fSize, 1, false);
+    std::copy(response.begin(), response.end(), fft->GetReal(0));
+    fft->Forward();
+    const CP::TFFTBatch::Complex* freq = fft->GetComplex(0);
+    std::vector<Frequency>& frequency = entry->fFrequency;
+    frequency.assign(freq, freq + GetFrequencyCount());
+    CP::TFFTPlans::Get().Release(fft);
 
     // The wire response is symetric around zero, so there is no offset.  That
     // means that the "zero" frequency is zero power, and the deconvolution
     // blows up with a divide by zero.  Fix that by adding an artificial
     // offset.  The offset will be removed later.
-    fFrequency[0] = fFrequency[1];
+    frequency[0] = frequency[1];
+
+    entry->fMagnitude.resize(frequency.size());
+    for (std::size_t i=0; i<frequency.size(); ++i) {
+        entry->fMagnitude[i] = std::abs(frequency[i]);
+    }
+
+    // Share the response with the other channels that have the same
+    // constants.
+    fEntry = CP::TResponseBank::Get().Add(fKey, entry);
 
 #ifdef FILL_HISTOGRAM
 #undef FILL_HISTOGRAM
     TH1F* elecResp = new TH1F(
         (fChannelId.AsString()+"-wire").c_str(),
         ("Wire Response for " + fChannelId.AsString()).c_str(),
-        fResponse.size(),
-        0.0, 1.0*fResponse.size());
-    for (std::size_t i=0; i<fResponse.size(); ++i) {
-        elecResp->Fill(i+0.5, fResponse[i]);
+        response.size(),
+        0.0, 1.0*response.size());
+    for (std::size_t i=0; i<response.size(); ++i) {
+        elecResp->Fill(i+0.5, response[i]);
     }
     TH1F* elecFreq = new TH1F(
         (fChannelId.AsString()+"-wireFFT").c_str(),
         ("FFT of the Wire Response for" + fChannelId.AsString()).c_str(),
-        fFrequency.size(),
-        0.0, 1.0*fFrequency.size());
-    for (std::size_t i=0; i<fFrequency.size(); ++i) {
-        elecFreq->Fill(i+0.5, std::abs(fFrequency[i]));
+        frequency.size(),
+        0.0, 1.0*frequency.size());
+    for (std::size_t i=0; i<frequency.size(); ++i) {
+        elecFreq->Fill(i+0.5, entry->fMagnitude[i]);
     }
 #endif
     return true;
@@ -138,16 +159,22 @@ bool CP::TWireResponse::Calculate(const CP::TEventContext& context,
     fEventContext = context;
     fChannelId = channel;
 
-
-    CP::TChannelCalib calib;
-    if (calib.IsBipolarSignal(channel) && fWireClass != kTimeDerivative) {
-        fWireClass = kTimeDerivative;
-        fMustRecalculate = true;
-    }
-    if (not calib.IsBipolarSignal(channel) && fWireClass != kDeltaFunction) {
-        fWireClass = kDeltaFunction;
-        fMustRecalculate = true;
+    bool bipolar;
+    {
+        CP::TChannelInfoLock lock(context);
+        CP::TChannelCalib calib;
+        bipolar = calib.IsBipolarSignal(channel);
     }
-
+    if (bipolar) fWireClass = kTimeDerivative;
+    else fWireClass = kDeltaFunction;
+
+    // The response only changes if the constants for the channel are
+    // different.  A response for the constants that was already calculated
+    // (by any channel or thread) is taken from the bank.
+    CP::TResponseBank::Key key = MakeKey();
+    if (fEntry && key == fKey) return false;
+    fKey = key;
+    fEntry = CP::TResponseBank::Get().Find(fKey);
+    fMustRecalculate = !fEntry;
     return true;
 }
@@ -1,11 +1,15 @@
 #ifndef TWireResponse_hxx_seen
 #define TWireResponse_hxx_seen
 
+#include "TResponseBank.hxx"
+
 #include <TEventContext.hxx>
 #include <TChannelId.hxx>
 #include <HEPUnits.hxx>
 
 #include <complex>
+#include <memory>
+#include <vector>
 
 namespace CP {
     class TWireResponse;
@@ -33,7 +37,7 @@ public:
 
     /// @{ Set (or Get) the number of samples.
     void SetSize(int s);
-    std::size_t GetSize() const {return fResponse.size();}
+    std::size_t GetSize() const {return fSize;}
     /// @}
 
     /// Get the response for a time bin.  This returns 0.0 if the bin is out
@@ -41,10 +45,15 @@ public:
     /// vector size).
     double GetResponse(int i);
 
-    /// Get the FFT for a frequency bin.  This returns 0+0*i if the bin is out
-    /// of the frequency range.
+    /// Get the FFT for a frequency bin.  The response is real, so only the
+    /// non-negative frequencies (bins 0 to GetSize()/2) are kept, and the
+    /// negative frequencies are their complex conjugates.  This returns
+    /// 0+0*i if the bin is out of the frequency range.
     Frequency GetFrequency(int i);
 
+    /// Get the number of frequency bins that are kept (GetSize()/2+1).
+    std::size_t GetFrequencyCount() const {return fSize/2+1;}
+
     /// Get the event context of the last event for which the response
     /// function was calculated.
     const CP::TEventContext& GetEventContext() const {return fEventContext;}
@@ -55,14 +64,23 @@ public:
 
     /// Calculate the delta function response for a particular
     /// CP::TEventContext and CP::TChannelId.  This also calculates the FFT
-    /// for use in a convolution or deconvolution.  This returns true if the
-    /// response function will be recalculated, but doesn't do the actual
-    /// recalculation.  The recalculation will be done on the first call to
+    /// for use in a convolution or deconvolution.  The responses are kept
+    /// in the CP::TResponseBank keyed by the wire class (and the time per
+    /// sample), so a response is only calculated once for each class.
+    /// This returns true if the response changed.  If the response isn't in
+    /// the bank, the recalculation is done on the first call to
     /// GetResponse, or GetFrequency.
     bool Calculate(const CP::TEventContext& context, const CP::TChannelId id);
 
-    /// Actually fill the frequency from the response.
+    /// Actually fill the frequency from the response, and add it to the
+    /// response bank.
     bool Calculate();
+
+    /// Get the response that is being used.  The response is shared with
+    /// the other channels that have the same constants.
+    std::shared_ptr<const CP::TResponseBank::Entry> GetEntry() const {
+        return fEntry;
+    }
     
 private:
 
@@ -80,10 +98,18 @@ private:
     enum {kDeltaFunction, kTimeDerivative};
     int fWireClass;
 
-    /// The response distribution
-    std::vector<Response> fResponse;
+    /// Make the key for the response bank from the wire class and the
+    /// constants for the current channel.
+    CP::TResponseBank::Key MakeKey();
+
+    /// The number of samples in the response.
+    int fSize;
+
+    /// The key for the current response.
+    CP::TResponseBank::Key fKey;
 
-    /// The frequency distribution
-    std::vector<Frequency> fFrequency;
+    /// The response distribution, the frequency distribution for the
+    /// non-negative frequencies, and the magnitude of the frequencies.
+    std::shared_ptr<const CP::TResponseBank::Entry> fEntry;
 };
 #endif
@@ -8,21 +8,26 @@
 namespace CP {
 
     /// Calculated the truncated RMS for the samples between begin and end.
+    /// The work vector is used as scratch space so that a caller can reuse
+    /// it between calls (each thread needs its own).  This has a different
+    /// name than the version with a temporary work area so a double
+    /// variable for "trunc" can't be taken as the work vector.
     /// \code
     /// const CP::TPulseDigit* pulse = digit.As<const CP::TPulseDigit>();
+    /// std::vector<double> work;
     /// std::pair<double,double> avgRMS
-    ///          = CP::TruncatedRMS(pulse->begin(), pulse->end());
+    ///          = CP::TruncatedRMSWork(pulse->begin(), pulse->end(), work);
     /// std::cout << "Average " << avgRMS.first << "  RMS " << avgRMS.second
     ///           << std::endl;
     /// \endcode
-    template <typename iter>
-    std::pair<double,double> TruncatedRMS(iter begin, iter end,
-                                          double trunc=0.05) {
+    template <typename iter, typename work_vector>
+    std::pair<double,double> TruncatedRMSWork(iter begin, iter end,
+                                              work_vector& work,
+                                              double trunc=0.05) {
         std::size_t length = end - begin;
         std::size_t lowBound = trunc*length;
         std::size_t highBound = (1.0-trunc)*length;
         if (highBound < lowBound+1) return std::pair<double,double>(0.0,0.0);
-        static std::vector<typename iter::value_type> work;
         if (work.capacity() < length) work.reserve(length);
         work.clear();
         std::copy(begin,end,std::back_inserter(work));
@@ -30,10 +35,8 @@ namespace CP {
         double average = 0.0;
         double rms = 0.0;
         double norm = 0.0;
-        typename std::vector<typename iter::value_type>::iterator first
-            = work.begin() + lowBound;
-        typename std::vector<typename iter::value_type>::iterator last
-            = work.begin() + highBound;
+        typename work_vector::iterator first = work.begin() + lowBound;
+        typename work_vector::iterator last = work.begin() + highBound;
         while (first != last) {
             average += *first;
             rms += (*first)*(*first);
@@ -47,5 +50,13 @@ namespace CP {
         else rms = - std::sqrt(-rms);
         return std::pair<double,double>(average,rms);
     }
+
+    /// Calculated the truncated RMS using a temporary work area.
+    template <typename iter>
+    std::pair<double,double> TruncatedRMS(iter begin, iter end,
+                                          double trunc=0.05) {
+        std::vector<typename iter::value_type> work;
+        return TruncatedRMSWork(begin, end, work, trunc);
+    }
 }
 #endif